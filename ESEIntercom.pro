@@ -28,7 +28,30 @@ HEADERS += audioplayback.h \
     audiofilterbuffer.h \
     phonebook.h \
     streambuffer.h \
-    userlist.h
+    userlist.h \
+    adpcm.h \
+    audiocodec.h \
+    g711.h \
+    vad.h \
+    ratecontroller.h \
+    jitterbuffer.h \
+    plc.h \
+    broadcastqueue.h \
+    streammixer.h \
+    recordingstore.h \
+    broadcastencoder.h \
+    broadcastbuffer.h \
+    audioendpoint.h \
+    simulatedclock.h \
+    headlessendpoint.h \
+    latencymonitor.h \
+    fft.h \
+    echocanceller.h \
+    resampler.h \
+    noisesuppressor.h \
+    levelmeter.h \
+    messagepool.h \
+    loopbackport.h
 FORMS += audiosettings.ui mainwindow.ui serialsettings.ui \
     advancedsettings.ui
 SOURCES += audioplayback.cpp \
@@ -43,6 +66,29 @@ SOURCES += audioplayback.cpp \
     audiofilterbuffer.cpp \
     phonebook.cpp \
     streambuffer.cpp \
-    userlist.cpp
+    userlist.cpp \
+    adpcm.cpp \
+    audiocodec.cpp \
+    g711.cpp \
+    vad.cpp \
+    ratecontroller.cpp \
+    jitterbuffer.cpp \
+    plc.cpp \
+    broadcastqueue.cpp \
+    streammixer.cpp \
+    recordingstore.cpp \
+    broadcastencoder.cpp \
+    broadcastbuffer.cpp \
+    audioendpoint.cpp \
+    simulatedclock.cpp \
+    headlessendpoint.cpp \
+    latencymonitor.cpp \
+    fft.cpp \
+    echocanceller.cpp \
+    resampler.cpp \
+    noisesuppressor.cpp \
+    levelmeter.cpp \
+    messagepool.cpp \
+    loopbackport.cpp
 
 RESOURCES += intercom.qrc
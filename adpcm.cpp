@@ -0,0 +1,197 @@
+
+/**
+    @file adpcm.cpp
+    @breif IMA ADPCM Encode and Decode
+    @author Natesh Narain
+*/
+
+#include "adpcm.h"
+
+#define ADPCM_CHANNEL_HEADER 4 ///< predictor (2), index (1), reserved (1)
+#define ADPCM_BLOCK_HEADER   4 ///< number of frames in the block
+
+static const int8_t _indexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t _stepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static void _adpcmupdate(uint8_t nibble, AdpcmState* state);
+
+void adpcmreset(AdpcmState* state)
+{
+    state->predictor = 0;
+    state->index = 0;
+}
+
+uint8_t adpcmencodesample(int16_t sample, AdpcmState* state)
+{
+    int diff = sample - state->predictor;
+    int step = _stepTable[state->index];
+    uint8_t nibble = 0;
+
+    if(diff < 0){
+        nibble = 8;
+        diff = -diff;
+    }
+
+    // quantize the difference against the step size
+    if(diff >= step){
+        nibble |= 4;
+        diff -= step;
+    }
+    step >>= 1;
+    if(diff >= step){
+        nibble |= 2;
+        diff -= step;
+    }
+    step >>= 1;
+    if(diff >= step){
+        nibble |= 1;
+    }
+
+    // track the prediction exactly as the decoder will
+    _adpcmupdate(nibble, state);
+
+    return nibble;
+}
+
+int16_t adpcmdecodesample(uint8_t nibble, AdpcmState* state)
+{
+    _adpcmupdate(nibble & 0x0F, state);
+    return state->predictor;
+}
+
+static void _adpcmupdate(uint8_t nibble, AdpcmState* state)
+{
+    int step = _stepTable[state->index];
+    int predictor = state->predictor;
+    int index;
+
+    int diff = step >> 3;
+    if(nibble & 4) diff += step;
+    if(nibble & 2) diff += step >> 1;
+    if(nibble & 1) diff += step >> 2;
+
+    if(nibble & 8)
+        predictor -= diff;
+    else
+        predictor += diff;
+
+    if(predictor > INT16_MAX) predictor = INT16_MAX;
+    if(predictor < INT16_MIN) predictor = INT16_MIN;
+
+    index = state->index + _indexTable[nibble];
+    if(index < 0) index = 0;
+    if(index > 88) index = 88;
+
+    state->predictor = (int16_t)predictor;
+    state->index = (int8_t)index;
+}
+
+int adpcmblocksize(int numFrames, int channels)
+{
+    return ADPCM_BLOCK_HEADER + (ADPCM_CHANNEL_HEADER * channels) + ((numFrames * channels) + 1) / 2;
+}
+
+int adpcmencode(const int16_t* inBuffer, int numFrames, int channels, uint8_t* outBuffer, int outLen)
+{
+    AdpcmState state[ADPCM_MAX_CHANNELS];
+    int i, c, outIdx = 0;
+    int numSamples = numFrames * channels;
+
+    if(channels < 1 || channels > ADPCM_MAX_CHANNELS) return 0;
+    if(adpcmblocksize(numFrames, channels) > outLen) return 0;
+
+    // block header
+    outBuffer[outIdx++] = (uint8_t)(numFrames);
+    outBuffer[outIdx++] = (uint8_t)(numFrames >> 8);
+    outBuffer[outIdx++] = (uint8_t)(numFrames >> 16);
+    outBuffer[outIdx++] = (uint8_t)(numFrames >> 24);
+
+    // the first sample of each channel seeds its predictor
+    for(c = 0; c < channels; ++c){
+        adpcmreset(&state[c]);
+        if(numFrames > 0) state[c].predictor = inBuffer[c];
+
+        outBuffer[outIdx++] = (uint8_t)(state[c].predictor);
+        outBuffer[outIdx++] = (uint8_t)(state[c].predictor >> 8);
+        outBuffer[outIdx++] = (uint8_t)(state[c].index);
+        outBuffer[outIdx++] = 0;
+    }
+
+    // pack two codes per byte
+    for(i = 0; i < numSamples; i += 2){
+        uint8_t lo = adpcmencodesample(inBuffer[i], &state[i % channels]);
+        uint8_t hi = 0;
+
+        if(i + 1 < numSamples)
+            hi = adpcmencodesample(inBuffer[i + 1], &state[(i + 1) % channels]);
+
+        outBuffer[outIdx++] = lo | (hi << 4);
+    }
+
+    return outIdx;
+}
+
+int adpcmframes(const uint8_t* inBuffer, int inLen, int channels)
+{
+    uint32_t numFrames;
+
+    if(channels < 1 || channels > ADPCM_MAX_CHANNELS) return 0;
+    if(inLen < ADPCM_BLOCK_HEADER + ADPCM_CHANNEL_HEADER * channels) return 0;
+
+    numFrames = (uint32_t)inBuffer[0] | ((uint32_t)inBuffer[1] << 8) | ((uint32_t)inBuffer[2] << 16) | ((uint32_t)inBuffer[3] << 24);
+
+    // reject a frame count the block can not hold
+    if(numFrames > (uint32_t)(inLen - ADPCM_BLOCK_HEADER - ADPCM_CHANNEL_HEADER * channels) * 2 / channels) return 0;
+
+    return (int)numFrames;
+}
+
+int adpcmdecode(const uint8_t* inBuffer, int inLen, int channels, int16_t* outBuffer, int maxFrames)
+{
+    AdpcmState state[ADPCM_MAX_CHANNELS];
+    int i, c, inIdx;
+    int numFrames = adpcmframes(inBuffer, inLen, channels);
+    int numSamples;
+
+    if(numFrames > maxFrames) numFrames = maxFrames;
+
+    // a short or corrupt block has no channel headers to read
+    if(numFrames <= 0) return 0;
+
+    numSamples = numFrames * channels;
+
+    inIdx = ADPCM_BLOCK_HEADER;
+
+    for(c = 0; c < channels; ++c){
+        state[c].predictor = (int16_t)(inBuffer[inIdx] | (inBuffer[inIdx + 1] << 8));
+        state[c].index = (int8_t)inBuffer[inIdx + 2];
+        if(state[c].index < 0 || state[c].index > 88) state[c].index = 0;
+
+        inIdx += ADPCM_CHANNEL_HEADER;
+    }
+
+    for(i = 0; i < numSamples; i += 2){
+        uint8_t byte = inBuffer[inIdx++];
+
+        outBuffer[i] = adpcmdecodesample(byte & 0x0F, &state[i % channels]);
+
+        if(i + 1 < numSamples)
+            outBuffer[i + 1] = adpcmdecodesample(byte >> 4, &state[(i + 1) % channels]);
+    }
+
+    return numFrames;
+}
@@ -0,0 +1,114 @@
+
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stdint.h>
+
+#define ADPCM_MAX_CHANNELS 2 ///< Maximum number of interleaved channels in a block
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+//! Predictor state of one channel
+typedef struct adpcmState{
+    int16_t predictor; ///< last predicted sample
+    int8_t  index;     ///< index into the step size table
+}AdpcmState;
+
+/**
+    Reset a channel state
+
+    @param state
+        The state to reset
+*/
+void adpcmreset(AdpcmState* state);
+
+/**
+    Encode a single 16 bit sample
+
+    @param sample
+        The sample to encode
+
+    @param state
+        The channel state, updated with the new prediction
+
+    @return the 4 bit code
+*/
+uint8_t adpcmencodesample(int16_t sample, AdpcmState* state);
+
+/**
+    Decode a single 4 bit code
+
+    @param nibble
+        The 4 bit code
+
+    @param state
+        The channel state, updated with the new prediction
+
+    @return the decoded sample
+*/
+int16_t adpcmdecodesample(uint8_t nibble, AdpcmState* state);
+
+/**
+    @return the size of an encoded block holding the given number of frames
+*/
+int adpcmblocksize(int numFrames, int channels);
+
+/**
+    IMA ADPCM encode a block of interleaved 16 bit samples.
+
+    The block starts with the frame count and the initial state of each channel so it can be decoded
+    on its own. The samples follow as 4 bit codes, two per byte, low nibble first.
+
+    @param inBuffer
+        Interleaved 16 bit samples
+
+    @param numFrames
+        Number of sample frames (samples per channel)
+
+    @param channels
+        Number of interleaved channels
+
+    @param outBuffer
+        Buffer to put the encoded block
+
+    @param outLen
+        Max output buffer length
+
+    @return the length of the block, 0 if the output buffer is too small
+*/
+int adpcmencode(const int16_t* inBuffer, int numFrames, int channels, uint8_t* outBuffer, int outLen);
+
+/**
+    @return the number of sample frames in an encoded block, 0 if the block is invalid
+*/
+int adpcmframes(const uint8_t* inBuffer, int inLen, int channels);
+
+/**
+    IMA ADPCM decode a block
+
+    @param inBuffer
+        The encoded block
+
+    @param inLen
+        Length of the encoded block
+
+    @param channels
+        Number of interleaved channels
+
+    @param outBuffer
+        Buffer to put the interleaved 16 bit samples
+
+    @param maxFrames
+        Max number of sample frames the output buffer holds
+
+    @return number of sample frames decoded
+*/
+int adpcmdecode(const uint8_t* inBuffer, int inLen, int channels, int16_t* outBuffer, int maxFrames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADPCM_H
@@ -22,6 +22,9 @@ AdvancedSettings::AdvancedSettings(QWidget *parent) :
     connect(ui->bnCancel, SIGNAL(clicked()), this, SLOT(close()));
 
     _settings.bDecodeOpts = 0;
+    _settings.bAudioCodec = AUDIO_CODEC_PCM;
+    _settings.adaptiveStreamRate = false;
+    _settings.stationId = STATION_ID_AUTO;
 
     loadSettings();
 }
@@ -55,6 +58,9 @@ void AdvancedSettings::loadSettings()
         bool XOR = _json[ENCRYPTION_XOR].toBool();
         bool huff = _json[COMPRESSION_HUFF].toBool();
         bool rle = _json[COMPRESSION_RLE].toBool();
+        bool adpcm = _json[COMPRESSION_ADPCM].toBool();
+        bool adaptive = _json[ADAPTIVE_STREAM_RATE].toBool();
+        int stationId = _json[STATION_ID].toInt(STATION_ID_AUTO);
 
         if(useHeader){
             ui->rbPacketFrame->setChecked(true);
@@ -79,6 +85,19 @@ void AdvancedSettings::loadSettings()
             setbit(_settings.bDecodeOpts, COMPRESS_TYPE_RLE);
         }
 
+        if(adpcm){
+            ui->cbCompressADPCM->setChecked(true);
+            _settings.bAudioCodec = AUDIO_CODEC_IMA_ADPCM;
+        }
+
+        if(adaptive){
+            ui->cbAdaptiveStreamRate->setChecked(true);
+            _settings.adaptiveStreamRate = true;
+        }
+
+        _settings.stationId = (stationId >= 0 && stationId <= UINT8_MAX) ? stationId : STATION_ID_AUTO;
+        ui->sbStationId->setValue(_settings.stationId);
+
         file.close();
     }
 }
@@ -95,12 +114,20 @@ void AdvancedSettings::updateSettings()
     else
         clearbit(_settings.bDecodeOpts, COMPRESS_TYPE_RLE);
 
+    if(ui->cbCompressADPCM->isChecked())
+        _settings.bAudioCodec = AUDIO_CODEC_IMA_ADPCM;
+    else
+        _settings.bAudioCodec = AUDIO_CODEC_PCM;
+    _settings.adaptiveStreamRate = false;
+
     if(ui->cbEncryptXOR->isChecked())
         setbit(_settings.bDecodeOpts, ENCRYPT_TYPE_XOR);
     else
         clearbit(_settings.bDecodeOpts, ENCRYPT_TYPE_XOR);
 
     _settings.useHeader = ui->rbPacketFrame->isChecked();
+    _settings.adaptiveStreamRate = ui->cbAdaptiveStreamRate->isChecked();
+    _settings.stationId = ui->sbStationId->value();
 }
 
 void AdvancedSettings::saveSettings()
@@ -112,6 +139,9 @@ void AdvancedSettings::saveSettings()
     _json[COMPRESSION_HUFF] = (isBitSet(_settings.bDecodeOpts, COMPRESS_TYPE_HUFF)) ? true : false;
     _json[COMPRESSION_RLE] = (isBitSet(_settings.bDecodeOpts, COMPRESS_TYPE_RLE)) ? true : false;
     _json[ENCRYPTION_XOR] = (isBitSet(_settings.bDecodeOpts, ENCRYPT_TYPE_XOR)) ? true : false;
+    _json[COMPRESSION_ADPCM] = (_settings.bAudioCodec == AUDIO_CODEC_IMA_ADPCM);
+    _json[ADAPTIVE_STREAM_RATE] = _settings.adaptiveStreamRate;
+    _json[STATION_ID] = _settings.stationId;
 
     QFile file(FILE_ADVANCED_CONFIG);
     file.open(QIODevice::WriteOnly | QIODevice::Text);
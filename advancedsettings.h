@@ -14,6 +14,11 @@
 #define ENCRYPTION_XOR  "EncryptionXOR"
 #define COMPRESSION_HUFF "CompressionHuff"
 #define COMPRESSION_RLE "CompressionRLE"
+#define COMPRESSION_ADPCM "CompressionADPCM"
+#define ADAPTIVE_STREAM_RATE "AdaptiveStreamRate"
+#define STATION_ID "StationId"
+
+#define STATION_ID_AUTO -1 ///< station id picked when each session opens
 
 namespace Ui {
 class AdvancedSettings;
@@ -34,6 +39,9 @@ public:
     struct Settings{
         bool useHeader;      ///< Send data in packets
         uint8_t bDecodeOpts; ///< Packet decode option
+        uint8_t bAudioCodec; ///< Codec used for audio messages and streams
+        bool adaptiveStreamRate; ///< Adapt the stream codec and sample rate to the link
+        int stationId;       ///< Id this station sends with, or STATION_ID_AUTO
     };
 
     /**
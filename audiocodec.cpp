@@ -0,0 +1,411 @@
+
+/**
+    @file audiocodec.cpp
+    @breif Audio codec stage between the audio devices and the serial port
+    @author Natesh Narain
+*/
+
+#include "audiocodec.h"
+
+#include <QDebug>
+
+#include "adpcm.h"
+#include "g711.h"
+#include "vad.h"
+
+//! G.711 law of a companding codec
+#define G711_LAW(codec) (((codec) == AUDIO_CODEC_ALAW) ? G711_ALAW : G711_ULAW)
+
+#define SILENCE_MAX_MS 4000 ///< longest silence a descriptor may cover, the jitter buffer's largest delay
+
+AudioCodec::AudioCodec()
+{
+    _sampleSize = 8;
+    _channels = 1;
+    _companding = AUDIO_CODEC_PCM;
+    _deviceRate = 8000;
+    _wireRate = 8000;
+    _noiseSeed = 1;
+}
+
+void AudioCodec::setFormat(int sampleSize, int channels, uint8_t companding)
+{
+    _sampleSize = sampleSize;
+    _channels = channels;
+    _companding = companding;
+}
+
+void AudioCodec::setRates(int deviceRate, int wireRate)
+{
+    _deviceRate = (deviceRate > 0) ? deviceRate : 8000;
+    _wireRate = (wireRate > 0) ? wireRate : _deviceRate;
+}
+
+int AudioCodec::getWireRate() const
+{
+    return _wireRate;
+}
+
+uint8_t AudioCodec::getWireCodec(uint8_t codec) const
+{
+    // companded audio goes out as is unless another codec is requested
+    if(codec == AUDIO_CODEC_PCM) return _companding;
+
+    // silence descriptors are already in their wire format
+    if(codec == AUDIO_CODEC_SILENCE) return codec;
+
+    return codec;
+}
+
+QByteArray AudioCodec::encode(const QByteArray& pcm, uint8_t codec, int divisor, Resampler* resampler, bool last) const
+{
+    uint8_t wireCodec = getWireCodec(codec);
+
+    // the audio goes out at the wire rate reduced by the divisor
+    const int inRate = _deviceRate * ((divisor > 1) ? divisor : 1);
+    const int outRate = _wireRate;
+
+    // silence descriptors are not audio, only the frames they cover change with the rate
+    if(wireCodec == AUDIO_CODEC_SILENCE){
+        if(inRate == outRate || pcm.size() < (int)sizeof(SilenceDescriptor)) return pcm;
+
+        SilenceDescriptor descriptor;
+        memcpy(&descriptor, pcm.data(), sizeof(SilenceDescriptor));
+        descriptor.lNumFrames = (uint32_t)(((uint64_t)descriptor.lNumFrames * outRate) / inRate);
+
+        return QByteArray((const char*)&descriptor, sizeof(SilenceDescriptor));
+    }
+
+    // captured audio is already in the wire format
+    if(inRate == outRate && (wireCodec == AUDIO_CODEC_PCM || wireCodec == _companding)) return pcm;
+
+    int numSamples = capturedSamples(pcm);
+    int numFrames = numSamples / _channels;
+
+    int16_t* samples = (int16_t*) malloc(numSamples * sizeof(int16_t));
+    toLinear16(pcm, samples, numSamples);
+
+    if(inRate != outRate){
+        convertRate(&samples, &numFrames, inRate, outRate, resampler, last);
+        numSamples = numFrames * _channels;
+    }
+
+    QByteArray encoded;
+
+    if(wireCodec == AUDIO_CODEC_IMA_ADPCM){
+        encoded.resize(adpcmblocksize(numFrames, _channels));
+
+        int len = adpcmencode(samples, numFrames, _channels, (uint8_t*)encoded.data(), encoded.size());
+        encoded.resize(len);
+    }
+    else if(wireCodec == AUDIO_CODEC_ULAW || wireCodec == AUDIO_CODEC_ALAW){
+        encoded.resize(numSamples);
+        g711encode(samples, numSamples, (uint8_t*)encoded.data(), G711_LAW(wireCodec));
+    }
+    else{
+        encoded = fromLinear16(samples, numSamples);
+    }
+
+    free(samples);
+
+    return encoded;
+}
+
+int AudioCodec::capturedBytesFor(int wireBytes, uint8_t codec, int divisor) const
+{
+    uint8_t wireCodec = getWireCodec(codec);
+
+    double wireFrameBytes;
+
+    if(wireCodec == AUDIO_CODEC_IMA_ADPCM){
+        // 4 bits a sample after the block header
+        wireBytes -= adpcmblocksize(0, _channels);
+        wireFrameBytes = _channels / 2.0;
+    }
+    else if(wireCodec == AUDIO_CODEC_ULAW || wireCodec == AUDIO_CODEC_ALAW){
+        wireFrameBytes = _channels;
+    }
+    else{
+        wireFrameBytes = (_sampleSize / 8) * _channels;
+    }
+
+    // the wire carries the frames at the wire rate, they were captured at the device rate
+    const int inRate = _deviceRate * ((divisor > 1) ? divisor : 1);
+    int frames = (int)(((wireBytes > 0 ? wireBytes : 0) / wireFrameBytes) * inRate / _wireRate);
+    if(frames < 1) frames = 1;
+
+    return frames * getCapturedFrameBytes();
+}
+
+int AudioCodec::getDecodeUnit(uint8_t codec, int channels, int sampleSize) const
+{
+    const int inChannels = (channels > 0) ? channels : _channels;
+    const int inSampleSize = (sampleSize > 0) ? sampleSize : _sampleSize;
+
+    if(codec == AUDIO_CODEC_PCM) return (inSampleSize / 8) * inChannels;
+    if(codec == AUDIO_CODEC_ULAW || codec == AUDIO_CODEC_ALAW) return inChannels;
+
+    // ADPCM blocks need the whole payload
+    return 0;
+}
+
+QByteArray AudioCodec::compand(const QByteArray& pcm) const
+{
+    if(_companding == AUDIO_CODEC_PCM) return pcm;
+
+    int numSamples = pcm.size() / sizeof(int16_t);
+
+    QByteArray companded;
+    companded.resize(numSamples);
+    g711encode((const int16_t*)pcm.data(), numSamples, (uint8_t*)companded.data(), G711_LAW(_companding));
+
+    return companded;
+}
+
+QByteArray AudioCodec::decode(const QByteArray& data, uint8_t codec, int divisor, int sampleRate, int channels, int sampleSize,
+                              Resampler* resampler) const
+{
+    // the audio arrives at the sender's wire rate reduced by the divisor
+    const int inRate = (sampleRate > 0) ? sampleRate : _deviceRate;
+    const int outRate = _deviceRate * ((divisor > 1) ? divisor : 1);
+    // and in the sender's format
+    const int inChannels = (channels > 0) ? channels : _channels;
+    const int inSampleSize = (sampleSize > 0) ? sampleSize : _sampleSize;
+    int numFrames;
+    int16_t* samples;
+
+    if(!isValidRate(inRate)){
+        qDebug() << "Audio at " << inRate << " Hz rejected";
+        return QByteArray();
+    }
+
+    if(!isValidFormat(inChannels, inSampleSize)){
+        qDebug() << "Audio of " << inChannels << " channels, " << inSampleSize << " bits rejected";
+        return QByteArray();
+    }
+
+    if(codec == AUDIO_CODEC_SILENCE){
+        if(data.size() < (int)sizeof(SilenceDescriptor)) return QByteArray();
+
+        SilenceDescriptor descriptor;
+        memcpy(&descriptor, data.data(), sizeof(SilenceDescriptor));
+
+        // the length comes off the wire, a corrupt descriptor must not allocate without bound
+        if((uint64_t)descriptor.lNumFrames * 1000 > (uint64_t)inRate * SILENCE_MAX_MS){
+            qDebug() << "Silence descriptor of " << descriptor.lNumFrames << " frames rejected";
+            return QByteArray();
+        }
+
+        // synthesize the background noise the sender measured, for as long at the device rate
+        int numSamples = (int)(((uint64_t)descriptor.lNumFrames * outRate) / inRate) * _channels;
+
+        samples = (int16_t*) malloc(numSamples * sizeof(int16_t));
+        if(samples == NULL) return QByteArray();
+
+        VoiceActivityDetector::comfortNoise(samples, numSamples, descriptor.wNoiseLevel, &_noiseSeed);
+
+        QByteArray pcm = fromLinear16(samples, numSamples);
+        free(samples);
+
+        return pcm;
+    }
+    else if(codec == AUDIO_CODEC_PCM && inRate == outRate && inChannels == _channels && inSampleSize == _sampleSize){
+        return data;
+    }
+
+    if(codec == AUDIO_CODEC_IMA_ADPCM){
+        numFrames = adpcmframes((const uint8_t*)data.data(), data.size(), inChannels);
+
+        // a block too short for its header holds no audio
+        if(numFrames <= 0){
+            qDebug() << "ADPCM block of " << data.size() << " bytes dropped";
+            return QByteArray();
+        }
+
+        samples = (int16_t*) malloc(numFrames * inChannels * sizeof(int16_t));
+        if(samples == NULL) return QByteArray();
+
+        numFrames = adpcmdecode((const uint8_t*)data.data(), data.size(), inChannels, samples, numFrames);
+    }
+    else if(codec == AUDIO_CODEC_ULAW || codec == AUDIO_CODEC_ALAW){
+        numFrames = data.size() / inChannels;
+
+        samples = (int16_t*) malloc(numFrames * inChannels * sizeof(int16_t));
+        g711decode((const uint8_t*)data.data(), numFrames * inChannels, samples, G711_LAW(codec));
+    }
+    else if(codec == AUDIO_CODEC_PCM){
+        numFrames = data.size() / ((inSampleSize / 8) * inChannels);
+
+        samples = (int16_t*) malloc(numFrames * inChannels * sizeof(int16_t));
+        pcmToLinear16(data.constData(), inSampleSize, samples, numFrames * inChannels);
+    }
+    else{
+        qDebug() << "Unknown audio codec: " << codec;
+        return QByteArray();
+    }
+
+    // to the local channel count, before the rate conversion that carries state at that count
+    if(inChannels != _channels) convertChannels(&samples, numFrames, inChannels);
+
+    // to the device sample rate
+    if(inRate != outRate) convertRate(&samples, &numFrames, inRate, outRate, resampler);
+
+    QByteArray pcm = fromLinear16(samples, numFrames * _channels);
+    free(samples);
+
+    return pcm;
+}
+
+QByteArray AudioCodec::flush(Resampler* resampler) const
+{
+    QVector<int16_t> tail;
+    int frames = resampler->flush(tail);
+
+    return fromLinear16(tail.constData(), frames * _channels);
+}
+
+bool AudioCodec::isValidRate(uint32_t rate)
+{
+    return rate == 0 || (rate >= AUDIO_RATE_MIN && rate <= AUDIO_RATE_MAX);
+}
+
+bool AudioCodec::isValidFormat(int channels, int sampleSize)
+{
+    if(channels < 0 || channels > AUDIO_CHANNELS_MAX) return false;
+
+    return sampleSize == 0 || sampleSize == 8 || sampleSize == 16 || sampleSize == 32;
+}
+
+int AudioCodec::capturedSamples(const QByteArray& pcm) const
+{
+    // companded audio is one byte per sample
+    if(_companding != AUDIO_CODEC_PCM) return pcm.size();
+
+    return pcm.size() / (_sampleSize / 8);
+}
+
+void AudioCodec::toLinear16(const QByteArray& pcm, int16_t* out, int numSamples) const
+{
+    if(_companding != AUDIO_CODEC_PCM){
+        g711decode((const uint8_t*)pcm.data(), numSamples, out, G711_LAW(_companding));
+    }
+    else{
+        pcmToLinear16(pcm.constData(), _sampleSize, out, numSamples);
+    }
+}
+
+void AudioCodec::pcmToLinear16(const char* pcm, int sampleSize, int16_t* out, int numSamples)
+{
+    int i;
+
+    if(sampleSize == 32){
+        const float* in = (const float*)pcm;
+        for(i = 0; i < numSamples; ++i){
+            float x = in[i] * 32768.0f;
+            out[i] = (int16_t)((x > INT16_MAX) ? INT16_MAX : ((x < INT16_MIN) ? INT16_MIN : x));
+        }
+    }
+    else if(sampleSize == 16){
+        memcpy(out, pcm, numSamples * sizeof(int16_t));
+    }
+    else{
+        const uint8_t* in = (const uint8_t*)pcm;
+        for(i = 0; i < numSamples; ++i){
+            out[i] = (int16_t)((in[i] - 0x80) * 256);
+        }
+    }
+}
+
+QByteArray AudioCodec::fromLinear16(const int16_t* samples, int numSamples) const
+{
+    QByteArray pcm;
+    int i;
+
+    if(_sampleSize == 32){
+        pcm.resize(numSamples * sizeof(float));
+        float* out = (float*)pcm.data();
+        for(i = 0; i < numSamples; ++i){
+            out[i] = samples[i] / 32768.0f;
+        }
+    }
+    else if(_sampleSize == 16){
+        pcm.append((const char*)samples, numSamples * sizeof(int16_t));
+    }
+    else{
+        pcm.resize(numSamples);
+        uint8_t* out = (uint8_t*)pcm.data();
+        for(i = 0; i < numSamples; ++i){
+            out[i] = (uint8_t)((samples[i] >> 8) + 0x80);
+        }
+    }
+
+    return pcm;
+}
+
+void AudioCodec::convertChannels(int16_t** samples, int numFrames, int channels) const
+{
+    const int16_t* in = *samples;
+    int16_t* out = (int16_t*) malloc(numFrames * _channels * sizeof(int16_t));
+    int i, c;
+
+    for(i = 0; i < numFrames; ++i){
+        if(_channels == 1){
+            // mixed down to mono
+            int sum = 0;
+            for(c = 0; c < channels; ++c) sum += in[i * channels + c];
+
+            out[i] = (int16_t)(sum / channels);
+        }
+        else{
+            // mono spread to every channel, otherwise the channels in turn
+            for(c = 0; c < _channels; ++c) out[i * _channels + c] = in[i * channels + (c % channels)];
+        }
+    }
+
+    free(*samples);
+    *samples = out;
+}
+
+void AudioCodec::convertRate(int16_t** samples, int* numFrames, int inRate, int outRate, Resampler* resampler, bool last) const
+{
+    Resampler local;
+    QVector<int16_t> converted, tail;
+    int frames, tailFrames = 0;
+
+    if(resampler == NULL) resampler = &local;
+    resampler->setRates(inRate, outRate, _channels);
+
+    frames = resampler->process(*samples, *numFrames, converted);
+
+    // audio converted on its own ends here, so the filter gives up what it holds back
+    if(resampler == &local || last) tailFrames = resampler->flush(tail);
+
+    free(*samples);
+
+    *samples = (int16_t*) malloc((frames + tailFrames) * _channels * sizeof(int16_t));
+    memcpy(*samples, converted.constData(), frames * _channels * sizeof(int16_t));
+    memcpy(*samples + frames * _channels, tail.constData(), tailFrames * _channels * sizeof(int16_t));
+
+    *numFrames = frames + tailFrames;
+}
+
+int AudioCodec::getSampleSize() const
+{
+    return _sampleSize;
+}
+
+int AudioCodec::getChannelCount() const
+{
+    return _channels;
+}
+
+uint8_t AudioCodec::getCompanding() const
+{
+    return _companding;
+}
+
+int AudioCodec::getCapturedFrameBytes() const
+{
+    // companded audio is captured one byte per sample
+    return ((_companding != AUDIO_CODEC_PCM) ? 1 : _sampleSize / 8) * _channels;
+}
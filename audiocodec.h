@@ -0,0 +1,282 @@
+#ifndef AUDIOCODEC_H
+#define AUDIOCODEC_H
+
+#include <cstdint>
+
+#include <QByteArray>
+
+#include "resampler.h"
+
+#define AUDIO_CODEC_PCM       0x00 ///< Raw PCM in the capture format, the header gives its sample size
+#define AUDIO_CODEC_IMA_ADPCM 0x01 ///< 4 bit IMA ADPCM
+#define AUDIO_CODEC_ULAW      0x02 ///< 8 bit mu-law
+#define AUDIO_CODEC_ALAW      0x03 ///< 8 bit A-law
+#define AUDIO_CODEC_SILENCE   0x04 ///< Silence descriptor, played as comfort noise
+
+#define AUDIO_RATE_MIN 4000  ///< lowest sample rate accepted off the wire
+#define AUDIO_RATE_MAX 96000 ///< highest sample rate accepted off the wire
+#define AUDIO_CHANNELS_MAX 2 ///< most channels accepted off the wire, as many as an ADPCM block holds
+
+/**
+    Converts audio between the local PCM format and the format sent over the wire
+*/
+class AudioCodec
+{
+public:
+    AudioCodec(void);
+
+    /**
+        Set the local PCM format
+
+        @param sampleSize
+            bits per sample of the audio devices, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param companding
+            AUDIO_CODEC_ULAW or AUDIO_CODEC_ALAW if captured audio is stored companded,
+            AUDIO_CODEC_PCM otherwise
+    */
+    void setFormat(int sampleSize, int channels, uint8_t companding = AUDIO_CODEC_PCM);
+
+    /**
+        Set the sample rates audio is converted between
+
+        @param deviceRate
+            samples per second of the audio devices
+
+        @param wireRate
+            samples per second of the audio sent, 0 sends at the device rate
+    */
+    void setRates(int deviceRate, int wireRate);
+
+    /**
+        @return samples per second of the audio sent, before any divisor
+    */
+    int getWireRate() const;
+
+    /**
+        Get the codec captured audio is sent with
+
+        @param codec
+            the requested codec
+
+        @return the codec the audio will be encoded with
+    */
+    uint8_t getWireCodec(uint8_t codec) const;
+
+    /**
+        Encode captured audio for the wire
+
+        @param pcm
+            audio as captured, companded if a companding capture mode is set
+
+        @param codec
+            the codec to encode with
+
+        @param divisor
+            reduce the wire rate by this factor
+
+        @param resampler
+            carries the rate conversion between the pieces of a stream, NULL converts the audio on its own
+
+        @param last
+            the audio ends with this piece, the resampler gives up the audio it holds back
+
+        @return the encoded audio
+    */
+    QByteArray encode(const QByteArray& pcm, uint8_t codec, int divisor = 1, Resampler* resampler = NULL, bool last = false) const;
+
+    /**
+        Compand audio from the devices into the capture format
+
+        @param pcm
+            16 bit linear audio from the input device
+
+        @return the companded audio, or the input if no companding capture mode is set
+    */
+    QByteArray compand(const QByteArray& pcm) const;
+
+    /**
+        Decode audio from the wire into the local PCM format
+
+        @param data
+            the encoded audio
+
+        @param codec
+            the codec the audio was encoded with
+
+        @param divisor
+            the sample rate divisor the audio was encoded with
+
+        @param sampleRate
+            the sender's wire rate before the divisor, 0 if it is the device rate
+
+        @param channels
+            the sender's channel count, 0 if it is the local count
+
+        @param sampleSize
+            bits per sample of the sender's PCM, 0 if it is the local size
+
+        @param resampler
+            carries the rate conversion between the pieces of a stream, NULL converts the audio on its own
+
+        @return the audio in the local format
+    */
+    QByteArray decode(const QByteArray& data, uint8_t codec, int divisor = 1, int sampleRate = 0, int channels = 0, int sampleSize = 0,
+                      Resampler* resampler = NULL) const;
+
+    /**
+        Get the audio a resampler still holds back at the end of decoded audio
+
+        @param resampler
+            the conversion the audio was decoded with
+
+        @return the audio in the local format, empty if the rates were the same
+    */
+    QByteArray flush(Resampler* resampler) const;
+
+    /**
+        Check a sample rate taken off the wire
+
+        @param rate
+            samples per second, 0 for the device rate
+
+        @return true if the rate can be converted from
+    */
+    static bool isValidRate(uint32_t rate);
+
+    /**
+        Check a sample format taken off the wire
+
+        @param channels
+            channel count, 0 for the local count
+
+        @param sampleSize
+            bits per PCM sample, 0 for the local size
+
+        @return true if the format can be converted from
+    */
+    static bool isValidFormat(int channels, int sampleSize);
+
+    /**
+        Get about how much captured audio encodes to a number of bytes on the wire
+
+        @param wireBytes
+            bytes of encoded audio
+
+        @param codec
+            the requested codec
+
+        @param divisor
+            the sample rate divisor
+
+        @return bytes of captured audio, whole sample frames and at least one
+    */
+    int capturedBytesFor(int wireBytes, uint8_t codec, int divisor = 1) const;
+
+    /**
+        Get the smallest piece of encoded audio that decodes on its own, so audio can be decoded as it arrives.
+        Pieces of audio at another rate are decoded with the same resampler.
+
+        @param codec
+            the codec the audio was encoded with
+
+        @param channels
+            the sender's channel count, 0 if it is the local count
+
+        @param sampleSize
+            bits per sample of the sender's PCM, 0 if it is the local size
+
+        @return bytes in the piece, 0 if only the whole payload can be decoded
+    */
+    int getDecodeUnit(uint8_t codec, int channels = 0, int sampleSize = 0) const;
+
+    /**
+        @return the local sample size in bits
+    */
+    int getSampleSize() const;
+
+    /**
+        @return the local channel count
+    */
+    int getChannelCount() const;
+
+    /**
+        @return the companding of captured audio
+    */
+    uint8_t getCompanding() const;
+
+    /**
+        @return bytes in a captured sample frame
+    */
+    int getCapturedFrameBytes() const;
+
+private:
+    //! bits per sample of the local PCM
+    int _sampleSize;
+    //! number of channels of the local PCM
+    int _channels;
+    //! companding of the captured audio
+    uint8_t _companding;
+    //! samples per second of the audio devices
+    int _deviceRate;
+    //! samples per second of the audio sent
+    int _wireRate;
+    //! comfort noise generator state
+    mutable uint32_t _noiseSeed;
+
+    /**
+        @return the number of samples in captured audio
+    */
+    int capturedSamples(const QByteArray& pcm) const;
+
+    /**
+        Convert captured audio to 16 bit signed samples
+    */
+    void toLinear16(const QByteArray& pcm, int16_t* out, int numSamples) const;
+
+    /**
+        Convert PCM of a sample size, 8 (unsigned), 16 (signed) or 32 (float), to 16 bit signed samples
+    */
+    static void pcmToLinear16(const char* pcm, int sampleSize, int16_t* out, int numSamples);
+
+    /**
+        Mix or spread 16 bit samples to the local channel count
+
+        @param samples
+            the samples, replaced by the converted samples
+
+        @param numFrames
+            sample frames in samples
+
+        @param channels
+            channels in samples
+    */
+    void convertChannels(int16_t** samples, int numFrames, int channels) const;
+
+    /**
+        Convert 16 bit signed samples to the local PCM
+    */
+    QByteArray fromLinear16(const int16_t* samples, int numSamples) const;
+
+    /**
+        Convert 16 bit samples between rates
+
+        @param samples
+            the samples, replaced by the converted samples
+
+        @param numFrames
+            sample frames in samples, set to the frames converted
+
+        @param resampler
+            the conversion carried between calls, NULL converts the samples on their own
+
+        @param last
+            the samples end the audio, the resampler gives up what it holds back
+    */
+    void convertRate(int16_t** samples, int* numFrames, int inRate, int outRate, Resampler* resampler, bool last = false) const;
+};
+
+#endif // AUDIOCODEC_H
@@ -0,0 +1,157 @@
+
+/**
+    @file audioendpoint.cpp
+    @breif Audio sources and sinks, hardware or headless
+    @author Natesh Narain
+*/
+
+#include "audioendpoint.h"
+#include "headlessendpoint.h"
+#include "simulatedclock.h"
+
+#include <cstring>
+
+#include <QAudioDeviceInfo>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#define ENDPOINT_DEVICE "device" ///< spec of the sound hardware
+#define ENDPOINT_WAV    "wav:"   ///< prefix of a WAV file spec
+#define ENDPOINT_TONE   "tone:"  ///< prefix of a tone spec
+#define ENDPOINT_NOISE  "noise"  ///< spec of the noise source
+#define ENDPOINT_NULL   "null"   ///< spec of the discarding sink
+
+QString AudioEndpoints::_source = ENDPOINT_DEVICE;
+QString AudioEndpoints::_sink = ENDPOINT_DEVICE;
+SimulatedClock* AudioEndpoints::_clock = NULL;
+
+AudioSource::AudioSource(QObject *parent) : QObject(parent)
+{
+}
+
+AudioSink::AudioSink(QObject *parent) : QObject(parent)
+{
+}
+
+DeviceAudioSource::DeviceAudioSource(const QAudioFormat& format, QObject *parent) : AudioSource(parent)
+{
+    QAudioDeviceInfo info = QAudioDeviceInfo::defaultInputDevice();
+    _input = new QAudioInput(info, format, this);
+    connect(_input, SIGNAL(notify()), this, SIGNAL(notify()));
+}
+
+void DeviceAudioSource::start(QIODevice* device)
+{
+    _input->start(device);
+}
+
+void DeviceAudioSource::stop()
+{
+    _input->stop();
+}
+
+void DeviceAudioSource::setBufferSize(int bytes)
+{
+    _input->setBufferSize(bytes);
+}
+
+void DeviceAudioSource::setNotifyInterval(int ms)
+{
+    _input->setNotifyInterval(ms);
+}
+
+DeviceAudioSink::DeviceAudioSink(const QAudioFormat& format, QObject *parent) : AudioSink(parent)
+{
+    _output = new QAudioOutput(format, this);
+    connect(_output, SIGNAL(stateChanged(QAudio::State)), this, SIGNAL(stateChanged(QAudio::State)));
+}
+
+void DeviceAudioSink::start(QIODevice* device)
+{
+    _output->start(device);
+}
+
+void DeviceAudioSink::stop()
+{
+    _output->stop();
+}
+
+QAudio::State DeviceAudioSink::state() const
+{
+    return _output->state();
+}
+
+void AudioEndpoints::configure(const QString& source, const QString& sink, double clockSpeed)
+{
+    _source = source.isEmpty() ? QString(ENDPOINT_DEVICE) : source;
+    _sink = sink.isEmpty() ? QString(ENDPOINT_DEVICE) : sink;
+
+    // the clock is only needed when something runs without the hardware
+    if(_source != ENDPOINT_DEVICE || _sink != ENDPOINT_DEVICE){
+        if(_clock == NULL) _clock = new SimulatedClock();
+        _clock->setSpeed(clockSpeed);
+
+        qDebug() << "Headless audio, source " << _source << ", sink " << _sink << ", clock speed " << clockSpeed;
+    }
+}
+
+AudioSource* AudioEndpoints::createSource(const QAudioFormat& format, Role role, QObject *parent)
+{
+    Q_UNUSED(role);
+
+    // every source reads from the start of the file on its own handle
+    if(_source.startsWith(ENDPOINT_WAV)){
+        return new WavFileSource(_source.mid(strlen(ENDPOINT_WAV)), format, _clock, parent);
+    }
+    else if(_source.startsWith(ENDPOINT_TONE)){
+        return new SignalSource(_source.mid(strlen(ENDPOINT_TONE)).toDouble(), format, _clock, parent);
+    }
+    else if(_source == ENDPOINT_NOISE){
+        return new SignalSource(0, format, _clock, parent);
+    }
+    else if(_source != ENDPOINT_DEVICE){
+        qWarning() << "Unknown audio source " << _source << ", using the input device";
+    }
+
+    return new DeviceAudioSource(format, parent);
+}
+
+AudioSink* AudioEndpoints::createSink(const QAudioFormat& format, Role role, QObject *parent)
+{
+    if(_sink == ENDPOINT_NULL){
+        return new NullSink(format, _clock, parent);
+    }
+    else if(_sink.startsWith(ENDPOINT_WAV)){
+        return new WavFileSink(sinkFileName(_sink.mid(strlen(ENDPOINT_WAV)), role), format, _clock, parent);
+    }
+    else if(_sink != ENDPOINT_DEVICE){
+        qWarning() << "Unknown audio sink " << _sink << ", using the output device";
+    }
+
+    return new DeviceAudioSink(format, parent);
+}
+
+QString AudioEndpoints::sinkFileName(const QString& fileName, Role role)
+{
+    if(role != Stream) return fileName;
+
+    int dot = fileName.lastIndexOf('.');
+    if(dot <= fileName.lastIndexOf('/')) return fileName + "-stream";
+
+    return fileName.left(dot) + "-stream" + fileName.mid(dot);
+}
+
+qint64 AudioEndpoints::elapsed()
+{
+    if(_clock != NULL) return _clock->elapsed();
+
+    static QElapsedTimer wall;
+    if(!wall.isValid()) wall.start();
+
+    return wall.elapsed();
+}
+
+SimulatedClock* AudioEndpoints::clock()
+{
+    return _clock;
+}
@@ -0,0 +1,189 @@
+#ifndef AUDIOENDPOINT_H
+#define AUDIOENDPOINT_H
+
+#include <QObject>
+#include <QString>
+#include <QIODevice>
+#include <QAudio>
+#include <QAudioFormat>
+#include <QAudioInput>
+#include <QAudioOutput>
+
+class SimulatedClock;
+
+/**
+    Where captured audio comes from
+
+    Works like QAudioInput in push mode, audio is written to the device given to start() and notify() is
+    emitted every notify interval.
+*/
+class AudioSource : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AudioSource(QObject *parent = 0);
+
+    /**
+        Start writing captured audio to a device
+
+        @param device
+            receives the audio
+    */
+    virtual void start(QIODevice* device) = 0;
+
+    /**
+        Stop capturing
+    */
+    virtual void stop() = 0;
+
+    /**
+        @param bytes
+            audio the source holds before writing it out
+    */
+    virtual void setBufferSize(int bytes) = 0;
+
+    /**
+        @param ms
+            interval between notify() signals
+    */
+    virtual void setNotifyInterval(int ms) = 0;
+
+signals:
+    void notify();
+};
+
+/**
+    Where played audio goes
+
+    Works like QAudioOutput in pull mode, audio is read from the device given to start() and the state
+    goes idle when the device has no audio.
+*/
+class AudioSink : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AudioSink(QObject *parent = 0);
+
+    /**
+        Start playing audio read from a device
+
+        @param device
+            supplies the audio
+    */
+    virtual void start(QIODevice* device) = 0;
+
+    /**
+        Stop playing
+    */
+    virtual void stop() = 0;
+
+    /**
+        @return the playback state
+    */
+    virtual QAudio::State state() const = 0;
+
+signals:
+    void stateChanged(QAudio::State);
+};
+
+/**
+    Captures from the default input device
+*/
+class DeviceAudioSource : public AudioSource
+{
+    Q_OBJECT
+public:
+    DeviceAudioSource(const QAudioFormat& format, QObject *parent = 0);
+
+    void start(QIODevice* device);
+    void stop();
+    void setBufferSize(int bytes);
+    void setNotifyInterval(int ms);
+
+private:
+    QAudioInput* _input;
+};
+
+/**
+    Plays to the default output device
+*/
+class DeviceAudioSink : public AudioSink
+{
+    Q_OBJECT
+public:
+    DeviceAudioSink(const QAudioFormat& format, QObject *parent = 0);
+
+    void start(QIODevice* device);
+    void stop();
+    QAudio::State state() const;
+
+private:
+    QAudioOutput* _output;
+};
+
+/**
+    Creates the audio endpoints
+
+    By default the sound hardware is used. For benchmarks and regression runs on machines without sound
+    hardware the source and sink can be replaced by headless endpoints, which move audio on a simulated
+    clock. The endpoints are described by a spec:
+
+    source: "device", "wav:<file>", "tone:<hz>" or "noise"
+    sink:   "device", "null" or "wav:<file>"
+*/
+class AudioEndpoints
+{
+public:
+    //! What an endpoint is used for, each use gets its own device handle
+    enum Role{
+        Message, ///< recording and playing messages and broadcasts
+        Stream   ///< capturing and playing streams
+    };
+
+    /**
+        Select the endpoints, called before any are created
+
+        @param source
+            source spec
+
+        @param sink
+            sink spec
+
+        @param clockSpeed
+            simulated milliseconds per real millisecond, 0 runs the simulated clock as fast as possible
+    */
+    static void configure(const QString& source, const QString& sink, double clockSpeed);
+
+    /**
+        @return a new source for the configured spec, in the given format
+    */
+    static AudioSource* createSource(const QAudioFormat& format, Role role, QObject *parent = 0);
+
+    /**
+        @return a new sink for the configured spec, in the given format. A WAV file sink for streams
+        writes next to the configured file, with "-stream" added to its name.
+    */
+    static AudioSink* createSink(const QAudioFormat& format, Role role, QObject *parent = 0);
+
+    /**
+        @return milliseconds on the clock the audio runs on, simulated when a headless endpoint is used
+    */
+    static qint64 elapsed();
+
+    /**
+        @return the simulated clock, NULL when only hardware endpoints are used
+    */
+    static SimulatedClock* clock();
+
+private:
+    /**
+        @return the file a WAV sink of a role writes
+    */
+    static QString sinkFileName(const QString& fileName, Role role);
+
+    static QString _source;
+    static QString _sink;
+    static SimulatedClock* _clock;
+};
+
+#endif // AUDIOENDPOINT_H
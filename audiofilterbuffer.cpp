@@ -1,60 +1,369 @@
 #include "audiofilterbuffer.h"
 #include <cstdint>
+#include <cstring>
+
+#include "rlencoding.h"
+#include "audiocodec.h"
+#include "g711.h"
 
 #include <QDebug>
 
-AudioFilterBuffer::AudioFilterBuffer(QObject *parent) : QBuffer(parent)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define FILTER_CHUNK_SAMPLES 256  ///< 16 bit samples filtered on the stack ahead of companding
+#define FILTER_SUPPRESS_MS   100  ///< audio the noise suppression buffer holds up front, longer writes grow it once
+
+/**
+    Set samples above the upper threshold to the max amplitude and samples below the lower threshold to the
+    min amplitude, without branches so the loop vectorizes
+*/
+static void _clampthresholds(const uint8_t* in, uint8_t* out, int len, uint8_t lower, uint8_t upper)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i vUpper = _mm_set1_epi8((char)upper);
+    const __m128i vLower = _mm_set1_epi8((char)lower);
+    const __m128i vMax   = _mm_set1_epi8((char)AudioFilterBuffer::Amplitude::MAX);
+
+    for(; i + 16 <= len; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+
+        // unsigned compares through min/max: x <= upper when min(x, upper) == x
+        __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(x, vUpper), x);
+        x = _mm_or_si128(_mm_and_si128(inRange, x), _mm_andnot_si128(inRange, vMax));
+
+        // x >= lower when max(x, lower) == x, MIN is zero
+        __m128i aboveLower = _mm_cmpeq_epi8(_mm_max_epu8(x, vLower), x);
+        x = _mm_and_si128(x, aboveLower);
+
+        _mm_storeu_si128((__m128i*)(out + i), x);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t vUpper = vdupq_n_u8(upper);
+    const uint8x16_t vLower = vdupq_n_u8(lower);
+    const uint8x16_t vMax   = vdupq_n_u8(AudioFilterBuffer::Amplitude::MAX);
+
+    for(; i + 16 <= len; i += 16){
+        uint8x16_t x = vld1q_u8(in + i);
+
+        x = vbslq_u8(vcgtq_u8(x, vUpper), vMax, x);
+        x = vandq_u8(x, vcgeq_u8(x, vLower));
+
+        vst1q_u8(out + i, x);
+    }
+#endif
+
+    // remaining samples, or all of them without SIMD
+    for(; i < len; ++i){
+        uint8_t x = in[i];
+        uint8_t above = (uint8_t)-(x > upper);
+        x = (uint8_t)((x & ~above) | (AudioFilterBuffer::Amplitude::MAX & above));
+        x &= (uint8_t)-(x >= lower);
+        out[i] = x;
+    }
+}
+
+/**
+    Thresholds are 8 bit amplitudes, the traits put them on the scale of each sample type
+*/
+template<typename T> struct SampleTraits;
+
+template<> struct SampleTraits<uint8_t>{
+    static uint8_t fromAmplitude(uint8_t amplitude){ return amplitude; }
+};
+
+template<> struct SampleTraits<int16_t>{
+    static int16_t fromAmplitude(uint8_t amplitude){ return (int16_t)((amplitude - 0x80) * 256); }
+};
+
+template<> struct SampleTraits<float>{
+    static float fromAmplitude(uint8_t amplitude){ return (amplitude - 0x80) / 128.0f; }
+};
+
+/**
+    Filter whole frames of interleaved audio. The selects compile to min/max style blends, and with the
+    channel count known the inner loop unrolls.
+*/
+template<typename T, int Channels>
+static void _filterframes(const char* in, char* out, int numFrames, uint8_t lower, uint8_t upper)
+{
+    const T lo   = SampleTraits<T>::fromAmplitude(lower);
+    const T hi   = SampleTraits<T>::fromAmplitude(upper);
+    const T vmax = SampleTraits<T>::fromAmplitude(AudioFilterBuffer::Amplitude::MAX);
+    const T vmin = SampleTraits<T>::fromAmplitude(AudioFilterBuffer::Amplitude::MIN);
+
+    const T* src = (const T*)in;
+    T* dst = (T*)out;
+    int i, c;
+
+    for(i = 0; i < numFrames; ++i){
+        for(c = 0; c < Channels; ++c){
+            T x = src[i * Channels + c];
+            x = (x > hi) ? vmax : x;
+            x = (x < lo) ? vmin : x;
+            dst[i * Channels + c] = x;
+        }
+    }
+}
+
+// 8 bit audio has an explicit SIMD kernel, channels only change the number of bytes
+template<>
+void _filterframes<uint8_t, 1>(const char* in, char* out, int numFrames, uint8_t lower, uint8_t upper)
+{
+    _clampthresholds((const uint8_t*)in, (uint8_t*)out, numFrames, lower, upper);
+}
+
+template<>
+void _filterframes<uint8_t, 2>(const char* in, char* out, int numFrames, uint8_t lower, uint8_t upper)
+{
+    _clampthresholds((const uint8_t*)in, (uint8_t*)out, numFrames * 2, lower, upper);
+}
+
+AudioFilterBuffer::AudioFilterBuffer(QObject *parent) : QIODevice(parent)
 {
     _upperThreshold = Amplitude::MAX;
     _lowerThreshold = Amplitude::MIN;
+    _companding = AUDIO_CODEC_PCM;
+    _suppress = false;
+    _meter = NULL;
 
-    int i;
-    for(i = 0; i < 256; ++i) _byteCount[i] = 0;
+    setFormat(8, 1, 8000);
+    resetByteCount();
 }
 
 qint64 AudioFilterBuffer::writeData(const char *data, qint64 len)
 {
-    const uint8_t channelBytes = 1;
-    const int sampleBytes = 1;
-    const int numChannels = 1;
+    // the level the thresholds see, the whole write is one period from the device
+    if(_meter != NULL) _meter->measure(data, len);
+
+    if(!_suppress) return storeData(data, len);
 
-    const int numSamples = len / sampleBytes;
+    // the suppressor takes whole sample frames in place, a partial frame waits at the front of the buffer
+    // for the next write
+    const int held = _unsuppressedLen;
+    const int total = held + (int)len;
+    const int whole = total - total % _frameBytes;
 
-    uint8_t* filtered = (uint8_t*)malloc(len * sizeof(uint8_t));
-    uint8_t* filterPtr = filtered;
-    memcpy(filtered, data, (size_t)len);
+    if(whole == 0){
+        if(_suppressFrames.size() < total) _suppressFrames.resize(total);
+        memcpy(_suppressFrames.data() + held, data, len);
+        _unsuppressedLen = total;
 
-    int i, j;
-    for(i =0; i < numSamples; ++i){
-        for(j = 0; j < numChannels; ++j){
+        return 0;
+    }
 
-            if(*filterPtr > _upperThreshold) *filterPtr = Amplitude::MAX;
-            if(*filterPtr < _lowerThreshold) *filterPtr = Amplitude::MIN;
+    // a frame is more than the held bytes, so they stay at the front
+    _suppressFrames.resize(whole);
+    memcpy(_suppressFrames.data() + held, data, whole - held);
 
-            _byteCount[*filterPtr]++;
+    _suppressor.process(_suppressFrames);
 
-            filterPtr += channelBytes;
-        }
+    qint64 stored = storeData(_suppressFrames.constData(), whole);
+
+    _unsuppressedLen = total - whole;
+    memcpy(_suppressFrames.data(), data + (whole - held), _unsuppressedLen);
+
+    return stored;
+}
+
+qint64 AudioFilterBuffer::storeData(const char* data, qint64 len)
+{
+    qint64 written = 0;
+    qint64 stored;
+
+    // finish a unit split over the previous write
+    if(_carryLen > 0){
+        int take = _unitBytes - _carryLen;
+        if(take > len) take = (int)len;
+
+        memcpy(_carry + _carryLen, data, take);
+        _carryLen += take;
+        data += take;
+        len -= take;
+
+        if(_carryLen < _unitBytes) return 0;
+
+        stored = filterUnits(_carry, 1, pos());
+        if(stored < 0) return -1;
+
+        written += stored;
+        _carryLen = 0;
     }
 
-    qint64 length = QBuffer::writeData((const char*)filtered, len);
-    free(filtered);
-    return length;
+    const qint64 numUnits = len / _unitBytes;
+
+    // after the completed unit, pos() only moves once the whole write is stored
+    stored = filterUnits(data, numUnits, pos() + written);
+    if(stored < 0) return -1;
+
+    written += stored;
+
+    // keep a trailing partial unit for the next write
+    _carryLen = (int)(len - numUnits * _unitBytes);
+    memcpy(_carry, data + numUnits * _unitBytes, _carryLen);
+
+    // QIODevice::write advances the position by the returned length, which has to be
+    // the number of bytes stored rather than the length of the input
+    return written;
 }
 
-uint8_t AudioFilterBuffer::getLeastUsedByte()
+qint64 AudioFilterBuffer::filterUnits(const char* data, qint64 numUnits, qint64 offset)
 {
-    int smallestIdx = INT32_MAX;
-    int i = 0;
+    const int unitSamples = _unitBytes / _sampleBytes;
+    const bool companded = (_companding != AUDIO_CODEC_PCM);
+
+    // companded audio is stored as one byte per sample
+    const qint64 outLen = companded ? numUnits * unitSamples : numUnits * _unitBytes;
 
-    for(i = 0; i < 256; ++i){
-        if(_byteCount[i] < smallestIdx){
-            smallestIdx = i;
-            _byteCount[i] = 0;
+    uint8_t* out = reserveWrite(offset, outLen);
+    if(out == NULL) return -1;
+
+    if(companded){
+        // filter the 16 bit input on the stack then compand into the storage
+        int16_t filtered[FILTER_CHUNK_SAMPLES];
+        const qint64 chunkUnits = FILTER_CHUNK_SAMPLES / unitSamples;
+        const int law = (_companding == AUDIO_CODEC_ALAW) ? G711_ALAW : G711_ULAW;
+        qint64 i;
+
+        for(i = 0; i < numUnits; i += chunkUnits){
+            int n = (int)((numUnits - i < chunkUnits) ? numUnits - i : chunkUnits);
+
+            _kernel(data + i * _unitBytes, (char*)filtered, n, _lowerThreshold, _upperThreshold);
+            g711encode(filtered, n * unitSamples, out + i * unitSamples, law);
         }
     }
+    else{
+        _kernel(data, (char*)out, (int)numUnits, _lowerThreshold, _upperThreshold);
+    }
+
+    // the filtered bytes are still in cache
+    qint64 i;
+    for(i = 0; i < outLen; ++i) _byteCount[out[i]]++;
+
+    return outLen;
+}
+
+uint8_t* AudioFilterBuffer::reserveWrite(qint64 offset, qint64 len)
+{
+    const qint64 end = offset + len;
+
+    // the store grows the file in whole chunks, capacity also survives into the next recording
+    char* store = _store.reserve(end);
+    if(store == NULL){
+        qWarning() << "AudioFilterBuffer: could not grow buffer";
+        return NULL;
+    }
+
+    if(end > _store.size()) _store.setSize(end);
+
+    return (uint8_t*)store + offset;
+}
 
-    return smallestIdx;
+qint64 AudioFilterBuffer::readData(char *data, qint64 maxlen)
+{
+    qint64 n = _store.size() - pos();
+    if(n > maxlen) n = maxlen;
+    if(n <= 0) return 0;
+
+    memcpy(data, _store.constData() + pos(), n);
+    return n;
+}
+
+bool AudioFilterBuffer::open(OpenMode mode)
+{
+    // write only starts a new recording, as it truncates a QBuffer
+    if((mode & QIODevice::Truncate) || ((mode & QIODevice::WriteOnly) && !(mode & (QIODevice::ReadOnly | QIODevice::Append))))
+        _store.clear();
+
+    // reads come straight from the mapping
+    if(!QIODevice::open(mode | QIODevice::Unbuffered)) return false;
+
+    if(mode & QIODevice::Append) seek(_store.size());
+
+    return true;
+}
+
+qint64 AudioFilterBuffer::size() const
+{
+    return _store.size();
+}
+
+QByteArray AudioFilterBuffer::data() const
+{
+    return _store.bytes();
+}
+
+uint8_t AudioFilterBuffer::getLeastUsedByte() const
+{
+    return rlleastused(_byteCount);
+}
+
+void AudioFilterBuffer::resetByteCount()
+{
+    memset(_byteCount, 0, sizeof(_byteCount));
+    _carryLen = 0;
+
+    _unsuppressedLen = 0;
+    _suppressor.reset();
+}
+
+void AudioFilterBuffer::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    // kernels for each sample type, mono and stereo
+    static const FilterKernel kernels[3][2] = {
+        { _filterframes<uint8_t, 1>, _filterframes<uint8_t, 2> },
+        { _filterframes<int16_t, 1>, _filterframes<int16_t, 2> },
+        { _filterframes<float,   1>, _filterframes<float,   2> }
+    };
+
+    int type;
+    if(sampleSize == 32){
+        type = 2;
+        _sampleBytes = sizeof(float);
+    }
+    else if(sampleSize == 16){
+        type = 1;
+        _sampleBytes = sizeof(int16_t);
+    }
+    else{
+        type = 0;
+        _sampleBytes = sizeof(uint8_t);
+    }
+
+    // the filter treats every channel the same, wider layouts are filtered a sample at a time
+    int kernelChannels = (channels == 2) ? 2 : 1;
+
+    _kernel = kernels[type][kernelChannels - 1];
+    _unitBytes = _sampleBytes * kernelChannels;
+    _frameBytes = _sampleBytes * ((channels > 0) ? channels : 1);
+    _carryLen = 0;
+
+    _suppressor.setFormat(sampleSize, channels, sampleRate);
+    _unsuppressedLen = 0;
+
+    // reserved so shrinking to a shorter write keeps the storage
+    _suppressFrames.reserve((int)(((qint64)_frameBytes * sampleRate * FILTER_SUPPRESS_MS) / 1000));
+}
+
+void AudioFilterBuffer::setNoiseSuppression(int db)
+{
+    _suppress = (db > 0);
+    _suppressor.setLevel(db);
+}
+
+void AudioFilterBuffer::setLevelMeter(LevelMeter* meter)
+{
+    _meter = meter;
+}
+
+void AudioFilterBuffer::setCompanding(uint8_t companding)
+{
+    _companding = companding;
 }
 
 void AudioFilterBuffer::setUpperThreshold(int upper)
@@ -3,13 +3,21 @@
 #ifndef AUDIOFILTERBUFFER_H
 #define AUDIOFILTERBUFFER_H
 
-#include <QBuffer>
+#include <QIODevice>
+#include <QByteArray>
 #include <cstdint>
 
+#include "recordingstore.h"
+#include "noisesuppressor.h"
+#include "levelmeter.h"
+
 /**
     Filter incoming audio stream with upper and lower cut offs to make compression easier
+
+    The filtered audio is kept in a memory mapped file rather than in memory. Background noise can be
+    suppressed ahead of the filter.
 */
-class AudioFilterBuffer : public QBuffer
+class AudioFilterBuffer : public QIODevice
 {
     Q_OBJECT
 public:
@@ -37,17 +45,79 @@ public:
     void setLowerThreshold(int lower);
 
     /**
-        Get the least used byte
+        Set the format of the recorded audio and select the filter kernel for it. The thresholds are
+        8 bit amplitudes and are scaled to the sample type.
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Suppress background noise before the audio is filtered
+
+        @param db
+            most attenuation of the noise in dB, 0 turns suppression off
     */
-    uint8_t getLeastUsedByte();
+    void setNoiseSuppression(int db);
 
     /**
-        Reimplemented QBuffer::writeData(const char *data, qint64 len)
+        Measure the level of the audio as it arrives, before it is filtered
+
+        @param meter
+            measures every write, NULL to stop
+    */
+    void setLevelMeter(LevelMeter* meter);
+
+    /**
+        Store the recording companded. The input must then be 16 bit linear audio.
+
+        @param companding
+            AUDIO_CODEC_ULAW, AUDIO_CODEC_ALAW or AUDIO_CODEC_PCM to store linear audio
+    */
+    void setCompanding(uint8_t companding);
+
+    /**
+        Get the least used byte in the audio recorded so far
+    */
+    uint8_t getLeastUsedByte() const;
+
+    /**
+        Clear the byte counts, any partial sample and the noise measured, used when a new recording starts
+    */
+    void resetByteCount();
+
+    /**
+        Get the recording without copying it
+
+        @return a view of the recording, valid until the next recording starts
+    */
+    QByteArray data() const;
+
+    /**
+        Reimplemented QIODevice::open(), opening write only without append starts a new recording
+    */
+    bool open(OpenMode mode);
+
+    /**
+        @return bytes recorded
+    */
+    qint64 size() const;
+
+    /**
+        Reimplemented QIODevice::writeData(const char *data, qint64 len)
 
         Used to filter the audio stream as it's being recorded
     */
     qint64 writeData(const char *data, qint64 len);
 
+
     /**
         @return the upper filter threshold
     */
@@ -58,6 +128,12 @@ public:
     */
     uint8_t getLowerThreshold() const;
 
+protected:
+    /**
+        Reimplemented QIODevice::readData(), plays back the recording
+    */
+    qint64 readData(char *data, qint64 maxlen);
+
 public slots:
 
 signals:
@@ -67,9 +143,72 @@ private:
     uint8_t _upperThreshold;
     //! The lower cut off
     uint8_t _lowerThreshold;
+    //! Filters numFrames frames of audio from in to out
+    typedef void (*FilterKernel)(const char* in, char* out, int numFrames, uint8_t lower, uint8_t upper);
+
+    //! kernel for the current format
+    FilterKernel _kernel;
+    //! bytes per sample
+    int _sampleBytes;
+    //! bytes in one unit the kernel filters
+    int _unitBytes;
+    //! partial unit left over from the last write
+    char _carry[8];
+    //! bytes in the partial unit
+    int _carryLen;
+    //! companding of the stored audio
+    uint8_t _companding;
+    //! bytes per sample frame
+    int _frameBytes;
+
+    //! removes background noise ahead of the filter
+    NoiseSuppressor _suppressor;
+    //! suppress noise in the recording
+    bool _suppress;
+    //! whole sample frames the suppressor works on in place, reused from write to write
+    QByteArray _suppressFrames;
+    //! bytes of a partial sample frame at the front of _suppressFrames waiting for the next write
+    int _unsuppressedLen;
+
+    //! measures the audio written
+    LevelMeter* _meter;
 
     //! holds the count of each byte
-    int _byteCount[256];
+    uint32_t _byteCount[256];
+
+    //! the recorded audio
+    RecordingStore _store;
+
+    /**
+        Make room for a write. The position only moves once writeData returns, so a write stored in
+        pieces passes where each piece goes.
+
+        @param offset
+            position in the recording to write at
+
+        @param len
+            number of bytes to be written
+
+        @return pointer into the backing storage to write to, NULL if it could not grow
+    */
+    uint8_t* reserveWrite(qint64 offset, qint64 len);
+
+    /**
+        Filter audio into the storage, carrying a partial unit over to the next call
+
+        @return the number of bytes stored, -1 on error
+    */
+    qint64 storeData(const char* data, qint64 len);
+
+    /**
+        Filter whole units into the storage
+
+        @param offset
+            position in the recording to store them at
+
+        @return the number of bytes stored, -1 on error
+    */
+    qint64 filterUnits(const char* data, qint64 numUnits, qint64 offset);
 
 };
 
@@ -6,27 +6,63 @@
 
 #include "audioplayback.h"
 
-#include <QAudioDeviceInfo>
+#include "serialcom.h"
 
 #include <QDebug>
 
+#define STREAM_BUFFER_SECONDS 4   ///< seconds of audio the stream recording ring holds
+#define STREAM_DEVICE_FRAMES  2   ///< stream frames the input device buffers
+#define STREAM_SILENCE_MS     200 ///< silence covered by one silence descriptor
+
+#define BROADCAST_CHECK_MS      500   ///< how often the broadcasts being received are checked
+#define BROADCAST_END_FACTOR    4.0   ///< fragment intervals without a fragment before a broadcast is over
+#define BROADCAST_END_MIN_MS    10000 ///< shortest time without a fragment before a broadcast is over
+
 AudioPlayback::AudioPlayback(AudioSettings::Settings format, QObject *parent) : QObject(parent)
 {
-    _timer = new QTimer(this);
-    connect(_timer, SIGNAL(timeout()), this, SLOT(onTick()));
-
-    setAudioFormat(format);
+    _input = NULL;
+    _output = NULL;
+    _streamInput = NULL;
+    _streamOutput = NULL;
+    _vadEnabled = false;
+    _aecEnabled = false;
+    _nsEnabled = false;
+    _playingBroadcast = NULL;
+    _playingReserved = 0;
+    _broadcastPrerollMs = 1000;
+    _sampleSize = 8;
+    _channels = 1;
+    _sampleRate = 8000;
+
+    _streamFrameMs = 20;
+    _streamFrameBytes = 0;
+    _bytesPerSecond = 0;
+    _streamStartMs = 0;
+    _streamBytesRead = 0;
+    _silentRunTimestamp = 0;
 
     _recording = false;
     _playing = false;
-    _broadcastPending = false;
+    _isBroadcastPlaying = false;
     _isStreamRecording = false;
     _isStreamPlaying = false;
+
+    connect(&_streamBufferRecord, SIGNAL(readyRead()), this, SLOT(onStreamDataReady()));
+
+    _receiveTimer.setInterval(BROADCAST_CHECK_MS);
+    connect(&_receiveTimer, SIGNAL(timeout()), this, SLOT(onReceiveTimeout()));
+
+    // measured where the input device writes, the UI reads the level when it wants it
+    _buffer.setLevelMeter(&_meter);
+    _streamBufferRecord.setLevelMeter(&_meter);
+
+    setAudioFormat(format);
 }
 
 void AudioPlayback::record()
 {
     qDebug() << "Recording\n";
+    _buffer.resetByteCount();
     _buffer.open(QIODevice::WriteOnly);
     _input->start(&_buffer);
     _recording = true;
@@ -43,56 +79,148 @@ void AudioPlayback::stopRecording()
 void AudioPlayback::play()
 {
     qDebug() << "Play\n";
-    _buffer.open(QIODevice::ReadOnly);
-    _buffer.seek(0);
-    _output->start(&_buffer);
+
+    if(_codec.getCompanding() != AUDIO_CODEC_PCM){
+        // expand the companded recording for the output device
+        if(_listen.isOpen()) _listen.close();
+        _listen.setData(_codec.decode(_buffer.data(), _codec.getCompanding()));
+        _listen.open(QIODevice::ReadOnly);
+        _output->start(&_listen);
+    }
+    else{
+        _buffer.open(QIODevice::ReadOnly);
+        _buffer.seek(0);
+        _output->start(&_buffer);
+    }
+
     _playing = true;
 }
 
 void AudioPlayback::stopPlayback()
 {
     if(_buffer.isOpen()) _buffer.close();
+    if(_listen.isOpen()) _listen.close();
+    if(_broadcast.isOpen()) _broadcast.close();
+    if(_playingBroadcast != NULL){
+        // a broadcast still arriving keeps receiving, what was not played is queued when it ends
+        if(_playingBroadcast->isFinished()){
+            _playingBroadcast->deleteLater();
+            _broadcastQueue.unreserve(_playingReserved);
+            _playingReserved = 0;
+        }
+        _playingBroadcast = NULL;
+    }
     _playing = false;
+    _isBroadcastPlaying = false;
+}
 
-    if(_isStreamPlaying){
-        qDebug() << "stream end";
-        _output->stop();
-        _streamBufferPlay.close();
-        _isStreamPlaying = false;
-    }
+void AudioPlayback::stopStreamPlayback()
+{
+    if(!_isStreamPlaying) return;
+
+    qDebug() << "stream end";
+    _isStreamPlaying = false;
+    _streamOutput->stop();
+    _mixer.close();
+    // logs the statistics of any stream still playing
+    _mixer.clear();
 }
 
 void AudioPlayback::startStreamingRecording()
 {
-    if(_recording){
-        stopRecording();
-    }
+    _vad.reset();
+    _aec.reset();
+    _ns.reset();
+    _silentRun.clear();
+    _streamBytesRead = 0;
 
-    // open the buffer for readwrite
+    // keep the device period near the frame length so frames leave as soon as they are captured
+    _streamInput->setBufferSize(_streamFrameBytes * STREAM_DEVICE_FRAMES);
+    _streamInput->setNotifyInterval(_streamFrameMs);
+
+    // open the ring for readwrite, the input device writes and onStreamDataReady drains it
     _streamBufferRecord.open(QIODevice::ReadWrite);
     // start recording to the stream buffer
-    _input->start(&_streamBufferRecord);
-    // send data every 3 seconds
-    _timer->start(2000);
+    _streamInput->start(&_streamBufferRecord);
+    _streamStartMs = AudioEndpoints::elapsed();
 
     _isStreamRecording = true;
 }
 
-void AudioPlayback::onTick()
+void AudioPlayback::onStreamDataReady()
 {
-    qDebug() << "onTick";
+    if(!_isStreamRecording) return;
+
+    // send every whole frame captured so far
+    while(_streamBufferRecord.bytesAvailable() >= _streamFrameBytes){
+        quint32 timestamp = captureTime();
 
-    qint64 readPos = _streamBufferRecord.readPosition();
-    qint64 diff = _streamBufferRecord.size() - readPos;
+        QByteArray captured = _streamBufferRecord.read(_streamFrameBytes);
+        _streamBytesRead += captured.size();
 
-    QByteArray buffer = _streamBufferRecord.read(diff);
-    emit onStreamBufferSendReady(buffer);
+        // before voice detection, so the far end's audio is not taken for speech
+        if(_aecEnabled) _aec.process(captured);
+        // the echo is not steady, so it is removed first, and the noise goes before VAD measures it
+        if(_nsEnabled) _ns.process(captured);
+
+        sendStreamFrame(captured, timestamp);
+    }
+}
+
+void AudioPlayback::sendStreamFrame(QByteArray& captured, quint32 timestamp)
+{
+    // only describe the background noise when nobody is talking
+    if(_vadEnabled && !_vad.process(captured)){
+        if(_silentRun.isEmpty()) _silentRunTimestamp = timestamp;
+        _silentRun.append(captured);
+
+        // one descriptor covers several frames of silence
+        if(_silentRun.size() >= (qint64)_bytesPerSecond * STREAM_SILENCE_MS / 1000) flushSilence();
+
+        return;
+    }
+
+    flushSilence();
+
+    QByteArray buffer = _codec.compand(captured);
+    emit onStreamBufferSendReady(buffer, timestamp);
+}
+
+void AudioPlayback::flushSilence()
+{
+    if(_silentRun.isEmpty()) return;
+
+    QByteArray descriptor = _vad.getSilenceDescriptor(_silentRun);
+    emit onStreamSilenceReady(descriptor, _silentRunTimestamp);
+
+    _silentRun.clear();
+}
+
+quint32 AudioPlayback::captureTime() const
+{
+    // position of the next frame on the sample clock, audio dropped by the ring still took time to capture
+    qint64 captured = _streamBytesRead + _streamBufferRecord.getOverflowBytes();
+
+    return (quint32)(_streamStartMs + (_bytesPerSecond > 0 ? (captured * 1000) / _bytesPerSecond : 0));
 }
 
 void AudioPlayback::stopStreamingRecording()
 {
-    _input->stop();
-    _timer->stop();
+    _streamInput->stop();
+
+    // send what is left, a final short frame included
+    onStreamDataReady();
+
+    if(_streamBufferRecord.bytesAvailable() > 0){
+        quint32 timestamp = captureTime();
+        QByteArray captured = _streamBufferRecord.readAll();
+        _streamBytesRead += captured.size();
+
+        sendStreamFrame(captured, timestamp);
+    }
+
+    flushSilence();
+
     _streamBufferRecord.close();
     _isStreamRecording = false;
 }
@@ -103,56 +231,228 @@ void AudioPlayback::onPlayerStateChanged(QAudio::State state)
         qDebug() << "stop state";
         stopPlayback();
         emit stoppedPlaying();
+
+        // the output ran out of audio, not stopped to play something else
+        if(state == QAudio::IdleState) playNextBroadcast();
+    }
+}
+
+void AudioPlayback::onStreamPlayerStateChanged(QAudio::State state)
+{
+    if((state == QAudio::StoppedState || state == QAudio::IdleState) && _isStreamPlaying){
+        stopStreamPlayback();
+
+        // broadcasts wait for the streams to end
+        playNextBroadcast();
     }
 }
 
-void AudioPlayback::onAudioReceived(QByteArray& buffer)
+void AudioPlayback::onBroadcastDataReceived(QByteArray& buffer, quint8 sender, quint8 priority, quint8 flags)
 {
-    if(_playing){
-        qDebug() << "Settings broadcast to pending";
-        _broadcastPending = true;
-        _broadcast.close();
-        _broadcast.setBuffer(&buffer);
+    if(flags & FRAGMENT_FIRST){
+        if(_receiving.contains(sender)) finishBroadcast(sender);
+
+        Receiving receiving;
+        receiving.buffer = new BroadcastBuffer(this);
+        receiving.buffer->setFormat(_sampleSize, _channels, _sampleRate);
+        receiving.buffer->setPreroll(_broadcastPrerollMs);
+        receiving.buffer->open(QIODevice::ReadOnly);
+        receiving.priority = priority;
+        receiving.reserved = 0;
+        receiving.lastArrival = AudioEndpoints::elapsed();
+        receiving.meanInterval = 0;
+
+        _receiving.insert(sender, receiving);
+        _receiveTimer.start();
+
+        qDebug() << "Receiving broadcast from " << sender;
+        return;
+    }
+
+    if(!_receiving.contains(sender)) return;
+
+    if(flags & FRAGMENT_LAST){
+        finishBroadcast(sender);
     }
     else{
-        qDebug() << "Starting broadcast";
+        Receiving& receiving = _receiving[sender];
+
+        const qint64 now = AudioEndpoints::elapsed();
+        double interval = (double)(now - receiving.lastArrival);
+        receiving.meanInterval = (receiving.meanInterval == 0) ? interval : (0.875 * receiving.meanInterval + 0.125 * interval);
+        receiving.lastArrival = now;
+
+        // the audio held while it is received counts against the queue's budget like queued audio
+        qint64 held = receiving.buffer->heldBytes() + buffer.size();
+        if(held > receiving.reserved && !_broadcastQueue.reserve(held - receiving.reserved, receiving.priority)){
+            abortBroadcast(sender);
+        }
+        else{
+            receiving.buffer->append(buffer);
+
+            // played audio dropped from the front gives room back
+            held = receiving.buffer->heldBytes();
+            if(held > receiving.reserved){
+                receiving.reserved = held;
+            }
+            else{
+                _broadcastQueue.unreserve(receiving.reserved - held);
+                receiving.reserved = held;
+            }
+        }
+    }
+
+    playNextBroadcast();
+}
+
+void AudioPlayback::onReceiveTimeout()
+{
+    const qint64 now = AudioEndpoints::elapsed();
+    QList<uint8_t> ended;
+
+    QMap<uint8_t, Receiving>::const_iterator it;
+    for(it = _receiving.constBegin(); it != _receiving.constEnd(); ++it){
+        double endMs = BROADCAST_END_FACTOR * it.value().meanInterval;
+        if(endMs < BROADCAST_END_MIN_MS) endMs = BROADCAST_END_MIN_MS;
+
+        if(now - it.value().lastArrival >= endMs) ended.append(it.key());
+    }
+
+    foreach(uint8_t sender, ended){
+        qDebug() << "Broadcast from " << sender << " timed out";
+        finishBroadcast(sender);
+    }
+
+    if(_receiving.isEmpty()) _receiveTimer.stop();
+
+    // a broadcast that ended while it played lets the output go idle by itself
+    if(!ended.isEmpty()) playNextBroadcast();
+}
+
+void AudioPlayback::finishBroadcast(uint8_t sender)
+{
+    Receiving receiving = _receiving.take(sender);
+    receiving.buffer->finish();
+
+    // plays out, released when playback stops
+    if(receiving.buffer == _playingBroadcast){
+        _playingReserved = receiving.reserved;
+        return;
+    }
+
+    QByteArray clip = receiving.buffer->data();
+    delete receiving.buffer;
+
+    // the room held while receiving goes to the queued clip
+    _broadcastQueue.unreserve(receiving.reserved);
+
+    if(clip.isEmpty()) return;
+
+    if(!_broadcastQueue.enqueue(clip, receiving.priority)){
+        qDebug() << "Broadcast dropped, " << _broadcastQueue.getEvicted() << " dropped so far";
+    }
+
+    emit onBroadcastQueueUpdate(_broadcastQueue.size());
+}
+
+void AudioPlayback::abortBroadcast(uint8_t sender)
+{
+    Receiving receiving = _receiving.take(sender);
+
+    qDebug() << "Broadcast from " << sender << " dropped, the broadcast queue is full";
+
+    // what already plays carries on and ends there
+    if(receiving.buffer == _playingBroadcast){
+        receiving.buffer->finish();
+        _playingReserved = receiving.reserved;
+        return;
+    }
+
+    _broadcastQueue.unreserve(receiving.reserved);
+    delete receiving.buffer;
+}
+
+void AudioPlayback::playNextBroadcast()
+{
+    if(_playing || _isStreamPlaying || _isBroadcastPlaying) return;
+
+    QByteArray clip;
+    if(_broadcastQueue.dequeue(clip)){
+        qDebug() << "Starting broadcast, " << _broadcastQueue.size() << " queued";
 
         if(_broadcast.isOpen()) _broadcast.close();
-        _broadcast.setData(buffer);
+        _broadcast.setData(clip);
         _broadcast.open(QIODevice::ReadOnly);
+        _isBroadcastPlaying = true;
         _output->start(&_broadcast);
+
+        emit onBroadcastQueueUpdate(_broadcastQueue.size());
+        return;
+    }
+
+    // nothing queued, play the most urgent broadcast still arriving once its pre-roll is in
+    BroadcastBuffer* next = NULL;
+    uint8_t nextPriority = 0;
+
+    QMap<uint8_t, Receiving>::const_iterator it;
+    for(it = _receiving.constBegin(); it != _receiving.constEnd(); ++it){
+        if(it.value().buffer->isReady() && (next == NULL || it.value().priority > nextPriority)){
+            next = it.value().buffer;
+            nextPriority = it.value().priority;
+        }
     }
+
+    if(next == NULL) return;
+
+    qDebug() << "Starting broadcast while it is received";
+
+    _playingBroadcast = next;
+    _isBroadcastPlaying = true;
+    _output->start(_playingBroadcast);
 }
 
-void AudioPlayback::onAudioStreamReceived(QByteArray &buffer)
+void AudioPlayback::onAudioStreamReceived(QByteArray &buffer, quint8 sender, quint16 sequence, quint32 timestamp)
 {
     if(!_isStreamPlaying){
+        // streams have their own output, whatever else is playing or recording carries on
         qDebug() << "stream start";
-        stopPlayback();
-        _streamBufferPlay.open(QIODevice::ReadWrite);
-        _streamBufferPlay.write(buffer);
-        _output->start(&_streamBufferPlay);
+        _mixer.clear();
+        _mixer.open(QIODevice::ReadOnly);
+        _mixer.push(sender, buffer, sequence, timestamp);
         _isStreamPlaying = true;
+        _streamOutput->start(&_mixer);
     }
     else{
         qDebug() << "write stream buffer";
-        _streamBufferPlay.write(buffer);
+        _mixer.push(sender, buffer, sequence, timestamp);
     }
 }
 
 void AudioPlayback::createAudioIO(QAudioFormat format)
 {
-    QAudioDeviceInfo info = QAudioDeviceInfo::defaultInputDevice();
-    _input = new QAudioInput(info, format, this);
-
-    _output = new QAudioOutput(format, this);
+    _input = AudioEndpoints::createSource(format, AudioEndpoints::Message, this);
+    _output = AudioEndpoints::createSink(format, AudioEndpoints::Message, this);
     connect(_output, SIGNAL(stateChanged(QAudio::State)), this, SLOT(onPlayerStateChanged(QAudio::State)));
+
+    _streamInput = AudioEndpoints::createSource(format, AudioEndpoints::Stream, this);
+    connect(_streamInput, SIGNAL(notify()), this, SLOT(onStreamDataReady()));
+
+    _streamOutput = AudioEndpoints::createSink(format, AudioEndpoints::Stream, this);
+    connect(_streamOutput, SIGNAL(stateChanged(QAudio::State)), this, SLOT(onStreamPlayerStateChanged(QAudio::State)));
 }
 
 void AudioPlayback::setAudioFormat(QAudioFormat format)
 {
-    if(_input == NULL) delete _input;
-    if(_output == NULL) delete _output;
+    if(_isStreamPlaying){
+        _mixer.close();
+        _mixer.clear();
+        _isStreamPlaying = false;
+    }
+
+    if(_input != NULL) delete _input;
+    if(_output != NULL) delete _output;
+    if(_streamInput != NULL) delete _streamInput;
+    if(_streamOutput != NULL) delete _streamOutput;
 
     createAudioIO(format);
 }
@@ -161,22 +461,80 @@ void AudioPlayback::setAudioFormat(AudioSettings::Settings settings)
 {
     QAudioFormat format;
     format.setSampleRate(settings.encoderSettings.sampleRate());
-    format.setSampleSize(8);
+    format.setSampleSize(settings.sampleSize);
     format.setChannelCount(settings.encoderSettings.channelCount());
     format.setCodec(settings.encoderSettings.codec());
     format.setByteOrder(QAudioFormat::LittleEndian);
-    format.setSampleType(QAudioFormat::UnSignedInt);
+    // 8 bit PCM is unsigned, 16 bit is signed and 32 bit is float
+    if(settings.sampleSize == 32)
+        format.setSampleType(QAudioFormat::Float);
+    else
+        format.setSampleType((settings.sampleSize == 8) ? QAudioFormat::UnSignedInt : QAudioFormat::SignedInt);
 
     _buffer.setUpperThreshold(settings.upperThreshold);
     _buffer.setLowerThreshold(settings.lowerThreshold);
+    _buffer.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.encoderSettings.sampleRate());
+    _buffer.setCompanding(settings.companding);
+    _buffer.setNoiseSuppression(settings.noiseSuppression);
+
+    _meter.setFormat(settings.sampleSize, settings.encoderSettings.channelCount());
+    _meter.setClipLevels(settings.lowerThreshold, settings.upperThreshold);
+
+    _codec.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.companding);
+
+    _vad.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.encoderSettings.sampleRate());
+    // stream frames are whole sample frames
+    int frameBytes = (settings.sampleSize / 8) * settings.encoderSettings.channelCount();
+    _bytesPerSecond = frameBytes * settings.encoderSettings.sampleRate();
+    _streamFrameMs = settings.streamFrameMs;
+    _streamFrameBytes = (settings.encoderSettings.sampleRate() * _streamFrameMs / 1000) * frameBytes;
+    if(_streamFrameBytes < frameBytes) _streamFrameBytes = frameBytes;
+
+    // room for a few seconds in case the reader falls behind
+    if(!_streamBufferRecord.isOpen()) _streamBufferRecord.setCapacity(_bytesPerSecond * STREAM_BUFFER_SECONDS);
+
+    _mixer.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.encoderSettings.sampleRate());
+
+    _aec.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.encoderSettings.sampleRate());
+    _aecEnabled = settings.echoCancel;
+    _mixer.setEchoCanceller(_aecEnabled ? &_aec : NULL);
+
+    _ns.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.encoderSettings.sampleRate());
+    _ns.setLevel(settings.noiseSuppression);
+    _nsEnabled = (settings.noiseSuppression > 0);
+
+    _sampleSize = settings.sampleSize;
+    _channels = settings.encoderSettings.channelCount();
+    _sampleRate = settings.encoderSettings.sampleRate();
+    _broadcastPrerollMs = settings.broadcastPrerollMs;
+    _vadEnabled = settings.vad;
 
     setAudioFormat(format);
 }
 
-void AudioPlayback::getRecordedAudio(QBuffer& data) const
+QByteArray AudioPlayback::getRecordedAudio() const
+{
+    return _buffer.data();
+}
+
+bool AudioPlayback::getStreamStats(quint8 sender, JitterBuffer::Stats& stats) const
+{
+    return _mixer.getStats(sender, stats);
+}
+
+void AudioPlayback::setStreamGain(quint8 sender, float gain)
+{
+    _mixer.setGain(sender, gain);
+}
+
+void AudioPlayback::setLatencyMonitor(LatencyMonitor* monitor)
+{
+    _mixer.setLatencyMonitor(monitor);
+}
+
+LevelMeter* AudioPlayback::getLevelMeter()
 {
-    QByteArray b = _buffer.data();
-    data.setData(b);
+    return &_meter;
 }
 
 bool AudioPlayback::isRecording() const
@@ -198,4 +556,6 @@ AudioPlayback::~AudioPlayback()
 {
     delete _input;
     delete _output;
+    delete _streamInput;
+    delete _streamOutput;
 }
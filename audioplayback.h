@@ -3,15 +3,22 @@
 
 #include <QObject>
 #include <QBuffer>
-#include <QAudioInput>
-#include <QAudioOutput>
 #include <QAudioFormat>
 #include <QAudioEncoderSettings>
 #include <QTimer>
 
+#include "audioendpoint.h"
 #include "audiofilterbuffer.h"
 #include "streambuffer.h"
+#include "streammixer.h"
+#include "broadcastqueue.h"
+#include "broadcastbuffer.h"
 #include "audiosettings.h"
+#include "audiocodec.h"
+#include "vad.h"
+#include "echocanceller.h"
+#include "noisesuppressor.h"
+#include "levelmeter.h"
 
 /**
     Audio Recording, Playback and Broadcasts
@@ -44,7 +51,7 @@ public:
     void stopPlayback();
 
     /**
-        Start an audio stream
+        Start an audio stream, any recording carries on
     */
     void startStreamingRecording();
 
@@ -85,71 +92,273 @@ public:
     bool isStreamRecording() const;
 
     /**
-        Get the recorded audio
+        Get the playout statistics of a received stream
 
-        @param buffer
-            buffer to copy the audio into
+        @param sender
+            id of the sending station
+
+        @param stats
+            set to the statistics
+
+        @return false if the sender is not streaming
+    */
+    bool getStreamStats(quint8 sender, JitterBuffer::Stats& stats) const;
+
+    /**
+        Set the gain of a sender's stream in the mix
+
+        @param sender
+            id of the sending station
+
+        @param gain
+            linear gain, 1 plays the stream unchanged
+    */
+    void setStreamGain(quint8 sender, float gain);
+
+    /**
+        Report when received stream audio plays
+
+        @param monitor
+            records the playout, NULL to stop reporting
+    */
+    void setLatencyMonitor(LatencyMonitor* monitor);
+
+    /**
+        Get the level of the audio being captured, read by the UI on its own timer
+
+        @return the meter both the message recording and the stream capture feed
+    */
+    LevelMeter* getLevelMeter();
+
+    /**
+        Get the recorded audio without copying it
+
+        @return a view of the recording, valid until the next recording starts
     */
-    void getRecordedAudio(QBuffer& buffer) const;
+    QByteArray getRecordedAudio() const;
 
 public slots:
     void onPlayerStateChanged(QAudio::State);
 
     /**
-        Handle audio broadcast received event
+        Handle the state of the stream output, the incoming streams are over when it goes idle
     */
-    void onAudioReceived(QByteArray&);
+    void onStreamPlayerStateChanged(QAudio::State);
 
     /**
-        Handle stream data received event
+        Handle audio broadcast data as it is received. A broadcast plays as it arrives once its pre-roll is
+        buffered if the output is free, otherwise it is queued when it ends.
+
+        @param sender
+            id of the sending station
+
+        @param priority
+            playback priority of the broadcast
+
+        @param flags
+            FRAGMENT_FIRST when the broadcast starts, FRAGMENT_LAST when it ends
+    */
+    void onBroadcastDataReceived(QByteArray& buffer, quint8 sender, quint8 priority, quint8 flags);
+
+    /**
+        Handle stream data received event, streams of several senders are mixed
+
+        @param sender
+            id of the sending station
+
+        @param sequence
+            sequence number of the chunk
+
+        @param timestamp
+            sender time of the chunk in milliseconds
     */
-    void onAudioStreamReceived(QByteArray& buffer);
+    void onAudioStreamReceived(QByteArray& buffer, quint8 sender, quint16 sequence, quint32 timestamp);
 
     /**
-        Handle the timer event for the stream recorder
+        Packetize captured stream audio into frames and send them
     */
-    void onTick();
+    void onStreamDataReady();
+
+    /**
+        End the broadcasts nothing has arrived for in much longer than their fragments normally take, the
+        last fragment was lost or the sender went away
+    */
+    void onReceiveTimeout();
 
 signals:
     void stoppedPlaying();
-    void onStreamBufferSendReady(QByteArray&);
+
+    /**
+        Emitted when broadcasts are queued or leave the queue
+
+        @param numQueued
+            number of broadcasts waiting to be played
+    */
+    void onBroadcastQueueUpdate(int numQueued);
+
+    /**
+        Emitted for each captured stream frame
+
+        @param timestamp
+            capture time of the first sample in milliseconds
+    */
+    void onStreamBufferSendReady(QByteArray&, quint32 timestamp);
+
+    /**
+        Emitted in place of onStreamBufferSendReady when the stream is silent
+
+        @param descriptor
+            the SilenceDescriptor of the silent audio
+
+        @param timestamp
+            capture time of the first silent sample in milliseconds
+    */
+    void onStreamSilenceReady(QByteArray& descriptor, quint32 timestamp);
 
 private:
     //! recording
-    QAudioInput*  _input;
-    //! playing
-    QAudioOutput* _output;
+    AudioSource* _input;
+    //! playing recordings and broadcasts
+    AudioSink* _output;
+    //! capturing the outgoing stream
+    AudioSource* _streamInput;
+    //! playing the incoming streams
+    AudioSink* _streamOutput;
     //! buffer to hold recorded data
     AudioFilterBuffer _buffer;
-    //! buffer to hold the audio stream
+    //! ring holding captured stream audio until it is sent
     StreamBuffer _streamBufferRecord;
-    //!
-    StreamBuffer _streamBufferPlay;
-    //! buffer used to hold broadcasted audio
+    //! mixes the received streams of every sender
+    StreamMixer _mixer;
+    //! buffer used to hold the broadcast being played
     QBuffer _broadcast;
+    //! received broadcasts waiting to be played
+    BroadcastQueue _broadcastQueue;
+
+    //! A broadcast being received
+    struct Receiving{
+        BroadcastBuffer* buffer; ///< audio received so far
+        uint8_t priority;        ///< playback priority
+        qint64 reserved;         ///< bytes reserved in the broadcast queue's budget
+        qint64 lastArrival;      ///< time the last fragment arrived
+        double meanInterval;     ///< smoothed time between fragments, 0 before the first
+    };
+    //! broadcasts being received, keyed by sender
+    QMap<uint8_t, Receiving> _receiving;
+    //! checks the broadcasts being received for a sender that went away
+    QTimer _receiveTimer;
+    //! received broadcast being played as it arrives, NULL if none
+    BroadcastBuffer* _playingBroadcast;
+    //! bytes the broadcast played as it arrived still holds in the queue's budget once received
+    qint64 _playingReserved;
+    //! audio buffered before a broadcast plays as it arrives
+    int _broadcastPrerollMs;
+    //! format of the audio played out
+    int _sampleSize;
+    int _channels;
+    int _sampleRate;
+    //! recorded audio expanded to linear PCM for listening
+    QBuffer _listen;
+
+    //! expands companded recordings
+    AudioCodec _codec;
+
+    //! detects silence in the outgoing stream
+    VoiceActivityDetector _vad;
+    //! send silence descriptors in place of silent stream audio
+    bool _vadEnabled;
+
+    //! removes the received streams from the captured stream
+    EchoCanceller _aec;
+    //! cancel echo in the captured stream
+    bool _aecEnabled;
 
-    //! Timer for streaming
-    QTimer* _timer;
+    //! removes background noise from the captured stream
+    NoiseSuppressor _ns;
+    //! suppress noise in the captured stream
+    bool _nsEnabled;
+
+    //! level of the captured audio
+    LevelMeter _meter;
+
+    //! milliseconds of audio in a stream frame
+    int _streamFrameMs;
+    //! bytes of captured audio in a stream frame
+    int _streamFrameBytes;
+    //! bytes per second of captured audio
+    int _bytesPerSecond;
+
+    //! time the stream capture started
+    qint64 _streamStartMs;
+    //! captured bytes taken from the ring since the stream started
+    qint64 _streamBytesRead;
+
+    //! silent frames waiting for a descriptor
+    QByteArray _silentRun;
+    //! capture time of the first silent frame
+    quint32 _silentRunTimestamp;
 
     //! is recording
     bool _recording;
     //! is playing
     bool _playing;
-    //! is there a broadcast waiting to be played
-    bool _broadcastPending;
+    //! is playing a broadcast
+    bool _isBroadcastPlaying;
     //! is streaming recording stream audio
     bool _isStreamRecording;
     //! is playing stream audio
     bool _isStreamPlaying;
 
     /**
-        Create the audio input and output devices with a format
+        Create the audio sources and sinks with a format, hardware or headless as configured. Messages and
+        streams get their own, so a stream can be sent and received at once, alongside a recording.
 
         @param format
             the given format to use
     */
     void createAudioIO(QAudioFormat format);
 
+    /**
+        Stop playing the incoming streams
+    */
+    void stopStreamPlayback();
+
+    /**
+        Play the next queued broadcast if the output is free
+    */
+    void playNextBroadcast();
+
+    /**
+        A sender's broadcast was received, queue it unless it is already playing
+
+        @param sender
+            id of the sending station
+    */
+    void finishBroadcast(uint8_t sender);
+
+    /**
+        Drop a broadcast being received that does not fit the queue's budget, what already plays carries on
+
+        @param sender
+            id of the sending station
+    */
+    void abortBroadcast(uint8_t sender);
+
+    /**
+        Send a captured frame, or hold it for a silence descriptor
+    */
+    void sendStreamFrame(QByteArray& captured, quint32 timestamp);
+
+    /**
+        Send the descriptor for the held silent frames
+    */
+    void flushSilence();
+
+    /**
+        @return capture time of the next frame in the ring
+    */
+    quint32 captureTime() const;
+
 };
 
 #endif // AUDIOPLAYBACK_H
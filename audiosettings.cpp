@@ -14,6 +14,7 @@
 #include <QDebug>
 
 #include "audiofilterbuffer.h"
+#include "audiocodec.h"
 
 AudioSettings::AudioSettings(QWidget *parent) :
     QDialog(parent),
@@ -26,6 +27,15 @@ AudioSettings::AudioSettings(QWidget *parent) :
     connect(ui->bnSave, SIGNAL(clicked()), this, SLOT(saveSettings()));
     connect(ui->bnCancel, SIGNAL(clicked()), this, SLOT(close()));
 
+    settings.sampleSize = 8;
+    settings.companding = AUDIO_CODEC_PCM;
+    settings.vad = false;
+    settings.streamFrameMs = 20;
+    settings.broadcastPrerollMs = 1000;
+    settings.echoCancel = false;
+    settings.wireSampleRate = 0;
+    settings.noiseSuppression = 0;
+
     fillParams();
     loadSettings();
 
@@ -45,6 +55,22 @@ void AudioSettings::updateSettings()
     settings.encoderSettings.setCodec(ui->cmbAudioCodec->currentText());
     settings.upperThreshold = ui->cmbUpperThreshold->itemData(ui->cmbUpperThreshold->currentIndex()).toInt();
     settings.lowerThreshold = ui->cmbLowerThreshold->itemData(ui->cmbLowerThreshold->currentIndex()).toInt();
+    settings.sampleSize = ui->cmbSampleSize->itemData(ui->cmbSampleSize->currentIndex()).toInt();
+    settings.companding = ui->cmbCompanding->itemData(ui->cmbCompanding->currentIndex()).toInt();
+    settings.vad = ui->cbVoiceDetection->isChecked();
+    settings.streamFrameMs = ui->cmbStreamFrame->itemData(ui->cmbStreamFrame->currentIndex()).toInt();
+    settings.broadcastPrerollMs = ui->cmbBroadcastPreroll->itemData(ui->cmbBroadcastPreroll->currentIndex()).toInt();
+    settings.echoCancel = ui->cbEchoCancel->isChecked();
+    settings.wireSampleRate = ui->cmbWireRate->itemData(ui->cmbWireRate->currentIndex()).toInt();
+    settings.noiseSuppression = ui->cmbNoiseSuppression->itemData(ui->cmbNoiseSuppression->currentIndex()).toInt();
+
+    // companding is applied to 16 bit captures
+    if(settings.companding != AUDIO_CODEC_PCM){
+        settings.sampleSize = 16;
+        ui->cmbSampleSize->setCurrentIndex(ui->cmbSampleSize->findData(settings.sampleSize));
+        ui->cmbCompanding->setCurrentIndex(ui->cmbCompanding->findData(settings.companding));
+        ui->cbVoiceDetection->setChecked(settings.vad);
+    }
 }
 
 void AudioSettings::fillParams()
@@ -65,6 +91,49 @@ void AudioSettings::fillParams()
     ui->cmbBitsRate->addItem("32000", 32000);
     ui->cmbBitsRate->addItem("64000", 64000);
 
+    // rate audio is sent at, converted from and to the device rate
+    ui->cmbWireRate->addItem("Device", 0);
+    ui->cmbWireRate->addItem("8000", 8000);
+    ui->cmbWireRate->addItem("11025", 11025);
+    ui->cmbWireRate->addItem("16000", 16000);
+    ui->cmbWireRate->addItem("22050", 22050);
+    ui->cmbWireRate->addItem("32000", 32000);
+    ui->cmbWireRate->addItem("44100", 44100);
+    ui->cmbWireRate->addItem("48000", 48000);
+
+    // sample size options
+    ui->cmbSampleSize->addItem("8", 8);
+    ui->cmbSampleSize->addItem("16", 16);
+    ui->cmbSampleSize->addItem("32 (float)", 32);
+
+    // stream packet durations
+    ui->cmbStreamFrame->addItem("10", 10);
+    ui->cmbStreamFrame->addItem("20", 20);
+    ui->cmbStreamFrame->addItem("40", 40);
+    ui->cmbStreamFrame->addItem("60", 60);
+    ui->cmbStreamFrame->setCurrentIndex(ui->cmbStreamFrame->findData(settings.streamFrameMs));
+
+    // audio buffered before a broadcast starts playing while it is still arriving
+    ui->cmbBroadcastPreroll->addItem("250", 250);
+    ui->cmbBroadcastPreroll->addItem("500", 500);
+    ui->cmbBroadcastPreroll->addItem("1000", 1000);
+    ui->cmbBroadcastPreroll->addItem("2000", 2000);
+    ui->cmbBroadcastPreroll->addItem("4000", 4000);
+    ui->cmbBroadcastPreroll->setCurrentIndex(ui->cmbBroadcastPreroll->findData(settings.broadcastPrerollMs));
+
+    // most attenuation of the background noise in dB
+    ui->cmbNoiseSuppression->addItem("Off", 0);
+    ui->cmbNoiseSuppression->addItem("6", 6);
+    ui->cmbNoiseSuppression->addItem("12", 12);
+    ui->cmbNoiseSuppression->addItem("18", 18);
+    ui->cmbNoiseSuppression->addItem("24", 24);
+    ui->cmbNoiseSuppression->setCurrentIndex(ui->cmbNoiseSuppression->findData(settings.noiseSuppression));
+
+    // companding options
+    ui->cmbCompanding->addItem("None", AUDIO_CODEC_PCM);
+    ui->cmbCompanding->addItem("mu-law", AUDIO_CODEC_ULAW);
+    ui->cmbCompanding->addItem("A-law", AUDIO_CODEC_ALAW);
+
     int i;
     for(i = 0; i <= AudioFilterBuffer::Amplitude::MAX; i++){
         ui->cmbUpperThreshold->addItem(QString::number(i), i);
@@ -96,6 +165,15 @@ void AudioSettings::loadSettings()
 
         settings.upperThreshold = json[UPPERTHRESHOLD].toInt();
         settings.lowerThreshold = json[LOWERTHRESHOLD].toInt();
+        settings.sampleSize = json.value(SAMPLESIZE).toInt(8);
+        settings.companding = json.value(COMPANDING).toInt(AUDIO_CODEC_PCM);
+        if(settings.companding != AUDIO_CODEC_PCM) settings.sampleSize = 16;
+        settings.vad = json[VOICEDETECTION].toBool();
+        settings.streamFrameMs = json.value(STREAMFRAME).toInt(20);
+        settings.broadcastPrerollMs = json.value(BROADCASTPREROLL).toInt(1000);
+        settings.echoCancel = json[ECHOCANCEL].toBool();
+        settings.wireSampleRate = json[WIRESAMPLERATE].toInt();
+        settings.noiseSuppression = json[NOISESUPPRESSION].toInt();
 
         // update the dialoag to match
         ui->etSampleRate->setText(QString("%1").arg(settings.encoderSettings.sampleRate()));
@@ -106,6 +184,15 @@ void AudioSettings::loadSettings()
         ui->cmbUpperThreshold->setCurrentIndex(ui->cmbUpperThreshold->findData(settings.upperThreshold));
         ui->cmbLowerThreshold->setCurrentIndex(ui->cmbLowerThreshold->findData(settings.lowerThreshold));
 
+        ui->cmbSampleSize->setCurrentIndex(ui->cmbSampleSize->findData(settings.sampleSize));
+        ui->cmbCompanding->setCurrentIndex(ui->cmbCompanding->findData(settings.companding));
+        ui->cbVoiceDetection->setChecked(settings.vad);
+        ui->cmbStreamFrame->setCurrentIndex(ui->cmbStreamFrame->findData(settings.streamFrameMs));
+        ui->cmbBroadcastPreroll->setCurrentIndex(ui->cmbBroadcastPreroll->findData(settings.broadcastPrerollMs));
+        ui->cbEchoCancel->setChecked(settings.echoCancel);
+        ui->cmbWireRate->setCurrentIndex(ui->cmbWireRate->findData((int)settings.wireSampleRate));
+        ui->cmbNoiseSuppression->setCurrentIndex(ui->cmbNoiseSuppression->findData(settings.noiseSuppression));
+
         file.close();
 
     }
@@ -122,6 +209,14 @@ void AudioSettings::saveSettings()
 
     json[UPPERTHRESHOLD] = settings.upperThreshold;
     json[LOWERTHRESHOLD] = settings.lowerThreshold;
+    json[SAMPLESIZE] = settings.sampleSize;
+    json[COMPANDING] = settings.companding;
+    json[VOICEDETECTION] = settings.vad;
+    json[STREAMFRAME] = settings.streamFrameMs;
+    json[BROADCASTPREROLL] = settings.broadcastPrerollMs;
+    json[ECHOCANCEL] = settings.echoCancel;
+    json[WIRESAMPLERATE] = (int)settings.wireSampleRate;
+    json[NOISESUPPRESSION] = settings.noiseSuppression;
 
     QJsonDocument doc(json);
 
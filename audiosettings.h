@@ -15,6 +15,14 @@
 #define AUDIOCODEC        "AudioCodec"
 #define UPPERTHRESHOLD    "UpperThreshold"
 #define LOWERTHRESHOLD    "LowerThreshold"
+#define SAMPLESIZE        "SampleSize"
+#define COMPANDING        "Companding"
+#define VOICEDETECTION    "VoiceActivityDetection"
+#define STREAMFRAME       "StreamFrameMs"
+#define BROADCASTPREROLL  "BroadcastPrerollMs"
+#define ECHOCANCEL        "EchoCancellation"
+#define WIRESAMPLERATE    "WireSampleRate"
+#define NOISESUPPRESSION  "NoiseSuppressionDb"
 
 namespace Ui {
 class AudioSettings;
@@ -36,6 +44,14 @@ public:
         QAudioEncoderSettings encoderSettings; ///< audio format
         uint8_t upperThreshold;                ///< upper filter cut off
         uint8_t lowerThreshold;                ///< lower filter cut off
+        uint8_t sampleSize;                    ///< bits per captured sample (8, 16 or 32 float)
+        uint8_t companding;                    ///< compand 16 bit capture to 8 bit mu-law or A-law
+        bool vad;                              ///< replace silent stream audio with comfort noise descriptors
+        uint8_t streamFrameMs;                 ///< milliseconds of audio in each stream packet
+        uint16_t broadcastPrerollMs;           ///< audio received before a broadcast starts playing
+        bool echoCancel;                       ///< remove received streams picked up by the microphone
+        uint32_t wireSampleRate;               ///< samples per second of audio sent, 0 sends at the device rate
+        uint8_t noiseSuppression;              ///< dB background noise is brought down by, 0 turns suppression off
     };
 
      Settings getSettings() const;
@@ -0,0 +1,159 @@
+
+/**
+    @file broadcastbuffer.cpp
+    @breif Plays a broadcast while it is still being received
+    @author Natesh Narain
+*/
+
+#include "broadcastbuffer.h"
+
+#include <cstring>
+
+#include <QDebug>
+
+#define BROADCAST_COMPACT_BYTES 65536 ///< played audio is dropped from the front once it grows past this
+
+BroadcastBuffer::BroadcastBuffer(QObject *parent) : QIODevice(parent)
+{
+    _readPos = 0;
+    _finished = false;
+    _buffering = true;
+    _underruns = 0;
+    _prerollMs = 1000;
+
+    setFormat(8, 1, 8000);
+}
+
+void BroadcastBuffer::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    if(channels < 1) channels = 1;
+
+    _frameBytes = (sampleSize / 8) * channels;
+    if(_frameBytes < 1) _frameBytes = 1;
+
+    // 8 bit audio is unsigned, silence is the middle of the range
+    _silence = (sampleSize == 8) ? (char)0x80 : 0;
+    _bytesPerSecond = _frameBytes * sampleRate;
+
+    updatePreroll();
+}
+
+void BroadcastBuffer::setPreroll(int ms)
+{
+    _prerollMs = (ms > 0) ? ms : 0;
+    updatePreroll();
+}
+
+void BroadcastBuffer::updatePreroll()
+{
+    _prerollBytes = (int)(((qint64)_bytesPerSecond * _prerollMs / 1000) / _frameBytes) * _frameBytes;
+}
+
+void BroadcastBuffer::append(const QByteArray& audio)
+{
+    // drop what was played so a long broadcast does not keep all of itself
+    if(_readPos >= BROADCAST_COMPACT_BYTES && _readPos >= _audio.size() / 2){
+        _audio.remove(0, _readPos);
+        _readPos = 0;
+    }
+
+    _audio.append(audio);
+
+    if(audio.size() > 0) emit readyRead();
+}
+
+void BroadcastBuffer::finish()
+{
+    _finished = true;
+
+    qDebug() << "Broadcast received, " << _underruns << " underruns";
+}
+
+bool BroadcastBuffer::isFinished() const
+{
+    return _finished;
+}
+
+bool BroadcastBuffer::isReady() const
+{
+    const int available = _audio.size() - _readPos;
+
+    return (_finished && available > 0) || (available > 0 && available >= _prerollBytes);
+}
+
+QByteArray BroadcastBuffer::data() const
+{
+    return _audio.mid(_readPos);
+}
+
+int BroadcastBuffer::heldBytes() const
+{
+    return _audio.size();
+}
+
+int BroadcastBuffer::getUnderruns() const
+{
+    return _underruns;
+}
+
+bool BroadcastBuffer::open(OpenMode mode)
+{
+    _buffering = true;
+
+    // reads come straight from the received audio, QIODevice must not buffer ahead of it
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+bool BroadcastBuffer::isSequential() const
+{
+    return true;
+}
+
+bool BroadcastBuffer::atEnd() const
+{
+    return _finished && _readPos >= _audio.size();
+}
+
+qint64 BroadcastBuffer::bytesAvailable() const
+{
+    return (_audio.size() - _readPos) + QIODevice::bytesAvailable();
+}
+
+qint64 BroadcastBuffer::readData(char *data, qint64 maxlen)
+{
+    const int available = _audio.size() - _readPos;
+
+    if(_buffering && isReady()) _buffering = false;
+
+    if(!_buffering && available > 0){
+        int n = (maxlen < available) ? (int)maxlen : available;
+
+        memcpy(data, _audio.constData() + _readPos, n);
+        _readPos += n;
+
+        return n;
+    }
+
+    // everything was played
+    if(_finished) return 0;
+
+    // the output caught up with the sender, wait for the pre-roll again
+    if(!_buffering){
+        _underruns++;
+        _buffering = true;
+        qDebug() << "Broadcast underrun, rebuffering";
+    }
+
+    qint64 n = (maxlen / _frameBytes) * _frameBytes;
+    memset(data, _silence, n);
+
+    return n;
+}
+
+qint64 BroadcastBuffer::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+
+    return -1;
+}
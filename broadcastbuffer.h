@@ -0,0 +1,130 @@
+#ifndef BROADCASTBUFFER_H
+#define BROADCASTBUFFER_H
+
+#include <cstdint>
+
+#include <QIODevice>
+#include <QByteArray>
+
+/**
+    Plays a broadcast while it is still being received
+
+    Decoded audio is appended as it arrives. Playback may start once a pre-roll of audio is buffered, if
+    the output catches up with the sender it is fed silence and waits for the pre-roll to build up again.
+    The end of input is reported once the broadcast is finished and everything was played.
+*/
+class BroadcastBuffer : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit BroadcastBuffer(QObject *parent = 0);
+
+    /**
+        Set the format of the audio played out
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Set the audio buffered before playback starts, and after the output runs dry
+
+        @param ms
+            pre-roll in milliseconds
+    */
+    void setPreroll(int ms);
+
+    /**
+        Add received audio
+
+        @param audio
+            decoded audio in the playout format
+    */
+    void append(const QByteArray& audio);
+
+    /**
+        Mark the broadcast as received, the rest plays without waiting for the pre-roll
+    */
+    void finish();
+
+    /**
+        @return true once the whole broadcast was received
+    */
+    bool isFinished() const;
+
+    /**
+        @return true if enough audio is buffered to start playing
+    */
+    bool isReady() const;
+
+    /**
+        @return the audio not played yet
+    */
+    QByteArray data() const;
+
+    /**
+        @return the bytes of audio held, played audio not dropped yet included
+    */
+    int heldBytes() const;
+
+    /**
+        @return the number of times the output ran dry
+    */
+    int getUnderruns() const;
+
+    /**
+        Reimplemented QIODevice::open(), always unbuffered
+    */
+    bool open(OpenMode mode);
+
+    bool isSequential() const;
+    bool atEnd() const;
+    qint64 bytesAvailable() const;
+
+protected:
+    /**
+        Reimplementation of QIODevice::readData(), silence while waiting for the pre-roll
+    */
+    qint64 readData(char *data, qint64 maxlen);
+
+    /**
+        Reimplementation of QIODevice::writeData(), audio is added with append()
+    */
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    //! received audio, the front is dropped as it plays
+    QByteArray _audio;
+    //! read position in the audio
+    int _readPos;
+    //! the whole broadcast was received
+    bool _finished;
+    //! waiting for the pre-roll before playing audio
+    bool _buffering;
+    //! bytes in a sample frame
+    int _frameBytes;
+    //! value of a silent sample byte
+    char _silence;
+    //! bytes buffered before playing
+    int _prerollBytes;
+    //! pre-roll in milliseconds
+    int _prerollMs;
+    //! bytes per second of audio
+    int _bytesPerSecond;
+    //! times the output ran dry
+    int _underruns;
+
+    /**
+        Recalculate the pre-roll in bytes
+    */
+    void updatePreroll();
+};
+
+#endif // BROADCASTBUFFER_H
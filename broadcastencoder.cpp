@@ -0,0 +1,92 @@
+
+/**
+    @file broadcastencoder.cpp
+    @breif Encodes broadcasts into fragment frames on a worker thread
+    @author Natesh Narain
+*/
+
+#include "broadcastencoder.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+BroadcastEncoder::BroadcastEncoder(QObject *parent) : QObject(parent)
+{
+    // queued across threads once the encoder is moved to its worker
+    connect(this, SIGNAL(jobQueued()), this, SLOT(process()));
+}
+
+void BroadcastEncoder::submit(const Job& job)
+{
+    {
+        QMutexLocker locker(&_sync);
+        _jobs.append(job);
+        _jobs.last().generation = _generation.loadAcquire();
+    }
+
+    emit jobQueued();
+}
+
+void BroadcastEncoder::cancel()
+{
+    QMutexLocker locker(&_sync);
+
+    _jobs.clear();
+    _generation.fetchAndAddOrdered(1);
+}
+
+bool BroadcastEncoder::takeJob(Job& job)
+{
+    QMutexLocker locker(&_sync);
+
+    if(_jobs.isEmpty()) return false;
+
+    job = _jobs.takeFirst();
+    return true;
+}
+
+void BroadcastEncoder::process()
+{
+    Job job;
+
+    while(takeJob(job)){
+        const int total = job.clip.size();
+        int offset = 0;
+        uint16_t index = 0;
+
+        // the encoded chunk fills the payload, before compression shrinks it
+        int chunk = job.codec.capturedBytesFor(job.payloadBytes, job.audioCodec, job.header.bRateDivisor);
+        if(chunk > BROADCAST_CHUNK_BYTES) chunk = BROADCAST_CHUNK_BYTES - BROADCAST_CHUNK_BYTES % job.codec.getCapturedFrameBytes();
+
+        qDebug() << "Encoding broadcast of " << total << " bytes";
+
+        do{
+            int n = total - offset;
+            if(n > chunk) n = chunk;
+
+            FrameHeader header = job.header;
+            header.wSequence = index;
+            header.bFragment = 0;
+            if(offset == 0) header.bFragment |= FRAGMENT_FIRST;
+            if(offset + n >= total) header.bFragment |= FRAGMENT_LAST;
+
+            // chunks are whole sample frames
+            QByteArray payload = QByteArray::fromRawData(job.clip.constData() + offset, n);
+            SerialCom::encodeAudioPayload(header, payload, job.decodeOptions, job.audioCodec, job.codec, &job.resampler,
+                                          (header.bFragment & FRAGMENT_LAST) != 0);
+
+            QByteArray frame((const char*)&header, sizeof(FrameHeader));
+            frame.append(payload);
+
+            // cancelled while encoding, the rest of the broadcast is not wanted
+            if(job.generation != _generation.loadAcquire()) break;
+
+            emit onFragmentReady(frame);
+
+            offset += n;
+            index++;
+        }while(offset < total);
+
+        if(offset >= total) emit onBroadcastEncoded();
+    }
+}
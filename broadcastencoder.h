@@ -0,0 +1,94 @@
+#ifndef BROADCASTENCODER_H
+#define BROADCASTENCODER_H
+
+#include <cstdint>
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QAtomicInt>
+
+#include "serialcom.h"
+
+#define BROADCAST_CHUNK_BYTES       4096 ///< most recorded audio per broadcast fragment
+#define BROADCAST_MIN_PAYLOAD_BYTES 64   ///< least audio a fragment carries, so headers do not take a slow link
+
+/**
+    Encodes recorded broadcasts into fragment frames on a worker thread
+
+    A broadcast is cut into chunks, and each chunk is encoded, compressed and encrypted into a frame of
+    its own. Chunks are sized so a fragment holds the link for about as long as a stream frame may wait. Each frame is handed back as soon as it is done, so the port is sending the first fragments
+    while the encoder is still working on later ones.
+*/
+class BroadcastEncoder : public QObject
+{
+    Q_OBJECT
+public:
+    //! A broadcast waiting to be encoded
+    struct Job{
+        QByteArray clip;        ///< recorded audio
+        FrameHeader header;     ///< header the fragments start from
+        uint8_t decodeOptions;  ///< message type, compression and encryption
+        uint8_t audioCodec;     ///< codec to encode the audio with
+        AudioCodec codec;       ///< the sender's codec settings when the broadcast was sent
+        Resampler resampler;    ///< carries the rate conversion from one fragment to the next
+        int payloadBytes;       ///< most encoded audio in a fragment
+        int generation;         ///< cancel() calls before the job was queued
+    };
+
+    explicit BroadcastEncoder(QObject *parent = 0);
+
+    /**
+        Queue a broadcast, may be called from any thread
+
+        @param job
+            the broadcast
+    */
+    void submit(const Job& job);
+
+    /**
+        Drop the queued broadcasts and stop the one being encoded, may be called from any thread
+    */
+    void cancel();
+
+signals:
+    /**
+        Emitted for each encoded fragment
+
+        @param frame
+            header and payload, ready for the port
+    */
+    void onFragmentReady(QByteArray frame);
+
+    /**
+        Emitted after the last fragment of a broadcast
+    */
+    void onBroadcastEncoded();
+
+    //! Wakes the worker thread when a job is queued
+    void jobQueued();
+
+private slots:
+    /**
+        Encode the queued broadcasts, runs on the worker thread
+    */
+    void process();
+
+private:
+    //! broadcasts waiting to be encoded
+    QList<Job> _jobs;
+    //! guards the job list
+    QMutex _sync;
+    //! counts cancel() calls, jobs queued before the last one are dropped
+    QAtomicInt _generation;
+
+    /**
+        Take the next job off the queue
+
+        @return false if there is none
+    */
+    bool takeJob(Job& job);
+};
+
+#endif // BROADCASTENCODER_H
@@ -0,0 +1,153 @@
+
+/**
+    @file broadcastqueue.cpp
+    @breif Priority queue of received audio broadcasts with a memory budget
+    @author Natesh Narain
+*/
+
+#include "broadcastqueue.h"
+
+#include <QDebug>
+
+#define BROADCAST_DEFAULT_BUDGET (8 * 1024 * 1024) ///< default memory budget in bytes
+
+BroadcastQueue::BroadcastQueue()
+{
+    _bytes = 0;
+    _reserved = 0;
+    _budget = BROADCAST_DEFAULT_BUDGET;
+    _policy = EvictOldest;
+    _nextOrder = 0;
+    _evicted = 0;
+}
+
+void BroadcastQueue::setBudget(qint64 bytes)
+{
+    _budget = bytes;
+}
+
+void BroadcastQueue::setEvictionPolicy(EvictionPolicy policy)
+{
+    _policy = policy;
+}
+
+bool BroadcastQueue::makeRoom(qint64 bytes, uint8_t priority)
+{
+    if(_reserved + bytes > _budget){
+        qDebug() << "Broadcast of " << bytes << " bytes does not fit the queue budget";
+        _evicted++;
+        return false;
+    }
+
+    while(_bytes + _reserved + bytes > _budget){
+        int victim = evictionCandidate(priority);
+
+        if(victim < 0){
+            qDebug() << "Broadcast queue full, dropping new broadcast";
+            _evicted++;
+            return false;
+        }
+
+        _bytes -= _clips[victim].audio.size();
+        _clips.removeAt(victim);
+        _evicted++;
+    }
+
+    return true;
+}
+
+bool BroadcastQueue::enqueue(const QByteArray& clip, uint8_t priority)
+{
+    if(!makeRoom(clip.size(), priority)) return false;
+
+    Clip entry;
+    entry.audio = clip;
+    entry.priority = priority;
+    entry.order = _nextOrder++;
+
+    // after every clip of the same or higher priority
+    int i = 0;
+    while(i < _clips.size() && _clips[i].priority >= priority) i++;
+
+    _clips.insert(i, entry);
+    _bytes += clip.size();
+
+    return true;
+}
+
+bool BroadcastQueue::reserve(qint64 bytes, uint8_t priority)
+{
+    if(!makeRoom(bytes, priority)) return false;
+
+    _reserved += bytes;
+
+    return true;
+}
+
+void BroadcastQueue::unreserve(qint64 bytes)
+{
+    _reserved -= bytes;
+    if(_reserved < 0) _reserved = 0;
+}
+
+bool BroadcastQueue::dequeue(QByteArray& clip)
+{
+    if(_clips.isEmpty()) return false;
+
+    Clip entry = _clips.takeFirst();
+    _bytes -= entry.audio.size();
+    clip = entry.audio;
+
+    return true;
+}
+
+int BroadcastQueue::evictionCandidate(uint8_t priority) const
+{
+    int candidate = -1;
+    int i;
+
+    if(_policy == RejectNew) return -1;
+
+    for(i = 0; i < _clips.size(); ++i){
+        const Clip& clip = _clips[i];
+
+        if(_policy == EvictOldest){
+            if(candidate < 0 || clip.order < _clips[candidate].order) candidate = i;
+        }
+        else if(clip.priority <= priority){
+            // lowest priority, and the oldest of those
+            if(candidate < 0 || clip.priority < _clips[candidate].priority
+               || (clip.priority == _clips[candidate].priority && clip.order < _clips[candidate].order)){
+                candidate = i;
+            }
+        }
+    }
+
+    return candidate;
+}
+
+void BroadcastQueue::clear()
+{
+    _clips.clear();
+    _bytes = 0;
+}
+
+int BroadcastQueue::size() const
+{
+    return _clips.size();
+}
+
+qint64 BroadcastQueue::bytes() const
+{
+    return _bytes;
+}
+
+qint64 BroadcastQueue::reserved() const
+{
+    return _reserved;
+}
+
+uint32_t BroadcastQueue::getEvicted() const
+{
+    return _evicted;
+}
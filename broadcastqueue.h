@@ -0,0 +1,157 @@
+#ifndef BROADCASTQUEUE_H
+#define BROADCASTQUEUE_H
+
+#include <cstdint>
+
+#include <QByteArray>
+#include <QList>
+
+#define BROADCAST_PRIORITY_LOW    0 ///< played after everything else
+#define BROADCAST_PRIORITY_NORMAL 1 ///< default priority
+#define BROADCAST_PRIORITY_URGENT 2 ///< played before everything else
+
+/**
+    Received audio broadcasts waiting to be played
+
+    The queue owns copies of its clips. Higher priority clips play first, clips of equal priority play
+    in the order they arrived. The total size of the queued audio, and of the broadcasts still being
+    received that reserve room in it, is capped, a clip that does not fit makes room according to the
+    eviction policy.
+*/
+class BroadcastQueue
+{
+public:
+    //! How room is made for a clip that does not fit the budget
+    enum EvictionPolicy{
+        EvictOldest,          ///< drop the clips that arrived first
+        EvictLowestPriority,  ///< drop the lowest priority clips, oldest first, never one above the new clip
+        RejectNew             ///< keep the queue and drop the new clip
+    };
+
+    BroadcastQueue(void);
+
+    /**
+        Set the most audio the queue holds
+
+        @param bytes
+            memory budget in bytes
+    */
+    void setBudget(qint64 bytes);
+
+    /**
+        Set how room is made for a clip that does not fit
+
+        @param policy
+            the eviction policy
+    */
+    void setEvictionPolicy(EvictionPolicy policy);
+
+    /**
+        Add a clip
+
+        @param clip
+            audio in the playback format, copied into the queue
+
+        @param priority
+            playback priority
+
+        @return false if the clip was dropped
+    */
+    bool enqueue(const QByteArray& clip, uint8_t priority = BROADCAST_PRIORITY_NORMAL);
+
+    /**
+        Reserve room for audio held outside the queue, a broadcast still being received, making room as
+        for a new clip
+
+        @param bytes
+            bytes to reserve
+
+        @param priority
+            playback priority of the audio
+
+        @return false if there is no room, nothing is reserved
+    */
+    bool reserve(qint64 bytes, uint8_t priority = BROADCAST_PRIORITY_NORMAL);
+
+    /**
+        Give back reserved room
+
+        @param bytes
+            bytes reserved with reserve()
+    */
+    void unreserve(qint64 bytes);
+
+    /**
+        Take the next clip to play
+
+        @param clip
+            set to the clip
+
+        @return false if the queue is empty
+    */
+    bool dequeue(QByteArray& clip);
+
+    /**
+        Drop all clips
+    */
+    void clear();
+
+    /**
+        @return the number of queued clips
+    */
+    int size() const;
+
+    /**
+        @return the number of queued bytes
+    */
+    qint64 bytes() const;
+
+    /**
+        @return the number of reserved bytes
+    */
+    qint64 reserved() const;
+
+    /**
+        @return the number of clips dropped to stay within the budget
+    */
+    uint32_t getEvicted() const;
+
+private:
+    //! A queued broadcast
+    struct Clip{
+        QByteArray audio;   ///< audio in the playback format
+        uint8_t priority;   ///< playback priority
+        quint64 order;      ///< arrival order
+    };
+
+    //! clips in playback order, highest priority first
+    QList<Clip> _clips;
+    //! bytes of queued audio
+    qint64 _bytes;
+    //! bytes reserved for audio held outside the queue
+    qint64 _reserved;
+    //! memory budget
+    qint64 _budget;
+    //! how room is made
+    EvictionPolicy _policy;
+    //! arrival counter
+    quint64 _nextOrder;
+    //! clips dropped
+    uint32_t _evicted;
+
+    /**
+        Choose the clip to evict for a new clip
+
+        @return index of the clip, -1 if none may be evicted
+    */
+    int evictionCandidate(uint8_t priority) const;
+
+    /**
+        Evict clips until a number of bytes fits the budget
+
+        @return false if they cannot fit
+    */
+    bool makeRoom(qint64 bytes, uint8_t priority);
+};
+
+#endif // BROADCASTQUEUE_H
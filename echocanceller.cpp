@@ -0,0 +1,499 @@
+
+/**
+    @file echocanceller.cpp
+    @breif Acoustic echo cancellation for full duplex streams
+    @author Natesh Narain
+*/
+
+#include "echocanceller.h"
+
+#include <QMutexLocker>
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define AEC_BLOCK_MS        8       ///< block length, rounded up to a power of two of samples
+#define AEC_TAIL_MS         128     ///< longest echo path modelled, speaker and device latency included
+#define AEC_MAX_LAG_MS      200     ///< most reference held waiting for the matching capture
+#define AEC_STEP            0.5f    ///< adaptation step, shared by the partitions
+#define AEC_POWER_SMOOTH    0.9f    ///< smoothing of the reference power per bin
+#define AEC_REGULARIZATION  10000.0f ///< reference power below an RMS of 100 does not speed up adaptation
+#define AEC_SILENCE_LEVEL   64.0f   ///< reference peaks below this are taken as silence
+#define AEC_GEIGEL_RATIO    0.5f    ///< near end peaks above this part of the reference peak are double talk
+#define AEC_HANGOVER_MS     100     ///< adaptation stays frozen this long after double talk
+#define AEC_MAX_LEVEL       32767.0f ///< largest sample on the 16 bit scale
+#define AEC_MIN_LEVEL      -32768.0f ///< smallest sample on the 16 bit scale
+
+static inline float _linear(uint8_t sample){ return (sample - 0x80) * 256.0f; }
+static inline float _linear(int16_t sample){ return sample; }
+static inline float _linear(float sample){ return sample * 32768.0f; }
+
+static inline float _saturate(float x)
+{
+    return (x > AEC_MAX_LEVEL) ? AEC_MAX_LEVEL : ((x < AEC_MIN_LEVEL) ? AEC_MIN_LEVEL : x);
+}
+
+/**
+    Convert interleaved samples to the 16 bit scale
+
+    @param mono
+        when true the channels are averaged into one sample per frame
+*/
+template<typename T>
+static void _toLinear(const T* in, float* out, int numFrames, int channels, bool mono)
+{
+    int i, c;
+
+    if(!mono || channels == 1){
+        for(i = 0; i < numFrames * channels; ++i) out[i] = _linear(in[i]);
+        return;
+    }
+
+    const float scale = 1.0f / channels;
+
+    for(i = 0; i < numFrames; ++i){
+        float sum = 0;
+        for(c = 0; c < channels; ++c) sum += _linear(in[i * channels + c]);
+        out[i] = sum * scale;
+    }
+}
+
+static void _fromLinear(const float* in, uint8_t* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = (uint8_t)(((int)lrintf(_saturate(in[i])) >> 8) + 0x80);
+}
+
+static void _fromLinear(const float* in, int16_t* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = (int16_t)lrintf(_saturate(in[i]));
+}
+
+static void _fromLinear(const float* in, float* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = _saturate(in[i]) / 32768.0f;
+}
+
+/**
+    Multiply two spectra and add the product, acc += a * b
+*/
+static void _mac(float* accRe, float* accIm, const float* aRe, const float* aIm, const float* bRe, const float* bIm, int n)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    for(; i + 4 <= n; i += 4){
+        __m128 ar = _mm_loadu_ps(aRe + i), ai = _mm_loadu_ps(aIm + i);
+        __m128 br = _mm_loadu_ps(bRe + i), bi = _mm_loadu_ps(bIm + i);
+
+        __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+
+        _mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+        _mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t ar = vld1q_f32(aRe + i), ai = vld1q_f32(aIm + i);
+        float32x4_t br = vld1q_f32(bRe + i), bi = vld1q_f32(bIm + i);
+
+        float32x4_t re = vmlsq_f32(vmlaq_f32(vld1q_f32(accRe + i), ar, br), ai, bi);
+        float32x4_t im = vmlaq_f32(vmlaq_f32(vld1q_f32(accIm + i), ar, bi), ai, br);
+
+        vst1q_f32(accRe + i, re);
+        vst1q_f32(accIm + i, im);
+    }
+#endif
+
+    for(; i < n; ++i){
+        accRe[i] += aRe[i] * bRe[i] - aIm[i] * bIm[i];
+        accIm[i] += aRe[i] * bIm[i] + aIm[i] * bRe[i];
+    }
+}
+
+/**
+    Multiply the conjugate of a spectrum by another and add the product, acc += conj(a) * b
+*/
+static void _macConj(float* accRe, float* accIm, const float* aRe, const float* aIm, const float* bRe, const float* bIm, int n)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    for(; i + 4 <= n; i += 4){
+        __m128 ar = _mm_loadu_ps(aRe + i), ai = _mm_loadu_ps(aIm + i);
+        __m128 br = _mm_loadu_ps(bRe + i), bi = _mm_loadu_ps(bIm + i);
+
+        __m128 re = _mm_add_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        __m128 im = _mm_sub_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+
+        _mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+        _mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t ar = vld1q_f32(aRe + i), ai = vld1q_f32(aIm + i);
+        float32x4_t br = vld1q_f32(bRe + i), bi = vld1q_f32(bIm + i);
+
+        float32x4_t re = vmlaq_f32(vmlaq_f32(vld1q_f32(accRe + i), ar, br), ai, bi);
+        float32x4_t im = vmlsq_f32(vmlaq_f32(vld1q_f32(accIm + i), ar, bi), ai, br);
+
+        vst1q_f32(accRe + i, re);
+        vst1q_f32(accIm + i, im);
+    }
+#endif
+
+    for(; i < n; ++i){
+        accRe[i] += aRe[i] * bRe[i] + aIm[i] * bIm[i];
+        accIm[i] += aRe[i] * bIm[i] - aIm[i] * bRe[i];
+    }
+}
+
+/**
+    Track the power of a spectrum in each bin
+*/
+static void _smoothPower(float* power, const float* re, const float* im, float smooth, int n)
+{
+    const float gain = 1.0f - smooth;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vSmooth = _mm_set1_ps(smooth);
+    const __m128 vGain = _mm_set1_ps(gain);
+
+    for(; i + 4 <= n; i += 4){
+        __m128 r = _mm_loadu_ps(re + i), m = _mm_loadu_ps(im + i);
+        __m128 p = _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m));
+
+        _mm_storeu_ps(power + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(power + i), vSmooth), _mm_mul_ps(p, vGain)));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t r = vld1q_f32(re + i), m = vld1q_f32(im + i);
+        float32x4_t p = vmlaq_f32(vmulq_f32(r, r), m, m);
+
+        vst1q_f32(power + i, vmlaq_n_f32(vmulq_n_f32(vld1q_f32(power + i), smooth), p, gain));
+    }
+#endif
+
+    for(; i < n; ++i) power[i] = power[i] * smooth + (re[i] * re[i] + im[i] * im[i]) * gain;
+}
+
+/**
+    Scale each bin of a spectrum by step / (power + delta)
+*/
+static void _normalize(float* re, float* im, const float* power, float step, float delta, int n)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vStep = _mm_set1_ps(step);
+    const __m128 vDelta = _mm_set1_ps(delta);
+
+    for(; i + 4 <= n; i += 4){
+        __m128 g = _mm_div_ps(vStep, _mm_add_ps(_mm_loadu_ps(power + i), vDelta));
+
+        _mm_storeu_ps(re + i, _mm_mul_ps(_mm_loadu_ps(re + i), g));
+        _mm_storeu_ps(im + i, _mm_mul_ps(_mm_loadu_ps(im + i), g));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t d = vaddq_f32(vld1q_f32(power + i), vdupq_n_f32(delta));
+
+        // reciprocal estimate refined by two Newton steps
+        float32x4_t r = vrecpeq_f32(d);
+        r = vmulq_f32(vrecpsq_f32(d, r), r);
+        r = vmulq_f32(vrecpsq_f32(d, r), r);
+
+        float32x4_t g = vmulq_n_f32(r, step);
+
+        vst1q_f32(re + i, vmulq_f32(vld1q_f32(re + i), g));
+        vst1q_f32(im + i, vmulq_f32(vld1q_f32(im + i), g));
+    }
+#endif
+
+    for(; i < n; ++i){
+        float g = step / (power[i] + delta);
+        re[i] *= g;
+        im[i] *= g;
+    }
+}
+
+static float _peak(const float* x, int n)
+{
+    float peak = 0;
+    int i;
+
+    for(i = 0; i < n; ++i){
+        float a = fabsf(x[i]);
+        if(a > peak) peak = a;
+    }
+
+    return peak;
+}
+
+EchoCanceller::EchoCanceller()
+{
+    setFormat(8, 1, 8000);
+}
+
+void EchoCanceller::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    QMutexLocker locker(&_sync);
+
+    _sampleSize = sampleSize;
+    _channels = (channels > 0) ? channels : 1;
+
+    int samples = sampleRate * AEC_BLOCK_MS / 1000;
+    _blockSize = 4;
+    while(_blockSize < samples) _blockSize <<= 1;
+
+    _bins = _blockSize + 1;
+    _partitions = (sampleRate * AEC_TAIL_MS / 1000 + _blockSize - 1) / _blockSize;
+    if(_partitions < 1) _partitions = 1;
+    _maxReference = sampleRate * AEC_MAX_LAG_MS / 1000 + _blockSize;
+    _hangoverBlocks = sampleRate * AEC_HANGOVER_MS / (1000 * _blockSize) + 1;
+
+    _fft.setSize(2 * _blockSize);
+
+    _reference.resize(_maxReference);
+    _x.resize(2 * _blockSize);
+    _xRe.resize(_partitions * _bins);
+    _xIm.resize(_partitions * _bins);
+    _wRe.resize(_partitions * _bins);
+    _wIm.resize(_partitions * _bins);
+    _power.resize(_bins);
+    _yRe.resize(_bins);
+    _yIm.resize(_bins);
+    _eRe.resize(_bins);
+    _eIm.resize(_bins);
+    _time.resize(2 * _blockSize);
+    _echo.resize(_blockSize);
+    _peaks.resize(_partitions);
+
+    locker.unlock();
+
+    reset();
+}
+
+void EchoCanceller::reset()
+{
+    QMutexLocker locker(&_sync);
+
+    _referenceCount = 0;
+    _nearFrames = 0;
+
+    // the first block out is the delay of the canceller
+    _out.fill(0, _blockSize * _channels);
+    _outFrames = _blockSize;
+
+    _x.fill(0);
+    _xRe.fill(0);
+    _xIm.fill(0);
+    _wRe.fill(0);
+    _wIm.fill(0);
+    _power.fill(0);
+    _peaks.fill(0);
+    _head = 0;
+    _constrain = 0;
+    _doubleTalk = 0;
+}
+
+void EchoCanceller::playback(const char* data, qint64 len)
+{
+    QMutexLocker locker(&_sync);
+
+    const int frameBytes = (_sampleSize / 8) * _channels;
+    int numFrames = (int)(len / frameBytes);
+
+    // more than the longest lag of reference, only the newest can still be matched
+    if(numFrames > _maxReference){
+        data += (qint64)(numFrames - _maxReference) * frameBytes;
+        numFrames = _maxReference;
+    }
+
+    int drop = _referenceCount + numFrames - _maxReference;
+    if(drop > 0){
+        memmove(_reference.data(), _reference.data() + drop, (_referenceCount - drop) * sizeof(float));
+        _referenceCount -= drop;
+    }
+
+    float* out = _reference.data() + _referenceCount;
+
+    if(_sampleSize == 32)
+        _toLinear((const float*)data, out, numFrames, _channels, true);
+    else if(_sampleSize == 16)
+        _toLinear((const int16_t*)data, out, numFrames, _channels, true);
+    else
+        _toLinear((const uint8_t*)data, out, numFrames, _channels, true);
+
+    _referenceCount += numFrames;
+}
+
+void EchoCanceller::takeReference(float* x)
+{
+    QMutexLocker locker(&_sync);
+
+    int n = (_referenceCount < _blockSize) ? _referenceCount : _blockSize;
+
+    memcpy(x, _reference.data(), n * sizeof(float));
+    if(n < _blockSize) memset(x + n, 0, (_blockSize - n) * sizeof(float));
+
+    _referenceCount -= n;
+    memmove(_reference.data(), _reference.data() + n, _referenceCount * sizeof(float));
+}
+
+void EchoCanceller::process(QByteArray& pcm)
+{
+    const int sampleBytes = _sampleSize / 8;
+    const int numFrames = pcm.size() / (sampleBytes * _channels);
+    const int numSamples = numFrames * _channels;
+
+    if(numFrames == 0) return;
+
+    if(_near.size() < (_nearFrames + numFrames) * _channels) _near.resize((_nearFrames + numFrames) * _channels);
+
+    float* near = _near.data() + _nearFrames * _channels;
+
+    if(_sampleSize == 32)
+        _toLinear((const float*)pcm.constData(), near, numFrames, _channels, false);
+    else if(_sampleSize == 16)
+        _toLinear((const int16_t*)pcm.constData(), near, numFrames, _channels, false);
+    else
+        _toLinear((const uint8_t*)pcm.constData(), near, numFrames, _channels, false);
+
+    _nearFrames += numFrames;
+
+    // processBlock works on the front of _near
+    while(_nearFrames >= _blockSize){
+        processBlock();
+
+        _nearFrames -= _blockSize;
+        memmove(_near.data(), _near.data() + _blockSize * _channels, _nearFrames * _channels * sizeof(float));
+    }
+
+    // one block of delay keeps a whole frame ready
+    if(_sampleSize == 32)
+        _fromLinear(_out.constData(), (float*)pcm.data(), numSamples);
+    else if(_sampleSize == 16)
+        _fromLinear(_out.constData(), (int16_t*)pcm.data(), numSamples);
+    else
+        _fromLinear(_out.constData(), (uint8_t*)pcm.data(), numSamples);
+
+    _outFrames -= numFrames;
+    memmove(_out.data(), _out.data() + numSamples, _outFrames * _channels * sizeof(float));
+}
+
+void EchoCanceller::processBlock()
+{
+    const int n = _blockSize;
+    const int bins = _bins;
+    float* x = _x.data();
+    float* time = _time.data();
+    float* echo = _echo.data();
+    int i, c, p;
+
+    // the transform covers the previous and current block of reference
+    memmove(x, x + n, n * sizeof(float));
+    takeReference(x + n);
+
+    // the newest partition replaces the oldest
+    _head = (_head + _partitions - 1) % _partitions;
+    _peaks[_head] = _peak(x + n, n);
+
+    float* xRe = _xRe.data() + _head * bins;
+    float* xIm = _xIm.data() + _head * bins;
+    _fft.forward(x, xRe, xIm);
+    _smoothPower(_power.data(), xRe, xIm, AEC_POWER_SMOOTH, bins);
+
+    float farPeak = 0;
+    for(p = 0; p < _partitions; ++p) if(_peaks[p] > farPeak) farPeak = _peaks[p];
+
+    // mono mix of the captured block
+    const float* near = _near.constData();
+    float nearPeak = 0;
+    for(i = 0; i < n; ++i){
+        float sum = 0;
+        for(c = 0; c < _channels; ++c) sum += near[i * _channels + c];
+        time[n + i] = sum / _channels;
+
+        float a = fabsf(time[n + i]);
+        if(a > nearPeak) nearPeak = a;
+    }
+
+    if(farPeak < AEC_SILENCE_LEVEL){
+        // nothing was played within the echo tail, there is no echo to remove
+        memset(echo, 0, n * sizeof(float));
+    }
+    else{
+        float* yRe = _yRe.data();
+        float* yIm = _yIm.data();
+        float* eRe = _eRe.data();
+        float* eIm = _eIm.data();
+
+        // echo estimate, partition p filters the reference of p blocks ago
+        memset(yRe, 0, bins * sizeof(float));
+        memset(yIm, 0, bins * sizeof(float));
+        for(p = 0; p < _partitions; ++p){
+            int slot = ((_head + p) % _partitions) * bins;
+            _mac(yRe, yIm, _wRe.constData() + p * bins, _wIm.constData() + p * bins,
+                 _xRe.constData() + slot, _xIm.constData() + slot, bins);
+        }
+
+        // the second half of the circular convolution is the linear one
+        float* error = time + n;
+        _fft.inverse(yRe, yIm, time);
+        for(i = 0; i < n; ++i){
+            echo[i] = time[n + i];
+        }
+
+        // rebuild the mono capture, inverse() overwrote it
+        for(i = 0; i < n; ++i){
+            float sum = 0;
+            for(c = 0; c < _channels; ++c) sum += near[i * _channels + c];
+            error[i] = sum / _channels - echo[i];
+        }
+
+        // a near end louder than the echo can be is the local talker, adapting to it would cancel them
+        if(nearPeak > AEC_GEIGEL_RATIO * farPeak) _doubleTalk = _hangoverBlocks;
+        if(_doubleTalk > 0){
+            _doubleTalk--;
+        }
+        else{
+            memset(time, 0, n * sizeof(float));
+            _fft.forward(time, eRe, eIm);
+            _normalize(eRe, eIm, _power.constData(), AEC_STEP / _partitions, AEC_REGULARIZATION * 2 * n, bins);
+
+            for(p = 0; p < _partitions; ++p){
+                int slot = ((_head + p) % _partitions) * bins;
+                _macConj(_wRe.data() + p * bins, _wIm.data() + p * bins,
+                         _xRe.constData() + slot, _xIm.constData() + slot, eRe, eIm, bins);
+            }
+
+            // keep one partition a linear filter each block, the rest follow in turn
+            float* wRe = _wRe.data() + _constrain * bins;
+            float* wIm = _wIm.data() + _constrain * bins;
+            _fft.inverse(wRe, wIm, time);
+            memset(time + n, 0, n * sizeof(float));
+            _fft.forward(time, wRe, wIm);
+            _constrain = (_constrain + 1) % _partitions;
+        }
+    }
+
+    // every channel loses the same echo estimate
+    if(_out.size() < (_outFrames + n) * _channels) _out.resize((_outFrames + n) * _channels);
+    float* out = _out.data() + _outFrames * _channels;
+
+    for(i = 0; i < n; ++i){
+        for(c = 0; c < _channels; ++c) out[i * _channels + c] = near[i * _channels + c] - echo[i];
+    }
+
+    _outFrames += n;
+}
@@ -0,0 +1,145 @@
+#ifndef ECHOCANCELLER_H
+#define ECHOCANCELLER_H
+
+#include <cstdint>
+
+#include <QByteArray>
+#include <QMutex>
+#include <QVector>
+
+#include "fft.h"
+
+/**
+    Removes the received streams picked up by the microphone from the captured stream
+
+    The audio handed to the output device is the far end reference. An adaptive filter models the path
+    from the speaker to the microphone and its estimate of the echo is subtracted from the capture.
+    The filter is a partitioned block frequency domain NLMS filter: the echo tail is split into
+    partitions of one block each, every block is filtered and adapted in the frequency domain, and the
+    step of each frequency bin is normalized by the power of the reference in that bin. Adaptation is
+    frozen while the near end talks, so the filter does not learn to cancel the local talker.
+
+    The filter runs on the mono mix of the channels on the 16 bit scale. Captured audio is delayed by
+    one block, about 8 ms.
+*/
+class EchoCanceller
+{
+public:
+    EchoCanceller(void);
+
+    /**
+        Set the format of the captured and played audio
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Forget the echo path and the reference, used when capture starts
+    */
+    void reset();
+
+    /**
+        Add audio handed to the output device to the reference, may be called from the audio thread
+
+        @param data
+            audio in the set format
+
+        @param len
+            bytes of audio
+    */
+    void playback(const char* data, qint64 len);
+
+    /**
+        Remove the echo from captured audio
+
+        @param pcm
+            captured audio in the set format, whole sample frames, replaced by the audio with the echo
+            removed
+    */
+    void process(QByteArray& pcm);
+
+private:
+    //! bits per sample
+    int _sampleSize;
+    //! interleaved channels
+    int _channels;
+    //! samples per block
+    int _blockSize;
+    //! frequency bins of a block
+    int _bins;
+    //! partitions covering the echo tail
+    int _partitions;
+    //! most reference samples held before the oldest are dropped
+    int _maxReference;
+
+    //! reference samples not yet matched to captured audio
+    QVector<float> _reference;
+    //! reference samples held in _reference
+    int _referenceCount;
+    //! the reference is added from the audio thread
+    QMutex _sync;
+
+    //! captured sample frames waiting for a whole block, on the 16 bit scale
+    QVector<float> _near;
+    //! sample frames in _near
+    int _nearFrames;
+    //! sample frames with the echo removed, waiting to be returned
+    QVector<float> _out;
+    //! sample frames in _out
+    int _outFrames;
+
+    //! transforms of two blocks
+    RealFFT _fft;
+    //! reference of the previous and current block
+    QVector<float> _x;
+    //! spectra of the reference of the last _partitions blocks, newest at _head
+    QVector<float> _xRe;
+    QVector<float> _xIm;
+    int _head;
+    //! filter of each partition
+    QVector<float> _wRe;
+    QVector<float> _wIm;
+    //! smoothed power of the reference in each bin
+    QVector<float> _power;
+    //! echo estimate and error spectra
+    QVector<float> _yRe;
+    QVector<float> _yIm;
+    QVector<float> _eRe;
+    QVector<float> _eIm;
+    //! time domain working buffer of two blocks
+    QVector<float> _time;
+    //! echo estimate of the current block
+    QVector<float> _echo;
+    //! partition whose filter is constrained next
+    int _constrain;
+
+    //! peak reference level of each partition, the newest at _head
+    QVector<float> _peaks;
+    //! blocks left in which the near end is taken to be talking
+    int _doubleTalk;
+    //! blocks adaptation stays frozen after double talk
+    int _hangoverBlocks;
+
+    /**
+        Remove the echo from one block of _near and append it to _out
+    */
+    void processBlock();
+
+    /**
+        Take the reference matched to the next block of captured audio, silence if none was played
+
+        @param x
+            receives one block of reference samples
+    */
+    void takeReference(float* x);
+};
+
+#endif // ECHOCANCELLER_H
@@ -0,0 +1,178 @@
+
+/**
+    @file fft.cpp
+    @breif Real FFT for the audio processing stages
+    @author Natesh Narain
+*/
+
+#include "fft.h"
+
+#include <cmath>
+
+RealFFT::RealFFT()
+{
+    _n = 0;
+    _m = 0;
+}
+
+RealFFT::RealFFT(int n)
+{
+    _n = 0;
+    _m = 0;
+
+    setSize(n);
+}
+
+void RealFFT::setSize(int n)
+{
+    if(n < 4) n = 4;
+    if(n == _n) return;
+
+    _n = n;
+    _m = n / 2;
+
+    int i, bits = 0;
+    while((1 << bits) < _m) bits++;
+
+    _bitrev.resize(_m);
+    for(i = 0; i < _m; ++i){
+        int r = 0, b;
+        for(b = 0; b < bits; ++b) if(i & (1 << b)) r |= 1 << (bits - 1 - b);
+        _bitrev[i] = r;
+    }
+
+    _cos.resize(_m / 2);
+    _sin.resize(_m / 2);
+    for(i = 0; i < _m / 2; ++i){
+        _cos[i] = (float)cos(2 * M_PI * i / _m);
+        _sin[i] = (float)sin(2 * M_PI * i / _m);
+    }
+
+    _splitCos.resize(_m + 1);
+    _splitSin.resize(_m + 1);
+    for(i = 0; i <= _m; ++i){
+        _splitCos[i] = (float)cos(2 * M_PI * i / _n);
+        _splitSin[i] = (float)sin(2 * M_PI * i / _n);
+    }
+
+    _workRe.resize(_m);
+    _workIm.resize(_m);
+}
+
+int RealFFT::size() const
+{
+    return _n;
+}
+
+int RealFFT::bins() const
+{
+    return _m + 1;
+}
+
+void RealFFT::complexFFT(float* re, float* im, bool inverse)
+{
+    const float sign = inverse ? 1.0f : -1.0f;
+    int i, j, len, k;
+
+    for(i = 0; i < _m; ++i){
+        j = _bitrev[i];
+        if(j > i){
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for(len = 2; len <= _m; len <<= 1){
+        const int half = len / 2;
+        const int step = _m / len;
+
+        for(i = 0; i < _m; i += len){
+            for(k = 0; k < half; ++k){
+                const float wr = _cos[k * step];
+                const float wi = sign * _sin[k * step];
+
+                const int a = i + k;
+                const int b = a + half;
+
+                const float tr = re[b] * wr - im[b] * wi;
+                const float ti = re[b] * wi + im[b] * wr;
+
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+void RealFFT::forward(const float* in, float* re, float* im)
+{
+    float* zr = _workRe.data();
+    float* zi = _workIm.data();
+    int k;
+
+    // even points are the real part, odd points the imaginary part
+    for(k = 0; k < _m; ++k){
+        zr[k] = in[2 * k];
+        zi[k] = in[2 * k + 1];
+    }
+
+    complexFFT(zr, zi, false);
+
+    // separate the spectra of the even and odd points and combine them
+    for(k = 0; k <= _m; ++k){
+        const int a = (k == _m) ? 0 : k;
+        const int b = (k == 0) ? 0 : _m - k;
+
+        const float er = 0.5f * (zr[a] + zr[b]);
+        const float ei = 0.5f * (zi[a] - zi[b]);
+        const float or_ = 0.5f * (zi[a] + zi[b]);
+        const float oi = -0.5f * (zr[a] - zr[b]);
+
+        // X[k] = E[k] + e^(-2 pi i k / n) O[k]
+        const float c = _splitCos[k];
+        const float s = -_splitSin[k];
+
+        re[k] = er + (or_ * c - oi * s);
+        im[k] = ei + (or_ * s + oi * c);
+    }
+}
+
+void RealFFT::inverse(const float* re, const float* im, float* out)
+{
+    float* zr = _workRe.data();
+    float* zi = _workIm.data();
+    const float scale = 1.0f / _m;
+    int k;
+
+    for(k = 0; k < _m; ++k){
+        const int b = _m - k;
+
+        // the bins at 0 and n/2 are real
+        const float xi = (k == 0) ? 0 : im[k];
+        const float yi = (b == _m) ? 0 : im[b];
+
+        const float er = 0.5f * (re[k] + re[b]);
+        const float ei = 0.5f * (xi - yi);
+        const float dr = 0.5f * (re[k] - re[b]);
+        const float di = 0.5f * (xi + yi);
+
+        // O[k] = (X[k] - conj(X[m - k])) e^(2 pi i k / n) / 2
+        const float c = _splitCos[k];
+        const float s = _splitSin[k];
+        const float or_ = dr * c - di * s;
+        const float oi = dr * s + di * c;
+
+        // Z[k] = E[k] + i O[k]
+        zr[k] = er - oi;
+        zi[k] = ei + or_;
+    }
+
+    complexFFT(zr, zi, true);
+
+    for(k = 0; k < _m; ++k){
+        out[2 * k] = zr[k] * scale;
+        out[2 * k + 1] = zi[k] * scale;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <QVector>
+
+/**
+    Real FFT of a power of two size
+
+    The spectrum of n real points is n/2 + 1 bins, held as separate real and imaginary arrays so the
+    per bin loops of its users vectorize. The transform is computed as a complex FFT of half the size.
+*/
+class RealFFT
+{
+public:
+    RealFFT(void);
+
+    /**
+        @param n
+            number of real points, a power of two of at least 4
+    */
+    explicit RealFFT(int n);
+
+    /**
+        Set the number of real points
+
+        @param n
+            a power of two of at least 4
+    */
+    void setSize(int n);
+
+    /**
+        @return number of real points
+    */
+    int size() const;
+
+    /**
+        @return number of bins in the spectrum, size() / 2 + 1
+    */
+    int bins() const;
+
+    /**
+        Forward transform, unscaled
+
+        @param in
+            size() real points
+
+        @param re
+            receives the real part of bins() bins
+
+        @param im
+            receives the imaginary part of bins() bins
+    */
+    void forward(const float* in, float* re, float* im);
+
+    /**
+        Inverse transform, scaled so that inverse(forward(x)) is x
+
+        @param re
+            real part of bins() bins
+
+        @param im
+            imaginary part of bins() bins, those of the first and last bin are ignored
+
+        @param out
+            receives size() real points
+    */
+    void inverse(const float* re, const float* im, float* out);
+
+private:
+    //! real points
+    int _n;
+    //! points of the half size complex transform
+    int _m;
+    //! twiddles of the complex transform
+    QVector<float> _cos;
+    QVector<float> _sin;
+    //! twiddles that split the complex transform into the real spectrum
+    QVector<float> _splitCos;
+    QVector<float> _splitSin;
+    //! bit reversed index of each complex point
+    QVector<int> _bitrev;
+    //! complex working buffer
+    QVector<float> _workRe;
+    QVector<float> _workIm;
+
+    /**
+        In place radix 2 complex transform of _m points, the inverse is unscaled
+    */
+    void complexFFT(float* re, float* im, bool inverse);
+};
+
+#endif // FFT_H
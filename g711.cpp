@@ -0,0 +1,191 @@
+
+/**
+    @file g711.cpp
+    @breif mu-law and A-law companding
+    @author Natesh Narain
+*/
+
+#include "g711.h"
+
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 32635
+
+#define ULAW_TABLE_BITS 14 ///< mu-law codes resolve 14 bits of the sample
+#define ALAW_TABLE_BITS 13 ///< A-law codes resolve 13 bits of the sample
+
+//! Lookup tables, built once on first use
+struct G711Tables{
+    uint8_t ulawEncode[1 << ULAW_TABLE_BITS];
+    uint8_t alawEncode[1 << ALAW_TABLE_BITS];
+    int16_t ulawDecode[256];
+    int16_t alawDecode[256];
+
+    G711Tables();
+};
+
+static const G711Tables& _tables();
+
+static uint8_t _ulawcompress(int sample);
+static uint8_t _alawcompress(int sample);
+static int16_t _ulawexpand(uint8_t code);
+static int16_t _alawexpand(uint8_t code);
+
+void g711encode(const int16_t* inBuffer, int numSamples, uint8_t* outBuffer, uint8_t law)
+{
+    const G711Tables& tables = _tables();
+    int i;
+
+    if(law == G711_ALAW){
+        for(i = 0; i < numSamples; ++i){
+            outBuffer[i] = tables.alawEncode[(inBuffer[i] >> (16 - ALAW_TABLE_BITS)) & ((1 << ALAW_TABLE_BITS) - 1)];
+        }
+    }
+    else{
+        for(i = 0; i < numSamples; ++i){
+            outBuffer[i] = tables.ulawEncode[(inBuffer[i] >> (16 - ULAW_TABLE_BITS)) & ((1 << ULAW_TABLE_BITS) - 1)];
+        }
+    }
+}
+
+void g711decode(const uint8_t* inBuffer, int numSamples, int16_t* outBuffer, uint8_t law)
+{
+    const int16_t* table = (law == G711_ALAW) ? _tables().alawDecode : _tables().ulawDecode;
+    int i;
+
+    for(i = 0; i < numSamples; ++i){
+        outBuffer[i] = table[inBuffer[i]];
+    }
+}
+
+uint8_t linear2ulaw(int16_t sample)
+{
+    return _tables().ulawEncode[(sample >> (16 - ULAW_TABLE_BITS)) & ((1 << ULAW_TABLE_BITS) - 1)];
+}
+
+uint8_t linear2alaw(int16_t sample)
+{
+    return _tables().alawEncode[(sample >> (16 - ALAW_TABLE_BITS)) & ((1 << ALAW_TABLE_BITS) - 1)];
+}
+
+int16_t ulaw2linear(uint8_t code)
+{
+    return _tables().ulawDecode[code];
+}
+
+int16_t alaw2linear(uint8_t code)
+{
+    return _tables().alawDecode[code];
+}
+
+G711Tables::G711Tables()
+{
+    int i;
+
+    // encode tables are indexed by the top bits of the sample as a two's complement index
+    for(i = 0; i < (1 << ULAW_TABLE_BITS); ++i){
+        int sample = (int16_t)(i << (16 - ULAW_TABLE_BITS));
+        ulawEncode[i] = _ulawcompress(sample);
+    }
+
+    for(i = 0; i < (1 << ALAW_TABLE_BITS); ++i){
+        int sample = (int16_t)(i << (16 - ALAW_TABLE_BITS));
+        alawEncode[i] = _alawcompress(sample);
+    }
+
+    for(i = 0; i < 256; ++i){
+        ulawDecode[i] = _ulawexpand((uint8_t)i);
+        alawDecode[i] = _alawexpand((uint8_t)i);
+    }
+}
+
+static const G711Tables& _tables()
+{
+    static const G711Tables tables;
+    return tables;
+}
+
+static uint8_t _ulawcompress(int sample)
+{
+    int sign = 0, exponent, mantissa;
+    int mask;
+
+    if(sample < 0){
+        sign = 0x80;
+        sample = -sample;
+    }
+    if(sample > ULAW_CLIP) sample = ULAW_CLIP;
+    sample += ULAW_BIAS;
+
+    // find the segment, the position of the highest set bit above bit 7
+    exponent = 7;
+    for(mask = 0x4000; (sample & mask) == 0 && exponent > 0; mask >>= 1){
+        exponent--;
+    }
+
+    mantissa = (sample >> (exponent + 3)) & 0x0F;
+
+    return (uint8_t)~(sign | (exponent << 4) | mantissa);
+}
+
+static uint8_t _alawcompress(int sample)
+{
+    int mask, seg, aval;
+
+    // A-law works on 13 bit magnitudes
+    sample >>= 3;
+
+    if(sample >= 0){
+        mask = 0xD5;
+    }
+    else{
+        mask = 0x55;
+        sample = -sample - 1;
+    }
+
+    for(seg = 0; seg < 8 && sample > ((0x20 << seg) - 1); ++seg);
+
+    if(seg >= 8) return (uint8_t)(0x7F ^ mask);
+
+    aval = seg << 4;
+    if(seg < 2)
+        aval |= (sample >> 1) & 0x0F;
+    else
+        aval |= (sample >> seg) & 0x0F;
+
+    return (uint8_t)(aval ^ mask);
+}
+
+static int16_t _ulawexpand(uint8_t code)
+{
+    int t;
+
+    code = ~code;
+    t = ((code & 0x0F) << 3) + ULAW_BIAS;
+    t <<= (code & 0x70) >> 4;
+
+    return (int16_t)((code & 0x80) ? (ULAW_BIAS - t) : (t - ULAW_BIAS));
+}
+
+static int16_t _alawexpand(uint8_t code)
+{
+    int t, seg;
+
+    code ^= 0x55;
+
+    t = (code & 0x0F) << 4;
+    seg = (code & 0x70) >> 4;
+
+    switch(seg){
+    case 0:
+        t += 8;
+        break;
+    case 1:
+        t += 0x108;
+        break;
+    default:
+        t += 0x108;
+        t <<= seg - 1;
+    }
+
+    return (int16_t)((code & 0x80) ? t : -t);
+}
@@ -0,0 +1,72 @@
+
+#ifndef G711_H
+#define G711_H
+
+#include <stdint.h>
+
+#define G711_ULAW 0x00 ///< mu-law companding
+#define G711_ALAW 0x01 ///< A-law companding
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+    Compress 16 bit linear samples to 8 bit companded samples
+
+    @param inBuffer
+        16 bit linear samples
+
+    @param numSamples
+        number of samples
+
+    @param outBuffer
+        buffer to put the companded samples, one byte per sample
+
+    @param law
+        G711_ULAW or G711_ALAW
+*/
+void g711encode(const int16_t* inBuffer, int numSamples, uint8_t* outBuffer, uint8_t law);
+
+/**
+    Expand 8 bit companded samples to 16 bit linear samples
+
+    @param inBuffer
+        companded samples
+
+    @param numSamples
+        number of samples
+
+    @param outBuffer
+        buffer to put the 16 bit linear samples
+
+    @param law
+        G711_ULAW or G711_ALAW
+*/
+void g711decode(const uint8_t* inBuffer, int numSamples, int16_t* outBuffer, uint8_t law);
+
+/**
+    @return the mu-law code of a 16 bit sample
+*/
+uint8_t linear2ulaw(int16_t sample);
+
+/**
+    @return the A-law code of a 16 bit sample
+*/
+uint8_t linear2alaw(int16_t sample);
+
+/**
+    @return the 16 bit sample of a mu-law code
+*/
+int16_t ulaw2linear(uint8_t code);
+
+/**
+    @return the 16 bit sample of an A-law code
+*/
+int16_t alaw2linear(uint8_t code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // G711_H
@@ -0,0 +1,470 @@
+
+/**
+    @file headlessendpoint.cpp
+    @breif Audio sources and sinks that run without sound hardware
+    @author Natesh Narain
+*/
+
+#include "headlessendpoint.h"
+
+#include <cstring>
+#include <cmath>
+
+#include <QDebug>
+
+#define WAV_HEADER_BYTES 44         ///< size of a canonical PCM WAV header
+#define WAV_FORMAT_PCM   1          ///< integer PCM
+#define WAV_FORMAT_FLOAT 3          ///< IEEE float PCM
+#define SIGNAL_AMPLITUDE 0.5        ///< peak of the synthetic signals, full scale is 1
+#define NOISE_SEED       0x12345678 ///< the same noise every run
+
+static uint32_t _le32(const char* p)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t _le16(const char* p)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    return b[0] | (b[1] << 8);
+}
+
+static void _put32(char* p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static void _put16(char* p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// SimulatedSource
+// ---------------------------------------------------------------------------------------------------------
+
+SimulatedSource::SimulatedSource(const QAudioFormat& format, SimulatedClock* clock, QObject *parent) :
+    AudioSource(parent)
+{
+    _sampleSize = format.sampleSize();
+    _channels = (format.channelCount() > 0) ? format.channelCount() : 1;
+    _sampleRate = format.sampleRate();
+    _frameBytes = (_sampleSize / 8) * _channels;
+    if(_frameBytes < 1) _frameBytes = 1;
+
+    _clock = clock;
+    _device = NULL;
+    _runMs = 0;
+    _runFrames = 0;
+    _bufferBytes = 0;
+    _notifyMs = 0;
+    _sinceNotify = 0;
+    _bytesProduced = 0;
+    _exhausted = false;
+
+    connect(_clock, SIGNAL(tick(int)), this, SLOT(onTick(int)));
+}
+
+void SimulatedSource::start(QIODevice* device)
+{
+    if(_device == NULL) _clock->acquire();
+
+    _device = device;
+    _runMs = 0;
+    _runFrames = 0;
+    _sinceNotify = 0;
+    _pending.resize(0);
+
+    // a start after the audio ran out plays it again
+    _exhausted = false;
+    rewind();
+}
+
+void SimulatedSource::rewind()
+{
+}
+
+void SimulatedSource::stop()
+{
+    if(_device == NULL) return;
+
+    _device = NULL;
+    _clock->release();
+
+    qDebug() << "Simulated source stopped, " << _bytesProduced << " bytes produced";
+}
+
+void SimulatedSource::setBufferSize(int bytes)
+{
+    _bufferBytes = (bytes > 0) ? bytes : 0;
+}
+
+void SimulatedSource::setNotifyInterval(int ms)
+{
+    _notifyMs = (ms > 0) ? ms : 0;
+}
+
+qint64 SimulatedSource::getBytesProduced() const
+{
+    return _bytesProduced;
+}
+
+void SimulatedSource::onTick(int ms)
+{
+    if(_device == NULL) return;
+
+    _runMs += ms;
+
+    // frames captured in this tick, counted from the start so rounding does not drift
+    qint64 due = (_runMs * _sampleRate) / 1000 - _runFrames;
+    _runFrames += due;
+
+    if(due > 0 && !_exhausted){
+        int start = _pending.size();
+        _pending.resize(start + (int)due * _frameBytes);
+
+        int produced = generate(_pending.data() + start, (int)due);
+        _pending.resize(start + produced * _frameBytes);
+
+        if(produced < due){
+            _exhausted = true;
+            qDebug() << "Simulated source ran out of audio";
+        }
+    }
+
+    // like a device the audio is handed over a period at a time, a period is half the buffer
+    int period = _bufferBytes / 2;
+    if(_pending.size() > 0 && (_pending.size() >= period || _exhausted)){
+        qint64 written = _device->write(_pending.constData(), _pending.size());
+        if(written > 0) _bytesProduced += written;
+        _pending.resize(0);
+    }
+
+    if(_notifyMs > 0){
+        _sinceNotify += ms;
+        if(_sinceNotify >= _notifyMs){
+            _sinceNotify %= _notifyMs;
+            emit notify();
+        }
+    }
+}
+
+SimulatedSource::~SimulatedSource()
+{
+    stop();
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// WavFileSource
+// ---------------------------------------------------------------------------------------------------------
+
+WavFileSource::WavFileSource(const QString& fileName, const QAudioFormat& format, SimulatedClock* clock, QObject *parent) :
+    SimulatedSource(format, clock, parent),
+    _file(fileName)
+{
+    _remaining = 0;
+    _dataStart = 0;
+    _dataBytes = 0;
+
+    if(!_file.open(QIODevice::ReadOnly)){
+        qWarning() << "WavFileSource: could not open " << fileName;
+    }
+    else if(!readHeader()){
+        qWarning() << "WavFileSource: " << fileName << " is not a PCM WAV file";
+        _remaining = 0;
+        _dataBytes = 0;
+    }
+}
+
+bool WavFileSource::readHeader()
+{
+    char riff[12];
+    if(_file.read(riff, 12) != 12) return false;
+    if(memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) return false;
+
+    char chunk[8];
+    while(_file.read(chunk, 8) == 8){
+        uint32_t size = _le32(chunk + 4);
+
+        if(memcmp(chunk, "fmt ", 4) == 0){
+            char fmt[16];
+            if(size < 16 || _file.read(fmt, 16) != 16) return false;
+
+            uint16_t type = _le16(fmt);
+            uint16_t channels = _le16(fmt + 2);
+            uint32_t rate = _le32(fmt + 4);
+            uint16_t bits = _le16(fmt + 14);
+
+            if(type != WAV_FORMAT_PCM && type != WAV_FORMAT_FLOAT) return false;
+
+            if(channels != _channels || (int)rate != _sampleRate || bits != _sampleSize){
+                qWarning() << "WavFileSource: file is " << bits << " bit, " << channels << " channels at "
+                           << rate << " Hz, playing it as the capture format";
+            }
+
+            // skip any extension, chunks are padded to an even size
+            _file.seek(_file.pos() + (size - 16) + (size & 1));
+        }
+        else if(memcmp(chunk, "data", 4) == 0){
+            _dataStart = _file.pos();
+            _dataBytes = size;
+            _remaining = size;
+            return true;
+        }
+        else{
+            _file.seek(_file.pos() + size + (size & 1));
+        }
+    }
+
+    return false;
+}
+
+void WavFileSource::rewind()
+{
+    if(!_file.isOpen() || _dataBytes == 0) return;
+
+    _file.seek(_dataStart);
+    _remaining = _dataBytes;
+}
+
+int WavFileSource::generate(char* out, int numFrames)
+{
+    qint64 want = (qint64)numFrames * _frameBytes;
+    if(want > _remaining) want = _remaining;
+
+    qint64 n = (want > 0) ? _file.read(out, want) : 0;
+    if(n < 0) n = 0;
+
+    _remaining -= n;
+
+    return (int)(n / _frameBytes);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// SignalSource
+// ---------------------------------------------------------------------------------------------------------
+
+SignalSource::SignalSource(double frequency, const QAudioFormat& format, SimulatedClock* clock, QObject *parent) :
+    SimulatedSource(format, clock, parent)
+{
+    _frequency = (frequency > 0) ? frequency : 0;
+    _phase = 0;
+    _noise = NOISE_SEED;
+}
+
+int SignalSource::generate(char* out, int numFrames)
+{
+    const double step = (_sampleRate > 0) ? _frequency / _sampleRate : 0;
+    int i, c;
+
+    for(i = 0; i < numFrames; ++i){
+        double v;
+
+        if(_frequency > 0){
+            v = SIGNAL_AMPLITUDE * sin(2 * M_PI * _phase);
+            _phase += step;
+            if(_phase >= 1.0) _phase -= 1.0;
+        }
+        else{
+            // xorshift, uniform over the full scale
+            _noise ^= _noise << 13;
+            _noise ^= _noise >> 17;
+            _noise ^= _noise << 5;
+            v = SIGNAL_AMPLITUDE * (((double)_noise / 4294967295.0) * 2.0 - 1.0);
+        }
+
+        for(c = 0; c < _channels; ++c){
+            if(_sampleSize == 8){
+                *out++ = (char)(uint8_t)(128 + (int)(v * 127));
+            }
+            else if(_sampleSize == 16){
+                _put16(out, (uint16_t)(int16_t)(v * 32767));
+                out += 2;
+            }
+            else{
+                float f = (float)v;
+                memcpy(out, &f, sizeof(float));
+                out += sizeof(float);
+            }
+        }
+    }
+
+    return numFrames;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// SimulatedSink
+// ---------------------------------------------------------------------------------------------------------
+
+SimulatedSink::SimulatedSink(const QAudioFormat& format, SimulatedClock* clock, QObject *parent) :
+    AudioSink(parent)
+{
+    _sampleSize = format.sampleSize();
+    _channels = (format.channelCount() > 0) ? format.channelCount() : 1;
+    _sampleRate = format.sampleRate();
+    _frameBytes = (_sampleSize / 8) * _channels;
+    if(_frameBytes < 1) _frameBytes = 1;
+
+    _clock = clock;
+    _device = NULL;
+    _state = QAudio::StoppedState;
+    _runMs = 0;
+    _runFrames = 0;
+    _bytesConsumed = 0;
+
+    connect(_clock, SIGNAL(tick(int)), this, SLOT(onTick(int)));
+}
+
+void SimulatedSink::start(QIODevice* device)
+{
+    if(_device == NULL) _clock->acquire();
+
+    _device = device;
+    _runMs = 0;
+    _runFrames = 0;
+
+    setState(QAudio::ActiveState);
+}
+
+void SimulatedSink::stop()
+{
+    if(_device == NULL) return;
+
+    _device = NULL;
+    _clock->release();
+
+    qDebug() << "Simulated sink stopped, " << _bytesConsumed << " bytes played";
+
+    setState(QAudio::StoppedState);
+}
+
+QAudio::State SimulatedSink::state() const
+{
+    return _state;
+}
+
+qint64 SimulatedSink::getBytesConsumed() const
+{
+    return _bytesConsumed;
+}
+
+void SimulatedSink::setState(QAudio::State state)
+{
+    if(_state == state) return;
+
+    _state = state;
+    emit stateChanged(state);
+}
+
+void SimulatedSink::onTick(int ms)
+{
+    if(_device == NULL) return;
+
+    _runMs += ms;
+
+    // the output plays on whether there is audio or not
+    qint64 due = (_runMs * _sampleRate) / 1000 - _runFrames;
+    _runFrames += due;
+
+    if(due <= 0) return;
+
+    QByteArray played((int)due * _frameBytes, 0);
+    qint64 n = _device->read(played.data(), played.size());
+
+    if(n > 0){
+        consume(played.constData(), n);
+        _bytesConsumed += n;
+        setState(QAudio::ActiveState);
+    }
+    else{
+        setState(QAudio::IdleState);
+    }
+}
+
+SimulatedSink::~SimulatedSink()
+{
+    // no one is listening once the sink is being destroyed
+    blockSignals(true);
+    stop();
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// NullSink
+// ---------------------------------------------------------------------------------------------------------
+
+NullSink::NullSink(const QAudioFormat& format, SimulatedClock* clock, QObject *parent) :
+    SimulatedSink(format, clock, parent)
+{
+}
+
+void NullSink::consume(const char* data, qint64 len)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// WavFileSink
+// ---------------------------------------------------------------------------------------------------------
+
+WavFileSink::WavFileSink(const QString& fileName, const QAudioFormat& format, SimulatedClock* clock, QObject *parent) :
+    SimulatedSink(format, clock, parent),
+    _file(fileName)
+{
+    _dataBytes = 0;
+
+    if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        qWarning() << "WavFileSink: could not create " << fileName;
+        return;
+    }
+
+    writeHeader();
+}
+
+void WavFileSink::consume(const char* data, qint64 len)
+{
+    if(!_file.isOpen()) return;
+
+    _file.write(data, len);
+    _dataBytes += len;
+}
+
+void WavFileSink::writeHeader()
+{
+    char header[WAV_HEADER_BYTES];
+    const int blockAlign = _frameBytes;
+
+    memcpy(header, "RIFF", 4);
+    _put32(header + 4, (uint32_t)(WAV_HEADER_BYTES - 8 + _dataBytes));
+    memcpy(header + 8, "WAVE", 4);
+
+    memcpy(header + 12, "fmt ", 4);
+    _put32(header + 16, 16);
+    _put16(header + 20, (_sampleSize == 32) ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM);
+    _put16(header + 22, _channels);
+    _put32(header + 24, _sampleRate);
+    _put32(header + 28, _sampleRate * blockAlign);
+    _put16(header + 32, blockAlign);
+    _put16(header + 34, _sampleSize);
+
+    memcpy(header + 36, "data", 4);
+    _put32(header + 40, (uint32_t)_dataBytes);
+
+    _file.seek(0);
+    _file.write(header, WAV_HEADER_BYTES);
+    _file.seek(WAV_HEADER_BYTES + _dataBytes);
+}
+
+WavFileSink::~WavFileSink()
+{
+    if(_file.isOpen()){
+        // the sizes are only known once playing is over
+        writeHeader();
+        _file.close();
+    }
+}
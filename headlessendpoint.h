@@ -0,0 +1,245 @@
+#ifndef HEADLESSENDPOINT_H
+#define HEADLESSENDPOINT_H
+
+#include <cstdint>
+
+#include <QByteArray>
+#include <QFile>
+
+#include "audioendpoint.h"
+#include "simulatedclock.h"
+
+/**
+    Source that writes audio on the simulated clock
+
+    Each tick the source produces the audio that was captured in that time and writes it to the device,
+    just as an input device would.
+*/
+class SimulatedSource : public AudioSource
+{
+    Q_OBJECT
+public:
+    SimulatedSource(const QAudioFormat& format, SimulatedClock* clock, QObject *parent = 0);
+    ~SimulatedSource(void);
+
+    void start(QIODevice* device);
+    void stop();
+    void setBufferSize(int bytes);
+    void setNotifyInterval(int ms);
+
+    /**
+        @return bytes written since the source was created
+    */
+    qint64 getBytesProduced() const;
+
+protected:
+    //! bytes in a sample frame
+    int _frameBytes;
+    //! bits per sample
+    int _sampleSize;
+    //! number of channels
+    int _channels;
+    //! samples per second
+    int _sampleRate;
+
+    /**
+        Produce audio
+
+        @param out
+            receives the audio
+
+        @param numFrames
+            sample frames wanted
+
+        @return sample frames produced, fewer when the source ran out
+    */
+    virtual int generate(char* out, int numFrames) = 0;
+
+    /**
+        Go back to the start of the audio, called each time the source starts
+    */
+    virtual void rewind();
+
+private slots:
+    void onTick(int ms);
+
+private:
+    SimulatedClock* _clock;
+    //! receives the audio, NULL when stopped
+    QIODevice* _device;
+    //! simulated time since the start
+    qint64 _runMs;
+    //! frames produced since the start
+    qint64 _runFrames;
+    //! audio held before it is written
+    int _bufferBytes;
+    //! audio produced but not written yet
+    QByteArray _pending;
+    //! notify interval
+    int _notifyMs;
+    //! simulated time since the last notify
+    int _sinceNotify;
+    //! bytes written in total
+    qint64 _bytesProduced;
+    //! the source ran out of audio
+    bool _exhausted;
+};
+
+/**
+    Plays a WAV file as captured audio
+
+    The file should be linear PCM in the capture format, its audio is passed on as is. Nothing more is
+    captured once the file ends, until the source is started again from the start of the file.
+*/
+class WavFileSource : public SimulatedSource
+{
+    Q_OBJECT
+public:
+    WavFileSource(const QString& fileName, const QAudioFormat& format, SimulatedClock* clock, QObject *parent = 0);
+
+protected:
+    int generate(char* out, int numFrames);
+    void rewind();
+
+private:
+    QFile _file;
+    //! bytes of audio left in the data chunk
+    qint64 _remaining;
+    //! file offset of the audio
+    qint64 _dataStart;
+    //! bytes of audio in the data chunk
+    qint64 _dataBytes;
+
+    /**
+        Read the header up to the start of the audio
+
+        @return false if the file is not a PCM WAV file
+    */
+    bool readHeader();
+};
+
+/**
+    Captures a synthetic signal, a sine tone or white noise
+*/
+class SignalSource : public SimulatedSource
+{
+    Q_OBJECT
+public:
+    /**
+        @param frequency
+            tone frequency in Hz, 0 for white noise
+    */
+    SignalSource(double frequency, const QAudioFormat& format, SimulatedClock* clock, QObject *parent = 0);
+
+protected:
+    int generate(char* out, int numFrames);
+
+private:
+    //! tone frequency, 0 for noise
+    double _frequency;
+    //! tone phase in cycles
+    double _phase;
+    //! noise generator state, seeded the same every run so the noise repeats
+    uint32_t _noise;
+};
+
+/**
+    Sink that reads audio on the simulated clock
+
+    Each tick the sink reads the audio that would have played in that time. Like an output device it goes
+    idle when the device has nothing to read and active again when it does.
+*/
+class SimulatedSink : public AudioSink
+{
+    Q_OBJECT
+public:
+    SimulatedSink(const QAudioFormat& format, SimulatedClock* clock, QObject *parent = 0);
+    ~SimulatedSink(void);
+
+    void start(QIODevice* device);
+    void stop();
+    QAudio::State state() const;
+
+    /**
+        @return bytes played since the sink was created
+    */
+    qint64 getBytesConsumed() const;
+
+protected:
+    //! bytes in a sample frame
+    int _frameBytes;
+    //! bits per sample
+    int _sampleSize;
+    //! number of channels
+    int _channels;
+    //! samples per second
+    int _sampleRate;
+
+    /**
+        Take played audio
+
+        @param data
+            the audio
+
+        @param len
+            bytes of audio
+    */
+    virtual void consume(const char* data, qint64 len) = 0;
+
+private slots:
+    void onTick(int ms);
+
+private:
+    SimulatedClock* _clock;
+    //! supplies the audio, NULL when stopped
+    QIODevice* _device;
+    //! playback state
+    QAudio::State _state;
+    //! simulated time since the start
+    qint64 _runMs;
+    //! frames played since the start
+    qint64 _runFrames;
+    //! bytes played in total
+    qint64 _bytesConsumed;
+
+    void setState(QAudio::State state);
+};
+
+/**
+    Discards the played audio
+*/
+class NullSink : public SimulatedSink
+{
+    Q_OBJECT
+public:
+    NullSink(const QAudioFormat& format, SimulatedClock* clock, QObject *parent = 0);
+
+protected:
+    void consume(const char* data, qint64 len);
+};
+
+/**
+    Writes the played audio to a WAV file
+*/
+class WavFileSink : public SimulatedSink
+{
+    Q_OBJECT
+public:
+    WavFileSink(const QString& fileName, const QAudioFormat& format, SimulatedClock* clock, QObject *parent = 0);
+    ~WavFileSink(void);
+
+protected:
+    void consume(const char* data, qint64 len);
+
+private:
+    QFile _file;
+    //! bytes of audio written
+    qint64 _dataBytes;
+
+    /**
+        Write the header for the audio written so far
+    */
+    void writeHeader();
+};
+
+#endif // HEADLESSENDPOINT_H
@@ -0,0 +1,292 @@
+
+/**
+    @file jitterbuffer.cpp
+    @breif Adaptive playout buffer for received audio streams
+    @author Natesh Narain
+*/
+
+#include "jitterbuffer.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <cmath>
+#include <cstring>
+
+#include "audioendpoint.h"
+
+#define JITTER_MIN_DELAY_MS   60    ///< smallest target playout delay
+#define JITTER_MAX_DELAY_MS   4000  ///< largest target playout delay
+#define JITTER_DELAY_FACTOR   4.0   ///< target delay in multiples of the jitter estimate
+#define JITTER_GAIN           16.0  ///< smoothing of the jitter estimate, as RFC 3550
+#define JITTER_EXCESS_MS      200   ///< audio allowed beyond the target before the oldest is dropped
+#define JITTER_MAX_CONCEAL_MS 200   ///< longest gap concealed, longer gaps are shortened
+#define JITTER_END_FACTOR     2.0   ///< silent arrival intervals before the stream is over
+#define JITTER_END_MIN_MS     1000  ///< shortest silence before the stream is over
+
+JitterBuffer::JitterBuffer(QObject *parent) : QIODevice(parent)
+{
+    _sync = new QMutex(QMutex::Recursive);
+    _latency = NULL;
+    _sender = 0;
+
+    setFormat(8, 1, 8000);
+    clear();
+}
+
+void JitterBuffer::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    QMutexLocker locker(_sync);
+
+    _frameBytes = (sampleSize / 8) * channels;
+    _bytesPerSecond = _frameBytes * sampleRate;
+
+    _concealer.setFormat(sampleSize, channels, sampleRate);
+
+    // room for the longest concealment and a chunk as long, grown once if the chunks are larger
+    _scratch.reserve((int)(((qint64)_bytesPerSecond * JITTER_MAX_CONCEAL_MS) / 1000) * 2);
+}
+
+void JitterBuffer::setLatencyMonitor(LatencyMonitor* monitor, uint8_t sender)
+{
+    QMutexLocker locker(_sync);
+
+    _latency = monitor;
+    _sender = sender;
+}
+
+void JitterBuffer::clear()
+{
+    QMutexLocker locker(_sync);
+
+    _chunks.clear();
+    _current.clear();
+    _currentPos = 0;
+    _nextSequence = 0;
+    _lastSequence = 0;
+    _bufferedBytes = 0;
+
+    _buffering = true;
+    _silentBytes = 0;
+    _isFirst = true;
+
+    _lastArrival = 0;
+    _lastTimestamp = 0;
+    _meanInterval = 0;
+    _meanChunkMs = 0;
+
+    _concealer.reset();
+
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.targetMs = JITTER_MIN_DELAY_MS;
+}
+
+void JitterBuffer::push(const QByteArray& chunk, uint16_t sequence, uint32_t timestamp)
+{
+    QMutexLocker locker(_sync);
+
+    // the clock the audio runs on, simulated runs estimate the same jitter every time
+    qint64 arrival = AudioEndpoints::elapsed();
+    qint64 extended;
+
+    if(_isFirst){
+        extended = sequence;
+        _nextSequence = extended;
+        _isFirst = false;
+    }
+    else{
+        // unwrap the 16 bit sequence number around the last one received
+        extended = _lastSequence + (int16_t)(sequence - (uint16_t)_lastSequence);
+
+        updateJitter(timestamp, arrival);
+    }
+
+    _stats.received++;
+
+    if(extended > _lastSequence || _stats.received == 1){
+        _lastSequence = extended;
+        _lastArrival = arrival;
+        _lastTimestamp = timestamp;
+    }
+
+    // its turn to play has passed
+    if(extended < _nextSequence || _chunks.contains(extended)){
+        _stats.late++;
+        return;
+    }
+
+    _chunks.insert(extended, chunk);
+    _bufferedBytes += chunk.size();
+
+    int chunkMs = bytesToMs(chunk.size());
+    _meanChunkMs = (_meanChunkMs == 0) ? chunkMs : (0.875 * _meanChunkMs + 0.125 * chunkMs);
+
+    // bound the delay, the oldest audio is the least useful
+    double excess = (2 * _meanChunkMs > JITTER_EXCESS_MS) ? 2 * _meanChunkMs : JITTER_EXCESS_MS;
+
+    while(_chunks.size() > 1 && bytesToMs(_bufferedBytes) > _stats.targetMs + excess){
+        QMap<qint64, QByteArray>::iterator oldest = _chunks.begin();
+
+        _bufferedBytes -= oldest.value().size();
+        _nextSequence = oldest.key() + 1;
+        _chunks.erase(oldest);
+
+        _stats.dropped++;
+    }
+
+    if(_buffering && bytesToMs(_bufferedBytes) >= _stats.targetMs){
+        _buffering = false;
+    }
+
+    emit readyRead();
+}
+
+void JitterBuffer::updateJitter(uint32_t timestamp, qint64 arrival)
+{
+    // difference in transit time between consecutive chunks
+    double transit = (double)(arrival - _lastArrival) - (double)(int32_t)(timestamp - _lastTimestamp);
+    _stats.jitterMs += (fabs(transit) - _stats.jitterMs) / JITTER_GAIN;
+
+    double interval = (double)(arrival - _lastArrival);
+    _meanInterval = (_meanInterval == 0) ? interval : (0.875 * _meanInterval + 0.125 * interval);
+
+    int target = JITTER_MIN_DELAY_MS + (int)(JITTER_DELAY_FACTOR * _stats.jitterMs);
+    if(target > JITTER_MAX_DELAY_MS) target = JITTER_MAX_DELAY_MS;
+
+    _stats.targetMs = target;
+}
+
+bool JitterBuffer::nextChunk()
+{
+    if(_chunks.isEmpty()) return false;
+
+    QMap<qint64, QByteArray>::iterator next = _chunks.begin();
+    QByteArray chunk = next.value();
+
+    // chunks that never arrived are concealed in front of the next one
+    if(next.key() > _nextSequence){
+        qint64 missing = next.key() - _nextSequence;
+        _stats.lost += (uint32_t)missing;
+
+        double gapMs = missing * _meanChunkMs;
+        if(gapMs > JITTER_MAX_CONCEAL_MS) gapMs = JITTER_MAX_CONCEAL_MS;
+
+        int gapFrames = (int)((gapMs * _bytesPerSecond) / (1000.0 * _frameBytes));
+
+        const int gapBytes = gapFrames * _frameBytes;
+
+        // _current lets go of the scratch buffer first, so its storage is reused and not copied
+        _current.clear();
+        _scratch.resize(gapBytes + chunk.size());
+
+        // the concealment is synthesized before the chunk ending the gap is merged with it
+        _concealer.conceal(_scratch.data(), gapFrames);
+
+        _concealer.process(chunk);
+        memcpy(_scratch.data() + gapBytes, chunk.constData(), chunk.size());
+
+        _current = _scratch;
+        _bufferedBytes += gapBytes;
+    }
+    else{
+        _concealer.process(chunk);
+        _current = chunk;
+    }
+
+    _currentPos = 0;
+    _nextSequence = next.key() + 1;
+
+    if(_latency != NULL) _latency->playout(_sender, (uint16_t)next.key());
+
+    _chunks.erase(next);
+
+    return true;
+}
+
+qint64 JitterBuffer::readData(char *data, qint64 maxlen)
+{
+    QMutexLocker locker(_sync);
+
+    // whole frames only
+    maxlen -= maxlen % _frameBytes;
+
+    qint64 copied = 0;
+
+    while(!_buffering && copied < maxlen){
+        if(_currentPos >= _current.size() && !nextChunk()){
+            // ran dry, refill to the target delay before playing again
+            _buffering = true;
+            _stats.underruns++;
+            break;
+        }
+
+        qint64 n = _current.size() - _currentPos;
+        if(n > maxlen - copied) n = maxlen - copied;
+
+        memcpy(data + copied, _current.constData() + _currentPos, n);
+        _currentPos += n;
+        _bufferedBytes -= n;
+        copied += n;
+
+        _silentBytes = 0;
+    }
+
+    if(copied < maxlen){
+        // nothing has arrived for much longer than chunks normally take, the stream is over
+        double endMs = JITTER_END_FACTOR * (_meanInterval > _meanChunkMs ? _meanInterval : _meanChunkMs) + _stats.targetMs;
+        if(endMs < JITTER_END_MIN_MS) endMs = JITTER_END_MIN_MS;
+
+        if(bytesToMs(_silentBytes) >= endMs){
+            if(copied == 0) qDebug() << "Stream ended";
+            return copied;
+        }
+
+        // keep the device running while the buffer refills, the concealment fades to comfort noise
+        _concealer.conceal(data + copied, (int)((maxlen - copied) / _frameBytes));
+        _silentBytes += maxlen - copied;
+        copied = maxlen;
+    }
+
+    return copied;
+}
+
+qint64 JitterBuffer::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+
+    qDebug() << "JitterBuffer: use push() to add audio";
+    return -1;
+}
+
+JitterBuffer::Stats JitterBuffer::getStats() const
+{
+    QMutexLocker locker(_sync);
+
+    Stats stats = _stats;
+    stats.depthMs = bytesToMs(_bufferedBytes);
+
+    return stats;
+}
+
+bool JitterBuffer::isSequential() const
+{
+    return true;
+}
+
+qint64 JitterBuffer::bytesAvailable() const
+{
+    QMutexLocker locker(_sync);
+
+    return _bufferedBytes + QIODevice::bytesAvailable();
+}
+
+int JitterBuffer::bytesToMs(qint64 bytes) const
+{
+    return (_bytesPerSecond > 0) ? (int)((bytes * 1000) / _bytesPerSecond) : 0;
+}
+
+JitterBuffer::~JitterBuffer()
+{
+    delete _sync;
+}
@@ -0,0 +1,173 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <cstdint>
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+
+#include "plc.h"
+#include "latencymonitor.h"
+
+/**
+    Playout buffer for received audio streams
+
+    Chunks are ordered by their sequence number and held until enough audio is buffered to ride out the
+    measured inter-arrival jitter. Missing chunks are concealed, and on an underrun the output is fed
+    concealment while the buffer refills to the target delay, so the audio device never goes idle in the
+    middle of a stream. The stream ends once
+    nothing has arrived for much longer than chunks normally take.
+*/
+class JitterBuffer : public QIODevice
+{
+    Q_OBJECT
+public:
+    //! Playout statistics
+    struct Stats{
+        int depthMs;         ///< audio currently buffered
+        int targetMs;        ///< target playout delay
+        double jitterMs;     ///< smoothed inter-arrival jitter
+        uint32_t received;   ///< chunks received
+        uint32_t late;       ///< chunks that arrived after their turn to play
+        uint32_t lost;       ///< chunks skipped over
+        uint32_t dropped;    ///< chunks discarded to bound the delay
+        uint32_t underruns;  ///< times the buffer ran dry
+    };
+
+    explicit JitterBuffer(QObject *parent = 0);
+    ~JitterBuffer(void);
+
+    /**
+        Set the format of the audio played out
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Add a received chunk
+
+        @param chunk
+            audio in the playout format
+
+        @param sequence
+            sequence number of the chunk
+
+        @param timestamp
+            sender time of the chunk in milliseconds
+    */
+    void push(const QByteArray& chunk, uint16_t sequence, uint32_t timestamp);
+
+    /**
+        Report when each chunk starts playing
+
+        @param monitor
+            records the playout, NULL to stop reporting
+
+        @param sender
+            id of the station the stream is from
+    */
+    void setLatencyMonitor(LatencyMonitor* monitor, uint8_t sender);
+
+    /**
+        Drop all buffered audio and clear the statistics, used when a new stream starts
+    */
+    void clear();
+
+    /**
+        @return the playout statistics
+    */
+    Stats getStats() const;
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+protected:
+    /**
+        Reimplemented QIODevice::readData(), feeds the audio output
+    */
+    qint64 readData(char *data, qint64 maxlen);
+
+    /**
+        Reimplemented QIODevice::writeData(), chunks are added with push()
+    */
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    //! chunks waiting to be played keyed by extended sequence number
+    QMap<qint64, QByteArray> _chunks;
+    //! chunk being played
+    QByteArray _current;
+    //! read offset into the current chunk
+    int _currentPos;
+    //! sequence number of the next chunk to play
+    qint64 _nextSequence;
+    //! last extended sequence number received
+    qint64 _lastSequence;
+    //! bytes buffered in _chunks and _current
+    qint64 _bufferedBytes;
+
+    //! filling to the target delay before playing
+    bool _buffering;
+    //! silence played since the buffer ran dry
+    qint64 _silentBytes;
+    //! no chunk received yet
+    bool _isFirst;
+
+    //! arrival time of the last chunk on the audio endpoint clock
+    qint64 _lastArrival;
+    //! sender timestamp of the last chunk
+    uint32_t _lastTimestamp;
+    //! smoothed time between arrivals
+    double _meanInterval;
+    //! smoothed duration of a chunk
+    double _meanChunkMs;
+
+    //! bytes per second of the playout format
+    int _bytesPerSecond;
+    //! bytes per sample frame
+    int _frameBytes;
+    //! fills gaps and underruns
+    LossConcealer _concealer;
+    //! a concealed gap and the chunk ending it, kept so the playback path does not allocate
+    QByteArray _scratch;
+
+    //! playout statistics
+    Stats _stats;
+
+    //! told when each chunk starts playing, NULL if not measuring
+    LatencyMonitor* _latency;
+    //! station the stream is from
+    uint8_t _sender;
+
+    //! Thread synchronization
+    QMutex* _sync;
+
+    /**
+        Update the jitter estimate and target delay from an arrival
+    */
+    void updateJitter(uint32_t timestamp, qint64 arrival);
+
+    /**
+        Move the next chunk to play into _current
+
+        @return false if there is nothing to play
+    */
+    bool nextChunk();
+
+    /**
+        @return the milliseconds of audio in a number of bytes
+    */
+    int bytesToMs(qint64 bytes) const;
+};
+
+#endif // JITTERBUFFER_H
@@ -0,0 +1,196 @@
+
+/**
+    @file latencymonitor.cpp
+    @breif Per stage latency histograms for audio streams
+    @author Natesh Narain
+*/
+
+#include "latencymonitor.h"
+#include "audioendpoint.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#define LATENCY_PENDING_MS 10000 ///< received frames not played within this are forgotten
+#define LATENCY_REPORT_MS  5000  ///< interval between reports
+
+LatencyHistogram::LatencyHistogram()
+{
+    _buckets.resize(LATENCY_MAX_MS + 1);
+    clear();
+}
+
+void LatencyHistogram::add(int ms)
+{
+    if(ms < 0) ms = 0;
+
+    _buckets[(ms < LATENCY_MAX_MS) ? ms : LATENCY_MAX_MS]++;
+    _count++;
+    if(ms > _max) _max = ms;
+}
+
+void LatencyHistogram::clear()
+{
+    _buckets.fill(0);
+    _count = 0;
+    _max = 0;
+}
+
+uint32_t LatencyHistogram::count() const
+{
+    return _count;
+}
+
+int LatencyHistogram::percentile(double fraction) const
+{
+    if(_count == 0) return 0;
+
+    // the rank of the delay wanted, rounded up so p99 of a few delays is the largest of them
+    uint64_t rank = (uint64_t)(fraction * _count + 0.999999);
+    if(rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    int i;
+
+    for(i = 0; i < LATENCY_MAX_MS; ++i){
+        seen += _buckets[i];
+        if(seen >= rank) return i;
+    }
+
+    return _max;
+}
+
+int LatencyHistogram::max() const
+{
+    return _max;
+}
+
+LatencyMonitor::LatencyMonitor(QObject *parent) : QObject(parent)
+{
+    _updated = false;
+
+    connect(&_report, SIGNAL(timeout()), this, SLOT(onReportTimeout()));
+    _report.start(LATENCY_REPORT_MS);
+}
+
+void LatencyMonitor::record(Stage stage, int ms)
+{
+    QMutexLocker locker(&_sync);
+
+    _stages[stage].add(ms);
+    _updated = true;
+}
+
+void LatencyMonitor::received(uint8_t sender, uint16_t sequence, int senderDelayMs, int linkMs, qint64 received, qint64 decoded)
+{
+    QMutexLocker locker(&_sync);
+
+    _stages[Link].add(linkMs);
+    _stages[Decode].add((int)(decoded - received));
+    _updated = true;
+
+    // frames dropped by the jitter buffer never play
+    while(!_pending.isEmpty() && received - _pending.first().received > LATENCY_PENDING_MS){
+        _pending.removeFirst();
+    }
+
+    Pending pending;
+    pending.sender = sender;
+    pending.sequence = sequence;
+    pending.senderDelayMs = senderDelayMs;
+    pending.linkMs = linkMs;
+    pending.received = received;
+    pending.decoded = decoded;
+
+    _pending.append(pending);
+}
+
+void LatencyMonitor::playout(uint8_t sender, uint16_t sequence)
+{
+    const qint64 now = AudioEndpoints::elapsed();
+    int i;
+
+    QMutexLocker locker(&_sync);
+
+    for(i = 0; i < _pending.size(); ++i){
+        const Pending& pending = _pending.at(i);
+
+        if(pending.sender == sender && pending.sequence == sequence){
+            _stages[Playout].add((int)(now - pending.decoded));
+            _stages[MouthToEar].add(pending.senderDelayMs + pending.linkMs + (int)(now - pending.received));
+            _updated = true;
+
+            _pending.removeAt(i);
+            return;
+        }
+    }
+}
+
+LatencyHistogram LatencyMonitor::getHistogram(Stage stage) const
+{
+    QMutexLocker locker(&_sync);
+
+    return _stages[stage];
+}
+
+QString LatencyMonitor::getReport() const
+{
+    QMutexLocker locker(&_sync);
+
+    QString report;
+    int i;
+
+    for(i = 0; i < NUM_STAGES; ++i){
+        const LatencyHistogram& stage = _stages[i];
+
+        report.append(QString("%1: n %2 p50 %3 ms p99 %4 ms max %5 ms\n")
+                      .arg(getStageName((Stage)i))
+                      .arg(stage.count())
+                      .arg(stage.percentile(0.5))
+                      .arg(stage.percentile(0.99))
+                      .arg(stage.max()));
+    }
+
+    return report;
+}
+
+void LatencyMonitor::clear()
+{
+    QMutexLocker locker(&_sync);
+    int i;
+
+    for(i = 0; i < NUM_STAGES; ++i) _stages[i].clear();
+    _pending.clear();
+    _updated = false;
+}
+
+const char* LatencyMonitor::getStageName(Stage stage)
+{
+    switch(stage){
+    case Encode:     return "encode";
+    case Transmit:   return "transmit";
+    case Link:       return "link";
+    case Decode:     return "decode";
+    case Playout:    return "playout";
+    case MouthToEar: return "mouth to ear";
+    default:         return "unknown";
+    }
+}
+
+void LatencyMonitor::onReportTimeout()
+{
+    LatencyHistogram mouthToEar;
+
+    {
+        QMutexLocker locker(&_sync);
+
+        if(!_updated) return;
+        _updated = false;
+
+        mouthToEar = _stages[MouthToEar];
+    }
+
+    qDebug("Stream latency\n%s", qPrintable(getReport()));
+
+    emit onLatencyUpdate(mouthToEar.percentile(0.5), mouthToEar.percentile(0.99), mouthToEar.max());
+}
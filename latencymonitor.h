@@ -0,0 +1,200 @@
+#ifndef LATENCYMONITOR_H
+#define LATENCYMONITOR_H
+
+#include <cstdint>
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#define LATENCY_MAX_MS 4096 ///< delays from here on share the last histogram bucket
+
+/**
+    Histogram of delays in 1 ms buckets
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram(void);
+
+    /**
+        Add a delay
+
+        @param ms
+            the delay in milliseconds
+    */
+    void add(int ms);
+
+    /**
+        Remove every delay
+    */
+    void clear();
+
+    /**
+        @return number of delays added
+    */
+    uint32_t count() const;
+
+    /**
+        @param fraction
+            between 0 and 1, 0.5 for the median
+
+        @return the delay that fraction of the delays are at or below, 0 if there are none
+    */
+    int percentile(double fraction) const;
+
+    /**
+        @return the longest delay
+    */
+    int max() const;
+
+private:
+    //! delays in each 1 ms bucket
+    QVector<uint32_t> _buckets;
+    //! delays added
+    uint32_t _count;
+    //! longest delay
+    int _max;
+};
+
+/**
+    Measures how long stream audio takes through each stage, from capture on one station to the output
+    device on another
+
+    The sender stamps each frame with its capture time and sequence number, and records how long encoding
+    and transmitting took on its own clock. The stations share no clock, so the frame also carries how
+    long the sender held it before it reached the link. The receiver adds the time the frame spent on the
+    link, worked out from its size and the baud rate, and its own time from receive to decode and playout.
+*/
+class LatencyMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    //! The delays measured
+    enum Stage{
+        Encode,     ///< capture to encoded, includes filling the frame
+        Transmit,   ///< encoded to written to the link
+        Link,       ///< time on the link, from the frame size and baud rate
+        Decode,     ///< received to decoded
+        Playout,    ///< decoded to handed to the output device
+        MouthToEar, ///< capture on the sender to the output device on the receiver
+        NUM_STAGES
+    };
+
+    explicit LatencyMonitor(QObject *parent = 0);
+
+    /**
+        Record the delay of a sender side stage
+
+        @param stage
+            Encode or Transmit
+
+        @param ms
+            the delay
+    */
+    void record(Stage stage, int ms);
+
+    /**
+        A stream frame was received and decoded
+
+        @param sender
+            id of the sending station
+
+        @param sequence
+            sequence number of the frame
+
+        @param senderDelayMs
+            time from capture until the frame reached the link on the sender
+
+        @param linkMs
+            time the frame spent on the link
+
+        @param received
+            local time the whole frame was received
+
+        @param decoded
+            local time the frame was decoded
+    */
+    void received(uint8_t sender, uint16_t sequence, int senderDelayMs, int linkMs, qint64 received, qint64 decoded);
+
+    /**
+        A stream frame started playing, may be called from the audio thread
+
+        @param sender
+            id of the sending station
+
+        @param sequence
+            sequence number of the frame
+    */
+    void playout(uint8_t sender, uint16_t sequence);
+
+    /**
+        Get the histogram of a stage
+
+        @param stage
+            the stage
+
+        @return a copy of the histogram
+    */
+    LatencyHistogram getHistogram(Stage stage) const;
+
+    /**
+        @return one line per stage with its count, p50, p99 and max
+    */
+    QString getReport() const;
+
+    /**
+        Clear every histogram
+    */
+    void clear();
+
+    /**
+        @return the name of a stage
+    */
+    static const char* getStageName(Stage stage);
+
+signals:
+    /**
+        Emitted periodically while frames are being measured, with the end to end delay
+
+        @param p50
+            median delay in milliseconds
+
+        @param p99
+            99th percentile delay in milliseconds
+
+        @param max
+            longest delay in milliseconds
+    */
+    void onLatencyUpdate(int p50, int p99, int max);
+
+private slots:
+    void onReportTimeout();
+
+private:
+    //! A received frame waiting to play
+    struct Pending{
+        uint8_t sender;
+        uint16_t sequence;
+        int senderDelayMs;
+        int linkMs;
+        qint64 received;
+        qint64 decoded;
+    };
+
+    //! delays of each stage
+    LatencyHistogram _stages[NUM_STAGES];
+    //! received frames in arrival order, frames that never play age out
+    QList<Pending> _pending;
+    //! delays added since the last report
+    bool _updated;
+    //! reports periodically
+    QTimer _report;
+    //! frames are received and played on different threads
+    mutable QMutex _sync;
+};
+
+#endif // LATENCYMONITOR_H
@@ -0,0 +1,329 @@
+
+/**
+    @file levelmeter.cpp
+    @breif Level of captured audio, measured on the capture side and read by the UI
+    @author Natesh Narain
+*/
+
+#include "levelmeter.h"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define METER_LEVEL_MASK 0x7FFFu      ///< RMS and peak are stored as 15 bit levels
+#define METER_PEAK_SHIFT 15           ///< position of the peak in the slot
+#define METER_CLIPPED    (1u << 30)   ///< a sample was clipped
+#define METER_MEASURED   (1u << 31)   ///< the slot holds a level, the empty slot is 0
+
+/**
+    Sum of squares and the largest and smallest sample of a period, all on the 16 bit scale
+*/
+static double _reduce(const int16_t* in, int n, int* max, int* min)
+{
+    uint64_t sum = 0;
+    int hi = INT16_MIN, lo = INT16_MAX;
+    int i = 0, j;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    __m128i vMax = _mm_set1_epi16(INT16_MIN);
+    __m128i vMin = _mm_set1_epi16(INT16_MAX);
+
+    for(; i + 8 <= n; i += 8){
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+
+        // pairs of squares are at most 2^31, so they are widened unsigned
+        __m128i sq = _mm_madd_epi16(x, x);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+
+        vMax = _mm_max_epi16(vMax, x);
+        vMin = _mm_min_epi16(vMin, x);
+    }
+
+    uint64_t sums[2];
+    int16_t maxs[8], mins[8];
+    _mm_storeu_si128((__m128i*)sums, acc);
+    _mm_storeu_si128((__m128i*)maxs, vMax);
+    _mm_storeu_si128((__m128i*)mins, vMin);
+
+    sum = sums[0] + sums[1];
+    for(j = 0; j < 8; ++j){
+        if(maxs[j] > hi) hi = maxs[j];
+        if(mins[j] < lo) lo = mins[j];
+    }
+#elif defined(__ARM_NEON)
+    int64x2_t acc = vdupq_n_s64(0);
+    int16x8_t vMax = vdupq_n_s16(INT16_MIN);
+    int16x8_t vMin = vdupq_n_s16(INT16_MAX);
+
+    for(; i + 8 <= n; i += 8){
+        int16x8_t x = vld1q_s16(in + i);
+
+        acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+        acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+
+        vMax = vmaxq_s16(vMax, x);
+        vMin = vminq_s16(vMin, x);
+    }
+
+    int16_t maxs[8], mins[8];
+    vst1q_s16(maxs, vMax);
+    vst1q_s16(mins, vMin);
+
+    sum = (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1));
+    for(j = 0; j < 8; ++j){
+        if(maxs[j] > hi) hi = maxs[j];
+        if(mins[j] < lo) lo = mins[j];
+    }
+#endif
+
+    for(; i < n; ++i){
+        int x = in[i];
+        sum += (uint64_t)(x * x);
+        if(x > hi) hi = x;
+        if(x < lo) lo = x;
+    }
+
+    *max = hi;
+    *min = lo;
+
+    return (double)sum;
+}
+
+static double _reduce(const uint8_t* in, int n, int* max, int* min)
+{
+    uint64_t sum = 0;
+    int hi = 0, lo = 0xFF;
+    int i = 0, j;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i acc = _mm_setzero_si128();
+    __m128i vMax = _mm_setzero_si128();
+    __m128i vMin = _mm_set1_epi8((char)0xFF);
+
+    for(; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+
+        // centred on zero and sign extended to 16 bits
+        __m128i s = _mm_xor_si128(x, bias);
+        __m128i sLo = _mm_srai_epi16(_mm_unpacklo_epi8(zero, s), 8);
+        __m128i sHi = _mm_srai_epi16(_mm_unpackhi_epi8(zero, s), 8);
+
+        __m128i sq = _mm_add_epi32(_mm_madd_epi16(sLo, sLo), _mm_madd_epi16(sHi, sHi));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+
+        vMax = _mm_max_epu8(vMax, x);
+        vMin = _mm_min_epu8(vMin, x);
+    }
+
+    uint64_t sums[2];
+    uint8_t maxs[16], mins[16];
+    _mm_storeu_si128((__m128i*)sums, acc);
+    _mm_storeu_si128((__m128i*)maxs, vMax);
+    _mm_storeu_si128((__m128i*)mins, vMin);
+
+    sum = sums[0] + sums[1];
+    for(j = 0; j < 16; ++j){
+        if(maxs[j] > hi) hi = maxs[j];
+        if(mins[j] < lo) lo = mins[j];
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t bias = vdupq_n_u8(0x80);
+    int64x2_t acc = vdupq_n_s64(0);
+    uint8x16_t vMax = vdupq_n_u8(0);
+    uint8x16_t vMin = vdupq_n_u8(0xFF);
+
+    for(; i + 16 <= n; i += 16){
+        uint8x16_t x = vld1q_u8(in + i);
+        int8x16_t s = vreinterpretq_s8_u8(veorq_u8(x, bias));
+
+        acc = vpadalq_s32(acc, vpaddlq_s16(vmull_s8(vget_low_s8(s), vget_low_s8(s))));
+        acc = vpadalq_s32(acc, vpaddlq_s16(vmull_s8(vget_high_s8(s), vget_high_s8(s))));
+
+        vMax = vmaxq_u8(vMax, x);
+        vMin = vminq_u8(vMin, x);
+    }
+
+    uint8_t maxs[16], mins[16];
+    vst1q_u8(maxs, vMax);
+    vst1q_u8(mins, vMin);
+
+    sum = (uint64_t)(vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1));
+    for(j = 0; j < 16; ++j){
+        if(maxs[j] > hi) hi = maxs[j];
+        if(mins[j] < lo) lo = mins[j];
+    }
+#endif
+
+    for(; i < n; ++i){
+        int x = in[i] - 0x80;
+        sum += (uint64_t)(x * x);
+        if(in[i] > hi) hi = in[i];
+        if(in[i] < lo) lo = in[i];
+    }
+
+    *max = (hi - 0x80) * 256;
+    *min = (lo - 0x80) * 256;
+
+    return (double)sum * 65536.0;
+}
+
+static double _reduce(const float* in, int n, int* max, int* min)
+{
+    float sum = 0;
+    float hi = -1.0f, lo = 1.0f;
+    int i = 0, j;
+
+#if defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 vMax = _mm_set1_ps(-1.0f);
+    __m128 vMin = _mm_set1_ps(1.0f);
+
+    for(; i + 8 <= n; i += 8){
+        __m128 x0 = _mm_loadu_ps(in + i);
+        __m128 x1 = _mm_loadu_ps(in + i + 4);
+
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(x0, x0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(x1, x1));
+
+        vMax = _mm_max_ps(vMax, _mm_max_ps(x0, x1));
+        vMin = _mm_min_ps(vMin, _mm_min_ps(x0, x1));
+    }
+
+    float sums[4], maxs[4], mins[4];
+    _mm_storeu_ps(sums, _mm_add_ps(acc0, acc1));
+    _mm_storeu_ps(maxs, vMax);
+    _mm_storeu_ps(mins, vMin);
+
+    sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    for(j = 0; j < 4; ++j){
+        if(maxs[j] > hi) hi = maxs[j];
+        if(mins[j] < lo) lo = mins[j];
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    float32x4_t vMax = vdupq_n_f32(-1.0f);
+    float32x4_t vMin = vdupq_n_f32(1.0f);
+
+    for(; i + 8 <= n; i += 8){
+        float32x4_t x0 = vld1q_f32(in + i);
+        float32x4_t x1 = vld1q_f32(in + i + 4);
+
+        acc0 = vmlaq_f32(acc0, x0, x0);
+        acc1 = vmlaq_f32(acc1, x1, x1);
+
+        vMax = vmaxq_f32(vMax, vmaxq_f32(x0, x1));
+        vMin = vminq_f32(vMin, vminq_f32(x0, x1));
+    }
+
+    float sums[4], maxs[4], mins[4];
+    vst1q_f32(sums, vaddq_f32(acc0, acc1));
+    vst1q_f32(maxs, vMax);
+    vst1q_f32(mins, vMin);
+
+    sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    for(j = 0; j < 4; ++j){
+        if(maxs[j] > hi) hi = maxs[j];
+        if(mins[j] < lo) lo = mins[j];
+    }
+#endif
+
+    for(; i < n; ++i){
+        sum += in[i] * in[i];
+        if(in[i] > hi) hi = in[i];
+        if(in[i] < lo) lo = in[i];
+    }
+
+    *max = (int)(hi * 32768.0f);
+    *min = (int)(lo * 32768.0f);
+
+    return (double)sum * 32768.0 * 32768.0;
+}
+
+LevelMeter::LevelMeter()
+{
+    _slot.store(0);
+
+    setFormat(8, 1);
+    setClipLevels(0x00, 0xFF);
+}
+
+void LevelMeter::setFormat(int sampleSize, int channels)
+{
+    // every channel counts towards the level the same
+    Q_UNUSED(channels);
+
+    _sampleSize = sampleSize;
+}
+
+void LevelMeter::setClipLevels(uint8_t lower, uint8_t upper)
+{
+    // the thresholds are 8 bit amplitudes, samples beyond them are clipped by the filter
+    _lowerClip = (lower - 0x80) * 256;
+    _upperClip = (upper - 0x80) * 256;
+}
+
+void LevelMeter::measure(const char* data, qint64 len)
+{
+    const int numSamples = (int)(len / (_sampleSize / 8));
+    int max, min;
+    double sum;
+
+    if(numSamples <= 0) return;
+
+    // the only pass over the audio
+    if(_sampleSize == 32)
+        sum = _reduce((const float*)data, numSamples, &max, &min);
+    else if(_sampleSize == 16)
+        sum = _reduce((const int16_t*)data, numSamples, &max, &min);
+    else
+        sum = _reduce((const uint8_t*)data, numSamples, &max, &min);
+
+    uint rms = (uint)sqrt(sum / numSamples);
+    uint peak = (uint)((max > -min) ? max : -min);
+
+    if(rms > METER_LEVEL_MASK) rms = METER_LEVEL_MASK;
+    if(peak > METER_LEVEL_MASK) peak = METER_LEVEL_MASK;
+
+    uint level = METER_MEASURED | rms | (peak << METER_PEAK_SHIFT);
+    if(max > _upperClip || min < _lowerClip) level |= METER_CLIPPED;
+
+    uint current, merged;
+
+    // a level not read yet keeps its peak and clipping, only the UI can empty the slot so this rarely retries
+    do{
+        current = _slot.loadAcquire();
+        merged = level;
+
+        if(current & METER_MEASURED){
+            uint held = (current >> METER_PEAK_SHIFT) & METER_LEVEL_MASK;
+            if(held > peak) merged = (merged & ~(METER_LEVEL_MASK << METER_PEAK_SHIFT)) | (held << METER_PEAK_SHIFT);
+            merged |= current & METER_CLIPPED;
+        }
+    }while(!_slot.testAndSetOrdered(current, merged));
+}
+
+bool LevelMeter::take(Level& level)
+{
+    uint value = _slot.fetchAndStoreAcquire(0);
+
+    if(!(value & METER_MEASURED)) return false;
+
+    level.rms = (value & METER_LEVEL_MASK) / (float)METER_LEVEL_MASK;
+    level.peak = ((value >> METER_PEAK_SHIFT) & METER_LEVEL_MASK) / (float)METER_LEVEL_MASK;
+    level.clipped = (value & METER_CLIPPED) != 0;
+
+    return true;
+}
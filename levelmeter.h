@@ -0,0 +1,84 @@
+#ifndef LEVELMETER_H
+#define LEVELMETER_H
+
+#include <cstdint>
+
+#include <QAtomicInteger>
+
+/**
+    Measures the level of captured audio for display
+
+    The capture side makes one pass over each period of audio it is handed for the RMS, the peak and
+    whether any sample is beyond the filter thresholds, and publishes the result to a single atomic
+    slot. The display reads the slot on its own timer, so the audio never signals the UI and neither
+    side waits on the other. Periods not yet read are merged into the slot, keeping the highest peak and
+    any clipping so a short burst is not missed between reads.
+*/
+class LevelMeter
+{
+public:
+    //! Level of the audio since the last read, on the full scale of the sample type
+    struct Level{
+        float rms;    ///< RMS of the newest period, 0 to 1
+        float peak;   ///< highest peak, 0 to 1
+        bool clipped; ///< a sample went beyond the filter thresholds
+    };
+
+    LevelMeter(void);
+
+    /**
+        Set the format of the measured audio
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+    */
+    void setFormat(int sampleSize, int channels);
+
+    /**
+        Set the levels audio is clipped at, the filter thresholds
+
+        @param lower
+            8 bit amplitude below which samples are clipped
+
+        @param upper
+            8 bit amplitude above which samples are clipped
+    */
+    void setClipLevels(uint8_t lower, uint8_t upper);
+
+    /**
+        Measure one period of captured audio, may be called from the audio thread
+
+        @param data
+            audio in the set format
+
+        @param len
+            bytes of audio
+    */
+    void measure(const char* data, qint64 len);
+
+    /**
+        Take the level measured since the last call, called from the UI
+
+        @param level
+            set to the level if any audio was measured
+
+        @return false if no audio was measured since the last call
+    */
+    bool take(Level& level);
+
+private:
+    //! bits per sample
+    int _sampleSize;
+    //! lowest sample not clipped, on the 16 bit scale
+    int _lowerClip;
+    //! highest sample not clipped, on the 16 bit scale
+    int _upperClip;
+
+    //! newest RMS, highest peak and clipping packed together, 0 when read
+    QAtomicInteger<uint> _slot;
+};
+
+#endif // LEVELMETER_H
@@ -0,0 +1,127 @@
+/**
+    @file loopbackport.cpp
+    @breif Serial port that reads back what it writes
+    @author Natesh Narain
+*/
+
+#include "loopbackport.h"
+
+#include <cstring>
+
+#include "audioendpoint.h"
+#include "simulatedclock.h"
+
+#define LOOPBACK_BITS_PER_BYTE 10 ///< start, 8 data and stop bit
+#define LOOPBACK_PERIOD_MS 10     ///< link update period on the wall clock
+
+LoopbackPort::LoopbackPort(QObject *parent) : QSerialPort(parent)
+{
+    _credit = 0;
+    _lastTime = 0;
+
+    // pace the link on the clock the audio runs on
+    SimulatedClock* clock = AudioEndpoints::clock();
+    if(clock != NULL){
+        connect(clock, SIGNAL(tick(int)), this, SLOT(onTick(int)));
+    }
+    else{
+        _timer.setInterval(LOOPBACK_PERIOD_MS);
+        connect(&_timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+    }
+}
+
+LoopbackPort::~LoopbackPort()
+{
+    close();
+}
+
+bool LoopbackPort::open(OpenMode mode)
+{
+    if(isOpen()) return false;
+
+    _outgoing.resize(0);
+    _incoming.resize(0);
+    _credit = 0;
+
+    if(AudioEndpoints::clock() == NULL){
+        _lastTime = AudioEndpoints::elapsed();
+        _timer.start();
+    }
+
+    // skip the device, the bytes are kept here
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void LoopbackPort::close()
+{
+    if(!isOpen()) return;
+
+    _timer.stop();
+    _outgoing.resize(0);
+    _incoming.resize(0);
+
+    QIODevice::close();
+}
+
+bool LoopbackPort::isSequential() const
+{
+    return true;
+}
+
+qint64 LoopbackPort::bytesAvailable() const
+{
+    return _incoming.size() + QIODevice::bytesAvailable();
+}
+
+qint64 LoopbackPort::bytesToWrite() const
+{
+    return _outgoing.size();
+}
+
+qint64 LoopbackPort::readData(char *data, qint64 maxSize)
+{
+    qint64 len = qMin(maxSize, (qint64)_incoming.size());
+
+    memcpy(data, _incoming.constData(), len);
+    _incoming.remove(0, len);
+
+    return len;
+}
+
+qint64 LoopbackPort::writeData(const char *data, qint64 maxSize)
+{
+    _outgoing.append(data, maxSize);
+    return maxSize;
+}
+
+void LoopbackPort::onTick(int ms)
+{
+    if(!isOpen()) return;
+
+    // an idle link does not bank time for the next write
+    if(_outgoing.isEmpty()){
+        _credit = 0;
+        return;
+    }
+
+    _credit += (double)ms * baudRate() / LOOPBACK_BITS_PER_BYTE / 1000.0;
+
+    int len = qMin((int)_credit, _outgoing.size());
+    if(len <= 0) return;
+
+    _credit -= len;
+
+    _incoming.append(_outgoing.constData(), len);
+    _outgoing.remove(0, len);
+
+    emit bytesWritten(len);
+    emit readyRead();
+}
+
+void LoopbackPort::onTimeout()
+{
+    qint64 now = AudioEndpoints::elapsed();
+
+    onTick((int)(now - _lastTime));
+    _lastTime = now;
+}
@@ -0,0 +1,53 @@
+#ifndef LOOPBACKPORT_H
+#define LOOPBACKPORT_H
+
+#include <QtSerialPort/QSerialPort>
+#include <QByteArray>
+#include <QTimer>
+
+#define LOOPBACK_PORT_NAME "loopback" ///< port name that opens the loopback link instead of a device
+
+/**
+    Serial port that reads back what it writes
+
+    Stands in for a device when there is no serial hardware, e.g. for benchmark runs. Written bytes go
+    out at the baud rate on the audio endpoint clock, so a headless run sees the same link time a real
+    port would give, and then come back as received data.
+*/
+class LoopbackPort : public QSerialPort
+{
+    Q_OBJECT
+public:
+    explicit LoopbackPort(QObject *parent = 0);
+    ~LoopbackPort();
+
+    bool open(OpenMode mode);
+    void close();
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private slots:
+    void onTick(int ms);
+    void onTimeout();
+
+private:
+    //! bytes written and not on the link yet
+    QByteArray _outgoing;
+    //! bytes off the link and not read yet
+    QByteArray _incoming;
+    //! link bytes owed to the next tick
+    double _credit;
+
+    //! drives the link when the audio runs on the wall clock
+    QTimer _timer;
+    //! endpoint time of the last timeout
+    qint64 _lastTime;
+};
+
+#endif // LOOPBACKPORT_H
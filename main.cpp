@@ -9,16 +9,42 @@
 
 #include "mainwindow.h"
 #include <QApplication>
+#include <QCommandLineParser>
 
 #include "messagequeue.h"
+#include "audioendpoint.h"
 
 int main(int argc, char *argv[])
 {
     srand(time(NULL));
 
     QApplication a(argc, argv);
+
+    // run without sound hardware, e.g. -platform offscreen --audio-source tone:440 --audio-sink null
+    QCommandLineParser parser;
+    parser.addHelpOption();
+
+    QCommandLineOption sourceOption("audio-source", "Audio source: device, wav:<file>, tone:<hz> or noise", "spec", "device");
+    QCommandLineOption sinkOption("audio-sink", "Audio sink: device, null or wav:<file>", "spec", "device");
+    QCommandLineOption speedOption("clock-speed", "Simulated clock speed for headless audio, 0 runs as fast as possible", "speed", "1");
+    QCommandLineOption runOption("run-for", "Stream over a loopback link for this long, print the latency report and exit", "ms");
+    parser.addOption(sourceOption);
+    parser.addOption(sinkOption);
+    parser.addOption(speedOption);
+    parser.addOption(runOption);
+    parser.process(a);
+
+    AudioEndpoints::configure(parser.value(sourceOption), parser.value(sinkOption), parser.value(speedOption).toDouble());
+
     MainWindow w;
 
-    w.show();
+    // benchmark and regression runs stream unattended, e.g. --run-for 10000 with the headless endpoints
+    if(parser.isSet(runOption)){
+        if(!w.runFor(parser.value(runOption).toInt())) return 1;
+    }
+    else{
+        w.show();
+    }
+
     return a.exec();
 }
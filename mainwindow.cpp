@@ -12,8 +12,19 @@
 #include <QByteArray>
 #include <QDateTime>
 #include <QMessageBox>
+#include <QApplication>
+
+#include <cmath>
+#include <cstdio>
 
 #include "bitopts.h"
+#include "loopbackport.h"
+#include "audioendpoint.h"
+
+#define METER_INTERVAL_MS 50   ///< interval the input level is shown at
+#define METER_RANGE_DB    60   ///< levels shown below full scale
+#define METER_CLIP_HOLD   20   ///< meter updates clipping stays shown for
+#define RUN_CHECK_MS      10   ///< interval a timed run checks the clock at
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -21,7 +32,7 @@ MainWindow::MainWindow(QWidget *parent) :
 {
     ui->setupUi(this);
 
-    //
+    // picked when a session opens
     _id = 0;
 
     // settings dialogs
@@ -32,17 +43,37 @@ MainWindow::MainWindow(QWidget *parent) :
     // audio recording and playback
     audio = new AudioPlayback(audioSettings->getSettings(), this);
     connect(audio, SIGNAL(stoppedPlaying()), this, SLOT(onPlaybackStopped()));
-    connect(audio, SIGNAL(onStreamBufferSendReady(QByteArray&)), this, SLOT(onStreamBufferSendReady(QByteArray&)));
+    connect(audio, SIGNAL(onStreamBufferSendReady(QByteArray&,quint32)), this, SLOT(onStreamBufferSendReady(QByteArray&,quint32)));
+    connect(audio, SIGNAL(onStreamSilenceReady(QByteArray&,quint32)), this, SLOT(onStreamSilenceReady(QByteArray&,quint32)));
 
     // init serial com
     serial = new SerialCom(this);
     connect(serial, SIGNAL(onQueueUpdate(int)), this, SLOT(onMessageReceived(int)));
-
-    serial->setStationId(_id);
+    connect(serial, SIGNAL(onBroadcastSent()), this, SLOT(onBroadcastSent()));
+
+    // measure stream latency on both the sending and receiving side
+    latency = new LatencyMonitor(this);
+    serial->setLatencyMonitor(latency);
+    audio->setLatencyMonitor(latency);
+    connect(latency, SIGNAL(onLatencyUpdate(int,int,int)), this, SLOT(onLatencyUpdate(int,int,int)));
+
+    // the input level is polled, the audio never signals the UI
+    clipHold = 0;
+    ui->pbInputLevel->setRange(0, METER_RANGE_DB);
+    ui->pbInputLevel->setValue(0);
+    levelTimer = new QTimer(this);
+    connect(levelTimer, SIGNAL(timeout()), this, SLOT(onLevelTimer()));
+    levelTimer->start(METER_INTERVAL_MS);
+
+    runTimer = new QTimer(this);
+    runTimer->setInterval(RUN_CHECK_MS);
+    connect(runTimer, SIGNAL(timeout()), this, SLOT(onRunTimer()));
+    runEnd = 0;
 
     // connect serial com to audio broadcast player
-    connect(serial, SIGNAL(onAudioReceived(QByteArray&)), audio, SLOT(onAudioReceived(QByteArray&)));
-    connect(serial, SIGNAL(onAudioStreamReceived(QByteArray&)), audio, SLOT(onAudioStreamReceived(QByteArray&)));
+    connect(serial, SIGNAL(onBroadcastDataReceived(QByteArray&,quint8,quint8,quint8)), audio, SLOT(onBroadcastDataReceived(QByteArray&,quint8,quint8,quint8)));
+    connect(audio, SIGNAL(onBroadcastQueueUpdate(int)), this, SLOT(onBroadcastQueueUpdate(int)));
+    connect(serial, SIGNAL(onAudioStreamReceived(QByteArray&,quint8,quint16,quint32)), audio, SLOT(onAudioStreamReceived(QByteArray&,quint8,quint16,quint32)));
 
     // connect button click events to respective slots
     connect(ui->bnRecord, SIGNAL(clicked()), this, SLOT(onRecordButtonClicked()));
@@ -99,16 +130,31 @@ void MainWindow::onPlaybackStopped()
 
 void MainWindow::onSendAudioButtonClicked()
 {
-    QBuffer buffer;
-    audio->getRecordedAudio(buffer);
-
-    QByteArray data = buffer.data();
+    // streamed from the recording's mapping, not copied
+    QByteArray data = audio->getRecordedAudio();
 
     AdvancedSettings::Settings settings = advancedSettings->getSettings();
     uint8_t decodeOptions = settings.bDecodeOpts;
     setbit(decodeOptions, MSG_TYPE_AUDIO);
 
-    serial->write(data, receiverId, settings.useHeader, decodeOptions);
+    if(settings.useHeader){
+        // one broadcast goes out at a time, the next can be recorded once the last fragment is out
+        ui->bnRecord->setEnabled(false);
+        ui->bnSendAudio->setEnabled(false);
+
+        serial->writeBroadcast(data, receiverId, decodeOptions, settings.bAudioCodec);
+    }
+    else{
+        serial->write(data, receiverId, settings.useHeader, decodeOptions, settings.bAudioCodec);
+    }
+}
+
+void MainWindow::onBroadcastSent()
+{
+    // the session may have closed while the broadcast was going out
+    bool enabled = ui->bnSendText->isEnabled();
+    ui->bnRecord->setEnabled(enabled);
+    ui->bnSendAudio->setEnabled(enabled);
 }
 
 void MainWindow::onStreamButtonClicked()
@@ -123,14 +169,24 @@ void MainWindow::onStreamButtonClicked()
     }
 }
 
-void MainWindow::onStreamBufferSendReady(QByteArray& buffer)
+void MainWindow::onStreamBufferSendReady(QByteArray& buffer, quint32 timestamp)
 {
     qDebug() << "Sending audio stream";
 
     AdvancedSettings::Settings settings = advancedSettings->getSettings();
     setbit(settings.bDecodeOpts, MSG_TYPE_AUDIO_STREAM);
 
-    serial->write(buffer, receiverId, settings.useHeader, settings.bDecodeOpts);
+    serial->write(buffer, receiverId, settings.useHeader, settings.bDecodeOpts, settings.bAudioCodec, timestamp);
+}
+
+void MainWindow::onStreamSilenceReady(QByteArray& descriptor, quint32 timestamp)
+{
+    qDebug() << "Sending stream silence";
+
+    AdvancedSettings::Settings settings = advancedSettings->getSettings();
+    setbit(settings.bDecodeOpts, MSG_TYPE_AUDIO_STREAM);
+
+    serial->write(descriptor, receiverId, settings.useHeader, settings.bDecodeOpts, AUDIO_CODEC_SILENCE, timestamp);
 }
 
 void MainWindow::onSendTextButtonClicked()
@@ -153,9 +209,12 @@ void MainWindow::onSendTextButtonClicked()
 
 void MainWindow::onNextMessageButtonClicked()
 {
-    Message* message = serial->getNextMessageFromQueue();
+    MessageHandle handle = serial->getNextMessageFromQueue();
+    Message* message = serial->getMessage(handle);
+    if(message == NULL) return;
+
     updateMessageDisplay(message);
-    free(message);
+    serial->releaseMessage(handle);
 }
 
 void MainWindow::onAddUserButtonClicked()
@@ -231,28 +290,115 @@ void MainWindow::onMessageReceived(int numQueued)
         ui->bnNextMessage->setEnabled(true);
 }
 
+void MainWindow::onBroadcastQueueUpdate(int numQueued)
+{
+    ui->statusBar->showMessage(QString("Broadcasts queued: %1").arg(numQueued));
+}
+
+void MainWindow::onLatencyUpdate(int p50, int p99, int max)
+{
+    ui->statusBar->showMessage(QString("Stream latency p50 %1 ms, p99 %2 ms, max %3 ms").arg(p50).arg(p99).arg(max));
+}
+
+void MainWindow::onLevelTimer()
+{
+    LevelMeter::Level level;
+
+    // nothing captured since the last update
+    if(!audio->getLevelMeter()->take(level)){
+        level.rms = 0;
+        level.peak = 0;
+        level.clipped = false;
+    }
+
+    if(level.clipped) clipHold = METER_CLIP_HOLD;
+    else if(clipHold > 0) clipHold--;
+
+    int peakDb = (level.peak > 0) ? (int)floor(20 * log10(level.peak)) : -METER_RANGE_DB;
+    int rmsDb = (level.rms > 0) ? (int)floor(20 * log10(level.rms)) : -METER_RANGE_DB;
+    if(peakDb < -METER_RANGE_DB) peakDb = -METER_RANGE_DB;
+    if(rmsDb < -METER_RANGE_DB) rmsDb = -METER_RANGE_DB;
+
+    ui->pbInputLevel->setValue(METER_RANGE_DB + peakDb);
+    ui->pbInputLevel->setFormat((clipHold > 0) ? QString("Clipping") : QString("%1 dB").arg(peakDb));
+    ui->lbInputLevel->setText(QString("Input RMS %1 dB").arg(rmsDb));
+}
+
 void MainWindow::newSession()
 {
-    SerialSettings::Settings settings = serialSettings->getSettings();
+    openSession(serialSettings->getSettings());
+}
+
+bool MainWindow::openSession(SerialSettings::Settings settings)
+{
     AdvancedSettings::Settings advancedSetting = advancedSettings->getSettings();
     AudioSettings::Settings audioSetting = audioSettings->getSettings();
 
+    // streams, broadcasts and their rate conversion are kept apart by sender, so every station needs its own id
+    if(advancedSetting.stationId != STATION_ID_AUTO){
+        _id = advancedSetting.stationId;
+    }
+    else{
+        // not from rand(), stations started in the same second would be seeded alike
+        uint32_t seed = (uint32_t)QDateTime::currentMSecsSinceEpoch() ^ ((uint32_t)QCoreApplication::applicationPid() * 2654435761u);
+        _id = 1 + (int)(seed % (UINT8_MAX - 1));
+    }
+    serial->setStationId(_id);
+
     serial->setUseHeader(advancedSetting.useHeader);
+    serial->setAdaptiveStreamRate(advancedSetting.adaptiveStreamRate);
 
     if(serial->open(settings)){
         audio->setAudioFormat(audioSetting);
+        serial->setAudioFormat(audioSetting);
 
         ui->actionNew_Session->setEnabled(false);
         ui->actionClose_Session->setEnabled(true);
         setEnabledUIComponents(true);
-        ui->statusBar->showMessage("Serial Communication Opened: " + settings.portName);
+        ui->statusBar->showMessage("Serial Communication Opened: " + settings.portName + ", station " + QString::number(_id));
+
+        return true;
     }
     else{
         ui->statusBar->showMessage("Failed to open serial port");
         qDebug() << "Failed to open serial port" << "\n";
+
+        return false;
     }
 }
 
+bool MainWindow::runFor(int ms)
+{
+    // the station streams to itself over the loopback link, paced at the configured baud rate
+    SerialSettings::Settings settings = serialSettings->getSettings();
+    settings.portName = LOOPBACK_PORT_NAME;
+
+    if(!openSession(settings)) return false;
+
+    onStreamButtonClicked();
+
+    runEnd = AudioEndpoints::elapsed() + ms;
+    runTimer->start();
+
+    return true;
+}
+
+void MainWindow::onRunTimer()
+{
+    if(AudioEndpoints::elapsed() < runEnd) return;
+
+    runTimer->stop();
+
+    if(audio->isStreamRecording()) onStreamButtonClicked();
+    closeSession();
+
+    printf("%s", qPrintable(latency->getReport()));
+    fflush(stdout);
+
+    // nothing made it from capture to playout, the run failed
+    QApplication::exit((latency->getHistogram(LatencyMonitor::MouthToEar).count() > 0) ? 0 : 1);
+}
+
 void MainWindow::closeSession()
 {
     serial->close();
@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QTimer>
 
 #include "audiosettings.h"
 #include "serialsettings.h"
@@ -27,6 +28,19 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    /**
+        Stream over a loopback link without the user, then print the latency report and quit
+
+        For benchmark and regression runs. The application exits with 0 if stream audio reached
+        playout and 1 otherwise.
+
+        @param ms
+            milliseconds to stream for, on the audio endpoint clock
+
+        @return false if the loopback session did not open
+    */
+    bool runFor(int ms);
+
 public slots:
     void onRecordButtonClicked();
     void onListenButtonClicked();
@@ -41,9 +55,15 @@ public slots:
     void closeSession();
 
     void onMessageReceived(int numQueued);
+    void onBroadcastQueueUpdate(int numQueued);
 
     void onPlaybackStopped();
-    void onStreamBufferSendReady(QByteArray&);
+    void onBroadcastSent();
+    void onStreamBufferSendReady(QByteArray&, quint32 timestamp);
+    void onStreamSilenceReady(QByteArray&, quint32 timestamp);
+    void onLatencyUpdate(int p50, int p99, int max);
+    void onLevelTimer();
+    void onRunTimer();
 
     void debugSerial();
 
@@ -60,6 +80,16 @@ private:
     SerialCom* serial;
     //! audio plack and recording
     AudioPlayback* audio;
+    //! stream latency from capture to playout
+    LatencyMonitor* latency;
+    //! shows the input level
+    QTimer* levelTimer;
+    //! meter updates left showing clipping
+    int clipHold;
+    //! ends a timed run
+    QTimer* runTimer;
+    //! endpoint time a timed run ends at
+    qint64 runEnd;
 
     //! user list
     UserList userList;
@@ -76,6 +106,16 @@ private:
     */
     void initMenuActions();
 
+    /**
+        Open the serial port and set the audio format for a session
+
+        @param settings
+            the serial settings to open with
+
+        @return true if the session opened
+    */
+    bool openSession(SerialSettings::Settings settings);
+
     /**
         Enable of Disable a group of ui components
     */
@@ -0,0 +1,128 @@
+/**
+    @file messagepool.cpp
+    @breif Slab storage for messages, recycled through a free list
+    @author Natesh Narain
+*/
+
+#include "messagepool.h"
+
+#include <stdlib.h>
+
+#define HANDLE_SLOT_BITS 20                              ///< bits of a handle holding the slot number
+#define HANDLE_SLOT_MASK ((1u << HANDLE_SLOT_BITS) - 1)   ///< slot number plus one of a handle
+#define HANDLE_GENERATION_MASK 0xFFFu                     ///< generation bits kept in a handle
+
+/**
+    Slot numbered n
+*/
+static MessageSlot* _slot(MessagePool* pool, uint32_t n)
+{
+    return &pool->slabs[n / MESSAGE_SLAB_SIZE][n % MESSAGE_SLAB_SIZE];
+}
+
+/**
+    Slot a handle owns, NULL if the handle does not match the slot any more
+*/
+static MessageSlot* _handleSlot(MessagePool* pool, MessageHandle handle)
+{
+    uint32_t n = handle & HANDLE_SLOT_MASK;
+
+    if(n == 0 || n > (uint32_t)pool->numSlabs * MESSAGE_SLAB_SIZE) return NULL;
+
+    MessageSlot* slot = _slot(pool, n - 1);
+    if(!slot->live || (slot->generation & HANDLE_GENERATION_MASK) != (handle >> HANDLE_SLOT_BITS)) return NULL;
+
+    return slot;
+}
+
+/**
+    Allocate one more slab and put its slots on the free list
+*/
+static int _grow(MessagePool* pool)
+{
+    int i;
+
+    if(pool->numSlabs >= MESSAGE_POOL_MAX_SLABS) return 0;
+
+    if(pool->numSlabs == pool->capacity){
+        int capacity = (pool->capacity > 0) ? pool->capacity * 2 : 4;
+        if(capacity > MESSAGE_POOL_MAX_SLABS) capacity = MESSAGE_POOL_MAX_SLABS;
+
+        MessageSlot** slabs = (MessageSlot**) realloc(pool->slabs, capacity * sizeof(MessageSlot*));
+        if(slabs == NULL) return 0;
+
+        pool->slabs = slabs;
+        pool->capacity = capacity;
+    }
+
+    MessageSlot* slab = (MessageSlot*) malloc(MESSAGE_SLAB_SIZE * sizeof(MessageSlot));
+    if(slab == NULL) return 0;
+
+    // chain the new slots in order ahead of whatever is still free
+    uint32_t first = (uint32_t)pool->numSlabs * MESSAGE_SLAB_SIZE;
+    for(i = 0; i < MESSAGE_SLAB_SIZE; ++i){
+        slab[i].next = (i + 1 < MESSAGE_SLAB_SIZE) ? first + i + 2 : pool->freeList;
+        slab[i].generation = 0;
+        slab[i].live = 0;
+    }
+
+    pool->slabs[pool->numSlabs++] = slab;
+    pool->freeList = first + 1;
+
+    return 1;
+}
+
+void initMessagePool(MessagePool* pool)
+{
+    pool->slabs = NULL;
+    pool->numSlabs = 0;
+    pool->capacity = 0;
+    pool->freeList = 0;
+    pool->used = 0;
+}
+
+MessageHandle allocMessage(MessagePool* pool)
+{
+    if(pool->freeList == 0 && !_grow(pool)) return MESSAGE_HANDLE_NONE;
+
+    uint32_t n = pool->freeList;
+    MessageSlot* slot = _slot(pool, n - 1);
+
+    pool->freeList = slot->next;
+    pool->used++;
+    slot->live = 1;
+
+    return ((slot->generation & HANDLE_GENERATION_MASK) << HANDLE_SLOT_BITS) | n;
+}
+
+Message* getMessage(MessagePool* pool, MessageHandle handle)
+{
+    MessageSlot* slot = _handleSlot(pool, handle);
+
+    return (slot != NULL) ? &slot->msg : NULL;
+}
+
+void releaseMessage(MessagePool* pool, MessageHandle handle)
+{
+    MessageSlot* slot = _handleSlot(pool, handle);
+    if(slot == NULL) return;
+
+    // a new generation so the released handle stops matching
+    slot->live = 0;
+    slot->generation++;
+
+    // the most recently used slot goes out next, while it is still in the cache
+    slot->next = pool->freeList;
+    pool->freeList = handle & HANDLE_SLOT_MASK;
+    pool->used--;
+}
+
+void destroyMessagePool(MessagePool* pool)
+{
+    int i;
+
+    for(i = 0; i < pool->numSlabs; ++i) free(pool->slabs[i]);
+    free(pool->slabs);
+
+    initMessagePool(pool);
+}
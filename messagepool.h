@@ -0,0 +1,115 @@
+
+/**
+    Message Pool
+
+    Fixed size storage for received messages. Messages are carved out of slabs allocated a block at a
+    time and recycled through a free list, so a burst of messages does not go to the heap one by one
+    and the slabs are only given back when the pool is destroyed.
+
+    A message is owned through its handle. Whoever holds the handle releases it, and a released handle
+    no longer finds the message even after its storage has gone to a newer one.
+
+    @author Natesh Narain
+*/
+
+#ifndef MESSAGE_POOL_H
+#define MESSAGE_POOL_H
+
+#include <stdint.h>
+
+#define MESSAGE_SLAB_SIZE 64        ///< messages allocated together
+#define MESSAGE_POOL_MAX_SLABS 16383 ///< most slabs, keeps slot numbers within a handle
+
+#define MESSAGE_HANDLE_NONE 0 ///< handle to no message
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+//! Structure of the message in the queue
+typedef struct message{
+	char msg[140];         ///< message data. Same size as a tweet...
+	uint16_t senderID;     ///< ID of the message sender
+	uint16_t receiverID;   ///< ID of the message receiver
+	uint8_t priority;      ///< Message Priority in the queue
+	uint16_t msgSeq;       ///< Message Sequence
+    uint32_t timestamp;    ///< Time stamp of the message when sent
+    uint8_t checksum;
+    uint8_t pad[4];
+}Message;
+
+//! Owns one message of a pool, slot number plus one in the low 20 bits and its generation above
+typedef uint32_t MessageHandle;
+
+//! Storage of one message
+typedef struct messageSlot{
+    Message msg;         ///< the message
+    uint32_t next;       ///< slot number plus one of the next free slot, 0 at the end of the list
+    uint16_t generation; ///< counts the times the slot was released, stale handles do not match it
+    uint8_t live;        ///< the slot is handed out
+}MessageSlot;
+
+//! Slabs of messages and the list of free slots
+typedef struct messagePool{
+    MessageSlot** slabs; ///< the slabs, MESSAGE_SLAB_SIZE slots each
+    int numSlabs;        ///< slabs allocated
+    int capacity;        ///< room in the slab array
+    uint32_t freeList;   ///< slot number plus one of the first free slot, 0 if none
+    int used;            ///< messages handed out
+}MessagePool;
+
+/**
+    Initialize the pool, no slabs are allocated until the first message
+
+    @param pool
+        The pool to initialize
+*/
+void initMessagePool(MessagePool* pool);
+
+/**
+    Take a message from the pool, the contents are left as the last owner left them
+
+    @param pool
+        The pool
+
+    @return the handle owning the message, or MESSAGE_HANDLE_NONE if no storage is left
+*/
+MessageHandle allocMessage(MessagePool* pool);
+
+/**
+    Get the message a handle owns
+
+    @param pool
+        The pool the handle came from
+
+    @param handle
+        The handle
+
+    @return the message, or NULL if the handle was released or is MESSAGE_HANDLE_NONE
+*/
+Message* getMessage(MessagePool* pool, MessageHandle handle);
+
+/**
+    Give a message back to the pool, releasing a released handle or MESSAGE_HANDLE_NONE does nothing
+
+    @param pool
+        The pool the handle came from
+
+    @param handle
+        The handle
+*/
+void releaseMessage(MessagePool* pool, MessageHandle handle);
+
+/**
+    Free every slab, handles still out no longer find their messages
+
+    @param pool
+        The pool
+*/
+void destroyMessagePool(MessagePool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
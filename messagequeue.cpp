@@ -1,111 +1,237 @@
 /**
     @file messagequeue.cpp
-    @breif FIFO implementation
+    @breif Priority queue of messages, a binary heap in one array
     @author Natesh Narain
 */
 
 #include "messagequeue.h"
 
-static void _printMessage(MessageNode* message);
-static void _deleteNode(MessageNode* node);
+#define QUEUE_INITIAL_CAPACITY 16 ///< entries allocated by the first enQueue
 
-void initQueue(MessageQueue* queue)
+static void _printMessage(Message* message);
+
+/**
+    Order in the queue, the priority then the arrival. Later arrivals have smaller keys.
+*/
+static uint64_t _key(const Message* message, uint32_t arrival)
 {
-	queue->head = queue->tail = NULL;
-	queue->size = 0;
+    return ((uint64_t)message->priority << 32) | (uint32_t)(0xFFFFFFFFu - arrival);
 }
 
-int enQueue(MessageQueue* queue, Message* message)
+/**
+    Move the entry at i up until its parent comes out before it
+*/
+static void _siftUp(MessageEntry* entries, int i)
 {
-	// create a new message node and add the message to it
-	MessageNode * node = (MessageNode *)malloc(sizeof(MessageNode));
+    MessageEntry entry = entries[i];
 
-	if (node == NULL) return FAILURE;
+    while(i > 0){
+        int parent = (i - 1) / 2;
+        if(entries[parent].key >= entry.key) break;
 
-	node->msg = message;
-	node->next = NULL;
+        entries[i] = entries[parent];
+        i = parent;
+    }
 
-	// if the queue is empty add the node to the head
-	// else add to the end of the tail
-	if (isQueueEmpty(queue)){
-		queue->head = node;
-	}
-	else{
-		queue->tail->next = node;
-	}
+    entries[i] = entry;
+}
+
+/**
+    Move the entry at i down until both children come out after it
+*/
+static void _siftDown(MessageEntry* entries, int size, int i)
+{
+    MessageEntry entry = entries[i];
+    int child;
 
-	// set the new node as the tail
-	queue->tail = node;
-	queue->size++;
+    while((child = 2 * i + 1) < size){
+        if(child + 1 < size && entries[child + 1].key > entries[child].key) child++;
+        if(entry.key >= entries[child].key) break;
 
-	return SUCCESS;
+        entries[i] = entries[child];
+        i = child;
+    }
+
+    entries[i] = entry;
 }
 
-Message* deQueue(MessageQueue* queue)
+/**
+    Take the entry at i out of the heap
+*/
+static MessageHandle _removeAt(MessageQueue* queue, int i)
 {
-	Message* ret = NULL;
-	MessageNode* node;
+    MessageHandle message = queue->entries[i].msg;
+
+    // the last entry fills the hole and moves whichever way it belongs
+    queue->size--;
+    if(i < queue->size){
+        queue->entries[i] = queue->entries[queue->size];
+        _siftDown(queue->entries, queue->size, i);
+        _siftUp(queue->entries, i);
+    }
 
-	// if the queue is empty return nothing
-	if (isQueueEmpty(queue)) return NULL; // :(
+    // arrival numbers start again once everything queued has come out
+    if(queue->size == 0) queue->arrivals = 0;
 
-	// get the current nodes message pointer
-	node = queue->head;
-	ret = node->msg;
+    return message;
+}
 
-	// set the head to the next node
-	queue->head = queue->head->next;
-	
-	// release the previous node
-	free(node);
-	queue->size--;
+/**
+    Make room for one more entry, the array doubles so queueing stays amortized constant time
+*/
+static int _reserve(MessageQueue* queue)
+{
+    if(queue->size < queue->capacity) return SUCCESS;
 
-	return ret;
+    int capacity = (queue->capacity > 0) ? queue->capacity * 2 : QUEUE_INITIAL_CAPACITY;
+    if(queue->limit != QUEUE_UNLIMITED && capacity > queue->limit) capacity = queue->limit;
+    if(capacity <= queue->size) capacity = queue->size + 1;
+
+    MessageEntry* entries = (MessageEntry*) realloc(queue->entries, capacity * sizeof(MessageEntry));
+    if(entries == NULL) return FAILURE;
+
+    queue->entries = entries;
+    queue->capacity = capacity;
+
+    return SUCCESS;
 }
 
-int isQueueEmpty(MessageQueue* queue)
+static int _compareEntries(const void* a, const void* b)
 {
-	return (queue->head == NULL);
+    uint64_t ka = ((const MessageEntry*)a)->key;
+    uint64_t kb = ((const MessageEntry*)b)->key;
+
+    // larger keys come out first
+    return (ka < kb) ? 1 : ((ka > kb) ? -1 : 0);
 }
 
-void transverse(MessageNode* node, MessageNodeFunction function)
+void initQueue(MessageQueue* queue, MessagePool* pool)
 {
-    if (node == NULL) return;
-    function(node);
-    transverse(node->next, function);
+    queue->entries = NULL;
+    queue->pool = pool;
+    queue->size = 0;
+    queue->capacity = 0;
+    queue->limit = QUEUE_UNLIMITED;
+    queue->arrivals = 0;
 }
 
-void transverseR(MessageNode* node, MessageNodeFunction function)
+void setQueueLimit(MessageQueue* queue, int limit)
 {
-    if (node == NULL) return;
-    transverseR(node->next, function);
-    function(node);
+    queue->limit = (limit > 0) ? limit : QUEUE_UNLIMITED;
 }
 
-void printMessages(MessageQueue* queue, BOOL reversed)
+int enQueue(MessageQueue* queue, MessageHandle handle)
+{
+    const Message* message = getMessage(queue->pool, handle);
+    if(message == NULL) return FAILURE;
+
+    if(queue->limit != QUEUE_UNLIMITED && queue->size >= queue->limit){
+        // the oldest of the lowest priority messages, only ever one below the new message, the
+        // priorities read from the keys rather than the pool
+        uint32_t priority = message->priority;
+        uint32_t lowest = priority;
+        int victim = -1;
+        int i;
+
+        for(i = 0; i < queue->size; ++i){
+            uint64_t key = queue->entries[i].key;
+            uint32_t entryPriority = (uint32_t)(key >> 32);
+            if(entryPriority >= priority) continue;
+
+            if(victim < 0 || entryPriority < lowest || (entryPriority == lowest && key > queue->entries[victim].key)){
+                victim = i;
+                lowest = entryPriority;
+            }
+        }
+
+        if(victim < 0) return FAILURE;
+
+        releaseMessage(queue->pool, _removeAt(queue, victim));
+    }
+
+    if(_reserve(queue) != SUCCESS) return FAILURE;
+
+    MessageEntry* entry = &queue->entries[queue->size];
+    entry->msg = handle;
+    entry->key = _key(message, queue->arrivals++);
+
+    _siftUp(queue->entries, queue->size);
+    queue->size++;
+
+    return SUCCESS;
+}
+
+MessageHandle deQueue(MessageQueue* queue)
+{
+    // if the queue is empty return nothing
+    if (isQueueEmpty(queue)) return MESSAGE_HANDLE_NONE; // :(
+
+    return _removeAt(queue, 0);
+}
+
+int drainQueue(MessageQueue* queue, MessageFunction function)
 {
+    int drained = 0;
+    MessageHandle message;
+
+    while((message = deQueue(queue)) != MESSAGE_HANDLE_NONE){
+        function(getMessage(queue->pool, message));
+        releaseMessage(queue->pool, message);
+        drained++;
+    }
+
+    return drained;
+}
+
+int isQueueEmpty(MessageQueue* queue)
+{
+    return (queue->size == 0);
+}
+
+void transverse(MessageQueue* queue, MessageFunction function, BOOL reversed)
+{
+    int i;
+
+    if (isQueueEmpty(queue)) return;
+
+    // the heap is only partly ordered, a sorted copy gives the order the messages come out in
+    MessageEntry* sorted = (MessageEntry*) malloc(queue->size * sizeof(MessageEntry));
+    if (sorted == NULL) return;
+
+    memcpy(sorted, queue->entries, queue->size * sizeof(MessageEntry));
+    qsort(sorted, queue->size, sizeof(MessageEntry), _compareEntries);
+
     if (reversed){
-        transverse(queue->head, _printMessage);
+        for(i = queue->size - 1; i >= 0; --i) function(getMessage(queue->pool, sorted[i].msg));
     }
     else{
-        transverseR(queue->head, _printMessage);
+        for(i = 0; i < queue->size; ++i) function(getMessage(queue->pool, sorted[i].msg));
     }
+
+    free(sorted);
 }
 
-static void _printMessage(MessageNode* node)
+void printMessages(MessageQueue* queue, BOOL reversed)
 {
-    printf("\n%s\n", node->msg->msg);
+    transverse(queue, _printMessage, reversed);
 }
 
-void deleteQueue(MessageQueue* queue)
+static void _printMessage(Message* message)
 {
-    transverseR(queue->head, _deleteNode);
+    printf("\n%s\n", message->msg);
 }
 
-static void _deleteNode(MessageNode* node)
+void deleteQueue(MessageQueue* queue)
 {
-    free(node->msg);
-    free(node);
+    int limit = queue->limit;
+    int i;
+
+    // heap order does not matter when everything goes
+    for(i = 0; i < queue->size; ++i) releaseMessage(queue->pool, queue->entries[i].msg);
+
+    free(queue->entries);
+    initQueue(queue, queue->pool);
+    queue->limit = limit;
 }
 
 int getMessageFromFile(char szBuf[], int iLen)
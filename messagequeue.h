@@ -2,7 +2,8 @@
 /**
 	Message Queue
 
-	Define a FIFO queue for managing a set of messages
+	Define a priority queue for managing a set of messages. Higher priority messages come out first,
+	messages of equal priority in the order they were queued.
 
 	@author Natesh Narain
 */
@@ -15,6 +16,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "messagepool.h"
+
 #define BUFFER_MAX 140 ///< Maximum length of a buffer
 
 #define MESSAGE_DELIMITER "%%"
@@ -22,37 +25,30 @@
 #define SUCCESS 0 ///< :)
 #define FAILURE 1 ///< :(
 
+#define QUEUE_UNLIMITED 0 ///< no limit on the messages queued
+
 #ifdef __cplusplus
 extern "C"{
 #endif
 
-//! Structure of the message in the queue
-typedef struct message{
-	char msg[140];         ///< message data. Same size as a tweet...
-	uint16_t senderID;     ///< ID of the message sender
-	uint16_t receiverID;   ///< ID of the message receiver
-	uint8_t priority;      ///< Message Priority in the queue
-	uint16_t msgSeq;       ///< Message Sequence
-    uint32_t timestamp;    ///< Time stamp of the message when sent
-    uint8_t checksum;
-    uint8_t pad[4];
-}Message;
-
-//! Linked List of Messages
-typedef struct messageNode{
-	struct messageNode* next; ///< Next message
-	Message* msg;			  ///< Pointer to Message payload
-}MessageNode;
-
-//! FIFO queue containing the head and tail of the corresponding linked list
+//! Queued message with its place in the queue
+typedef struct messageEntry{
+    uint64_t key;  ///< priority in the upper half, arrival order inverted in the lower, larger keys come out first
+    MessageHandle msg; ///< the queued message, owned by the queue
+}MessageEntry;
+
+//! Priority queue kept as a binary heap in one array, the next message at the top
 typedef struct {
-	MessageNode* head; ///< The next node in the queue
-	MessageNode* tail; ///< The last node in the queue
-	int size;          ///< The number of messages in the queue
+    MessageEntry* entries; ///< the heap
+    MessagePool* pool;     ///< storage of the queued messages
+    int size;              ///< The number of messages in the queue
+    int capacity;          ///< entries allocated
+    int limit;             ///< most messages queued, QUEUE_UNLIMITED for no limit
+    uint32_t arrivals;     ///< messages queued since the queue was last empty
 }MessageQueue;
 
-//!
-typedef void(*MessageNodeFunction)(MessageNode*);
+//! Function applied to messages in the queue, the message stays with the queue
+typedef void(*MessageFunction)(Message*);
 
 //! boolean
 #ifndef __cplusplus
@@ -79,27 +75,61 @@ int getMessageFromFile(char szBuf[], int iLen);
 
 	@param queue
 		The queue to initialize
+
+	@param pool
+		The pool the queued messages come from, released back to it when deleted
+*/
+void initQueue(MessageQueue* queue, MessagePool* pool);
+
+/**
+    Limit the number of messages queued
+
+    @param queue
+        The queue
+
+    @param limit
+        most messages held, QUEUE_UNLIMITED for no limit
 */
-void initQueue(MessageQueue* queue);
+void setQueueLimit(MessageQueue* queue, int limit);
 
 /**
-	Add to the Queue
+	Add to the Queue. The queue owns the message until it is taken out.
+
+	When the queue is full the oldest of the lowest priority messages is deleted to make room, as long
+	as its priority is below the new message's.
 
 	@param queue
 		The queue to add the message to
 
 	@param msg
-		The message to add to the queue
+		Handle to the message to add, from the queue's pool
+
+	@return SUCCESS, or FAILURE if the message was not queued and still belongs to the caller
 */
-int enQueue(MessageQueue* queue, Message* msg);
+int enQueue(MessageQueue* queue, MessageHandle msg);
 
 /**
-	Get next message from the queue
+	Get next message from the queue, the highest priority and the oldest of those
 
 	@param queue
 		The queue
+
+	@return handle to the message, owned by the caller, or MESSAGE_HANDLE_NONE if the queue is empty
 */
-Message* deQueue(MessageQueue* queue);
+MessageHandle deQueue(MessageQueue* queue);
+
+/**
+    Take every message out of the queue in order and release it
+
+    @param queue
+        The queue
+
+    @param function
+        function handed each message before it is released
+
+    @return the number of messages drained
+*/
+int drainQueue(MessageQueue* queue, MessageFunction function);
 
 /**
 	Check if the given queue is empty
@@ -110,29 +140,22 @@ Message* deQueue(MessageQueue* queue);
 int isQueueEmpty(MessageQueue* queue);
 
 /**
-    Recursively tranverse the linked link from a startign node. Top to bottom
+    Apply a function to the messages in the queue in the order they will come out, the queue keeps
+    the messages
 
-    @param node
-        starting node
+    @param queue
+        The queue
 
     @param function
-        function to apply to all nodes
-*/
-void transverse(MessageNode* node, MessageNodeFunction function);
-
-/**
-    Recursively tranverse the linked link from a starting node. Bottom to Top
+        function to apply to all messages
 
-    @param node
-        starting node
-
-    @param function
-        function to apply to all nodes
+    @param reversed
+        start from the last message to come out
 */
-void tranverseR(MessageNode *node, MessageNodeFunction function);
+void transverse(MessageQueue* queue, MessageFunction function, BOOL reversed);
 
 /**
-    Recursively print the messages in the queue
+    Print the messages in the queue
 
     @param queue
         The queue to print
@@ -143,7 +166,8 @@ void tranverseR(MessageNode *node, MessageNodeFunction function);
 void printMessages(MessageQueue* queue, BOOL reversed);
 
 /**
-    Delete the content of the queue, recursively
+    Release every message in the queue to the pool and free the queue's storage, the queue is left
+    empty
 
     @param queue
         The queue
@@ -0,0 +1,372 @@
+
+/**
+    @file noisesuppressor.cpp
+    @breif Spectral noise suppression of captured audio
+    @author Natesh Narain
+*/
+
+#include "noisesuppressor.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define NS_FRAME_MS          16      ///< frame length, rounded up to a power of two of samples
+#define NS_POWER_SMOOTH      0.7f    ///< smoothing of the power per bin the noise is tracked on
+#define NS_NOISE_RISE_DB     5.0     ///< dB per second the noise estimate can grow
+#define NS_LEARN_MS          100     ///< capture the noise is averaged over before it is tracked
+#define NS_NOISE_BIAS        1.5f    ///< the minimum of the smoothed power sits below the mean noise power
+#define NS_DECISION_DIRECTED 0.98f   ///< weight of the previous frame in the speech to noise ratio
+#define NS_MIN_NOISE         1.0f    ///< keeps the ratios finite in digital silence
+#define NS_MAX_LEVEL         32767.0f ///< largest sample on the 16 bit scale
+#define NS_MIN_LEVEL        -32768.0f ///< smallest sample on the 16 bit scale
+
+static inline float _linear(uint8_t sample){ return (sample - 0x80) * 256.0f; }
+static inline float _linear(int16_t sample){ return sample; }
+static inline float _linear(float sample){ return sample * 32768.0f; }
+
+static inline float _saturate(float x)
+{
+    return (x > NS_MAX_LEVEL) ? NS_MAX_LEVEL : ((x < NS_MIN_LEVEL) ? NS_MIN_LEVEL : x);
+}
+
+template<typename T>
+static void _toLinear(const T* in, float* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = _linear(in[i]);
+}
+
+static void _fromLinear(const float* in, uint8_t* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = (uint8_t)(((int)lrintf(_saturate(in[i])) >> 8) + 0x80);
+}
+
+static void _fromLinear(const float* in, int16_t* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = (int16_t)lrintf(_saturate(in[i]));
+}
+
+static void _fromLinear(const float* in, float* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = _saturate(in[i]) / 32768.0f;
+}
+
+/**
+    Power of a spectrum in each bin, smoothed into smooth. The noise follows the smoothed power down
+    at once and up by at most rise.
+*/
+static void _trackNoise(float* power, float* smooth, float* noise, const float* re, const float* im, float rise, int n)
+{
+    const float gain = 1.0f - NS_POWER_SMOOTH;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vSmooth = _mm_set1_ps(NS_POWER_SMOOTH);
+    const __m128 vGain = _mm_set1_ps(gain);
+    const __m128 vRise = _mm_set1_ps(rise);
+
+    for(; i + 4 <= n; i += 4){
+        __m128 r = _mm_loadu_ps(re + i), m = _mm_loadu_ps(im + i);
+        __m128 p = _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m));
+        __m128 s = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(smooth + i), vSmooth), _mm_mul_ps(p, vGain));
+
+        _mm_storeu_ps(power + i, p);
+        _mm_storeu_ps(smooth + i, s);
+        _mm_storeu_ps(noise + i, _mm_min_ps(s, _mm_mul_ps(_mm_loadu_ps(noise + i), vRise)));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t r = vld1q_f32(re + i), m = vld1q_f32(im + i);
+        float32x4_t p = vmlaq_f32(vmulq_f32(r, r), m, m);
+        float32x4_t s = vmlaq_n_f32(vmulq_n_f32(vld1q_f32(smooth + i), NS_POWER_SMOOTH), p, gain);
+
+        vst1q_f32(power + i, p);
+        vst1q_f32(smooth + i, s);
+        vst1q_f32(noise + i, vminq_f32(s, vmulq_n_f32(vld1q_f32(noise + i), rise)));
+    }
+#endif
+
+    for(; i < n; ++i){
+        power[i] = re[i] * re[i] + im[i] * im[i];
+        smooth[i] = smooth[i] * NS_POWER_SMOOTH + power[i] * gain;
+
+        float grown = noise[i] * rise;
+        noise[i] = (smooth[i] < grown) ? smooth[i] : grown;
+    }
+}
+
+/**
+    Wiener gain of each bin from the decision directed speech to noise ratio, no lower than floor.
+    clean is the speech power left in the previous frame and is replaced by that of this frame.
+*/
+static void _wienerGain(float* gain, float* clean, const float* power, const float* noise, float floor, int n)
+{
+    const float dd = NS_DECISION_DIRECTED;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vDd = _mm_set1_ps(dd);
+    const __m128 vNew = _mm_set1_ps(1.0f - dd);
+    const __m128 vOne = _mm_set1_ps(1.0f);
+    const __m128 vBias = _mm_set1_ps(NS_NOISE_BIAS);
+    const __m128 vMin = _mm_set1_ps(NS_MIN_NOISE);
+    const __m128 vFloor = _mm_set1_ps(floor);
+    const __m128 vZero = _mm_setzero_ps();
+
+    for(; i + 4 <= n; i += 4){
+        __m128 p = _mm_loadu_ps(power + i);
+        __m128 inv = _mm_div_ps(vOne, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(noise + i), vBias), vMin));
+        __m128 post = _mm_max_ps(_mm_sub_ps(_mm_mul_ps(p, inv), vOne), vZero);
+        __m128 prio = _mm_add_ps(_mm_mul_ps(vDd, _mm_mul_ps(_mm_loadu_ps(clean + i), inv)), _mm_mul_ps(vNew, post));
+        __m128 g = _mm_max_ps(_mm_div_ps(prio, _mm_add_ps(vOne, prio)), vFloor);
+
+        _mm_storeu_ps(gain + i, g);
+        _mm_storeu_ps(clean + i, _mm_mul_ps(_mm_mul_ps(g, g), p));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t p = vld1q_f32(power + i);
+        float32x4_t d = vmlaq_n_f32(vdupq_n_f32(NS_MIN_NOISE), vld1q_f32(noise + i), NS_NOISE_BIAS);
+
+        // reciprocal estimate refined by two Newton steps
+        float32x4_t inv = vrecpeq_f32(d);
+        inv = vmulq_f32(vrecpsq_f32(d, inv), inv);
+        inv = vmulq_f32(vrecpsq_f32(d, inv), inv);
+
+        float32x4_t post = vmaxq_f32(vsubq_f32(vmulq_f32(p, inv), vdupq_n_f32(1.0f)), vdupq_n_f32(0));
+        float32x4_t prio = vmlaq_n_f32(vmulq_n_f32(vmulq_f32(vld1q_f32(clean + i), inv), dd), post, 1.0f - dd);
+
+        float32x4_t den = vaddq_f32(prio, vdupq_n_f32(1.0f));
+        float32x4_t r = vrecpeq_f32(den);
+        r = vmulq_f32(vrecpsq_f32(den, r), r);
+        r = vmulq_f32(vrecpsq_f32(den, r), r);
+
+        float32x4_t g = vmaxq_f32(vmulq_f32(prio, r), vdupq_n_f32(floor));
+
+        vst1q_f32(gain + i, g);
+        vst1q_f32(clean + i, vmulq_f32(vmulq_f32(g, g), p));
+    }
+#endif
+
+    for(; i < n; ++i){
+        float inv = 1.0f / (noise[i] * NS_NOISE_BIAS + NS_MIN_NOISE);
+        float post = power[i] * inv - 1.0f;
+        float prio = dd * clean[i] * inv + (1.0f - dd) * ((post > 0) ? post : 0);
+        float g = prio / (1.0f + prio);
+
+        if(g < floor) g = floor;
+
+        gain[i] = g;
+        clean[i] = g * g * power[i];
+    }
+}
+
+/**
+    Scale each bin of a spectrum by its gain
+*/
+static void _applyGain(float* re, float* im, const float* gain, int n)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    for(; i + 4 <= n; i += 4){
+        __m128 g = _mm_loadu_ps(gain + i);
+
+        _mm_storeu_ps(re + i, _mm_mul_ps(_mm_loadu_ps(re + i), g));
+        _mm_storeu_ps(im + i, _mm_mul_ps(_mm_loadu_ps(im + i), g));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= n; i += 4){
+        float32x4_t g = vld1q_f32(gain + i);
+
+        vst1q_f32(re + i, vmulq_f32(vld1q_f32(re + i), g));
+        vst1q_f32(im + i, vmulq_f32(vld1q_f32(im + i), g));
+    }
+#endif
+
+    for(; i < n; ++i){
+        re[i] *= gain[i];
+        im[i] *= gain[i];
+    }
+}
+
+NoiseSuppressor::NoiseSuppressor()
+{
+    _floor = 0.25f;
+
+    setFormat(8, 1, 8000);
+}
+
+void NoiseSuppressor::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    _sampleSize = sampleSize;
+    _channels = (channels > 0) ? channels : 1;
+    if(sampleRate <= 0) sampleRate = 8000;
+
+    int samples = sampleRate * NS_FRAME_MS / 1000;
+    _frameSize = 8;
+    while(_frameSize < samples) _frameSize <<= 1;
+
+    _hop = _frameSize / 2;
+    _bins = _frameSize / 2 + 1;
+    _rise = (float)pow(10.0, NS_NOISE_RISE_DB / 10.0 * _hop / sampleRate);
+    _startFrames = sampleRate * NS_LEARN_MS / (1000 * _hop) + 1;
+
+    _fft.setSize(_frameSize);
+
+    // periodic, so the squares of the windows of overlapping frames add up to one
+    _window.resize(_frameSize);
+    int i;
+    for(i = 0; i < _frameSize; ++i) _window[i] = (float)sin(M_PI * i / _frameSize);
+
+    _frame.resize(_frameSize * _channels);
+    _overlap.resize(_hop * _channels);
+    _time.resize(_frameSize);
+    _re.resize(_bins);
+    _im.resize(_bins);
+    _power.resize(_bins);
+    _smooth.resize(_bins);
+    _noise.resize(_bins);
+    _clean.resize(_bins);
+    _gain.resize(_bins);
+
+    reset();
+}
+
+void NoiseSuppressor::setLevel(int db)
+{
+    if(db < 0) db = 0;
+    _floor = (float)pow(10.0, -db / 20.0);
+}
+
+void NoiseSuppressor::reset()
+{
+    _nearFrames = 0;
+
+    // the first hop out and the silence the first frame finishes are the delay of the suppressor
+    _out.fill(0, _hop * _channels);
+    _outFrames = _hop;
+
+    _frame.fill(0);
+    _overlap.fill(0);
+    _smooth.fill(0);
+    _noise.fill(0);
+    _clean.fill(0);
+    _frames = 0;
+}
+
+void NoiseSuppressor::process(QByteArray& pcm)
+{
+    const int sampleBytes = _sampleSize / 8;
+    const int numFrames = pcm.size() / (sampleBytes * _channels);
+    const int numSamples = numFrames * _channels;
+
+    if(numFrames == 0) return;
+
+    if(_near.size() < (_nearFrames + numFrames) * _channels) _near.resize((_nearFrames + numFrames) * _channels);
+
+    float* near = _near.data() + _nearFrames * _channels;
+
+    if(_sampleSize == 32)
+        _toLinear((const float*)pcm.constData(), near, numSamples);
+    else if(_sampleSize == 16)
+        _toLinear((const int16_t*)pcm.constData(), near, numSamples);
+    else
+        _toLinear((const uint8_t*)pcm.constData(), near, numSamples);
+
+    _nearFrames += numFrames;
+
+    // processHop works on the front of _near
+    while(_nearFrames >= _hop){
+        processHop();
+
+        _nearFrames -= _hop;
+        memmove(_near.data(), _near.data() + _hop * _channels, _nearFrames * _channels * sizeof(float));
+    }
+
+    // a hop is only finished by the frame after it, the hop of delay on top keeps a whole hop ready
+    if(_sampleSize == 32)
+        _fromLinear(_out.constData(), (float*)pcm.data(), numSamples);
+    else if(_sampleSize == 16)
+        _fromLinear(_out.constData(), (int16_t*)pcm.data(), numSamples);
+    else
+        _fromLinear(_out.constData(), (uint8_t*)pcm.data(), numSamples);
+
+    _outFrames -= numFrames;
+    memmove(_out.data(), _out.data() + numSamples, _outFrames * _channels * sizeof(float));
+}
+
+void NoiseSuppressor::processHop()
+{
+    const int n = _frameSize;
+    const int h = _hop;
+    const float* near = _near.constData();
+    const float* window = _window.constData();
+    float* time = _time.data();
+    float* re = _re.data();
+    float* im = _im.data();
+    int i, c;
+
+    // each channel's frame moves on by a hop
+    for(c = 0; c < _channels; ++c){
+        float* frame = _frame.data() + c * n;
+
+        memmove(frame, frame + h, h * sizeof(float));
+        for(i = 0; i < h; ++i) frame[h + i] = near[i * _channels + c];
+    }
+
+    // the gain comes from the mono mix
+    const float* frame = _frame.constData();
+    for(i = 0; i < n; ++i){
+        float sum = 0;
+        for(c = 0; c < _channels; ++c) sum += frame[c * n + i];
+        time[i] = sum / _channels * window[i];
+    }
+
+    _fft.forward(time, re, im);
+    _frames++;
+
+    if(_frames <= _startFrames){
+        // until enough has been heard to take a minimum, the noise is the average power
+        for(i = 0; i < _bins; ++i){
+            _power[i] = re[i] * re[i] + im[i] * im[i];
+            _smooth[i] += (_power[i] - _smooth[i]) / _frames;
+            _noise[i] = _smooth[i];
+        }
+    }
+    else{
+        _trackNoise(_power.data(), _smooth.data(), _noise.data(), re, im, _rise, _bins);
+    }
+
+    _wienerGain(_gain.data(), _clean.data(), _power.constData(), _noise.constData(), _floor, _bins);
+
+    if(_out.size() < (_outFrames + h) * _channels) _out.resize((_outFrames + h) * _channels);
+    float* out = _out.data() + _outFrames * _channels;
+
+    for(c = 0; c < _channels; ++c){
+        // a single channel is the mono mix, already transformed
+        if(_channels > 1){
+            for(i = 0; i < n; ++i) time[i] = frame[c * n + i] * window[i];
+            _fft.forward(time, re, im);
+        }
+
+        _applyGain(re, im, _gain.constData(), _bins);
+        _fft.inverse(re, im, time);
+
+        // the first half completes the previous frame, the second half waits for the next
+        float* overlap = _overlap.data() + c * h;
+        for(i = 0; i < h; ++i) out[i * _channels + c] = overlap[i] + time[i] * window[i];
+        for(i = 0; i < h; ++i) overlap[i] = time[h + i] * window[h + i];
+    }
+
+    _outFrames += h;
+}
@@ -0,0 +1,124 @@
+#ifndef NOISESUPPRESSOR_H
+#define NOISESUPPRESSOR_H
+
+#include <cstdint>
+
+#include <QByteArray>
+#include <QVector>
+
+#include "fft.h"
+
+/**
+    Removes steady background noise from captured audio
+
+    Audio is cut into frames overlapping by half, each windowed with a square root Hann window,
+    transformed, scaled bin by bin and added back together with the same window. The noise power of
+    each bin follows the minimum of the smoothed power, so it keeps up with the background while
+    someone talks over it. The gain of each bin is a Wiener gain on a decision directed estimate of the
+    speech to noise ratio, which keeps the residual noise from warbling, and never drops below the
+    floor set by the suppression level.
+
+    The gain is worked out on the mono mix and applied to every channel. Captured audio is delayed by
+    one frame, about 16 ms.
+*/
+class NoiseSuppressor
+{
+public:
+    NoiseSuppressor(void);
+
+    /**
+        Set the format of the captured audio
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Set how far the noise is brought down
+
+        @param db
+            most attenuation of a frequency bin in dB
+    */
+    void setLevel(int db);
+
+    /**
+        Forget the noise measured and the audio held back, used when capture starts
+    */
+    void reset();
+
+    /**
+        Remove the noise from captured audio
+
+        @param pcm
+            captured audio in the set format, whole sample frames, replaced by the audio with the noise
+            removed
+    */
+    void process(QByteArray& pcm);
+
+private:
+    //! bits per sample
+    int _sampleSize;
+    //! interleaved channels
+    int _channels;
+    //! samples per frame, a power of two
+    int _frameSize;
+    //! samples between frames, half a frame
+    int _hop;
+    //! frequency bins of a frame
+    int _bins;
+    //! least gain of a bin
+    float _floor;
+    //! growth of the noise estimate per frame while the power stays above it
+    float _rise;
+    //! frames over which the noise estimate follows the power from the start of capture
+    int _startFrames;
+
+    //! captured sample frames waiting for a whole hop, on the 16 bit scale
+    QVector<float> _near;
+    //! sample frames in _near
+    int _nearFrames;
+    //! sample frames with the noise removed, waiting to be returned
+    QVector<float> _out;
+    //! sample frames in _out
+    int _outFrames;
+
+    //! transforms of a frame
+    RealFFT _fft;
+    //! square root Hann window
+    QVector<float> _window;
+    //! the last frame of input of each channel
+    QVector<float> _frame;
+    //! second half of the previous output frame of each channel, waiting for the next frame
+    QVector<float> _overlap;
+    //! time domain working buffer of one frame
+    QVector<float> _time;
+    //! spectrum of a frame
+    QVector<float> _re;
+    QVector<float> _im;
+    //! power of the mono mix in each bin
+    QVector<float> _power;
+    //! smoothed power in each bin
+    QVector<float> _smooth;
+    //! noise power in each bin
+    QVector<float> _noise;
+    //! speech power left in each bin of the previous frame
+    QVector<float> _clean;
+    //! gain of each bin
+    QVector<float> _gain;
+    //! frames processed since reset
+    int _frames;
+
+    /**
+        Remove the noise from one hop of _near and append the finished hop to _out
+    */
+    void processHop();
+};
+
+#endif // NOISESUPPRESSOR_H
@@ -0,0 +1,292 @@
+
+/**
+    @file plc.cpp
+    @breif Packet loss concealment for received streams
+    @author Natesh Narain
+*/
+
+#include "plc.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "vad.h"
+
+#define PLC_HISTORY_MS    48   ///< played audio kept for concealment, three of the longest pitch periods
+#define PLC_MIN_PITCH_HZ  62.5 ///< lowest pitch searched
+#define PLC_MAX_PITCH_HZ  400  ///< highest pitch searched
+#define PLC_HOLD_MS       10   ///< concealment played at full level
+#define PLC_FADE_MS       50   ///< fade from repetition to comfort noise after the hold
+#define PLC_PERIOD_MS     10   ///< gap length after which another pitch period is repeated
+#define PLC_MAX_PERIODS   3    ///< most pitch periods repeated
+#define PLC_MERGE_MS      4    ///< cross fade when audio resumes
+#define PLC_NOISE_RISE    0.01f ///< background level tracking rate
+#define PLC_NOISE_MAX     300.0f ///< loudest comfort noise, louder audio is speech rather than background
+
+template<typename T>
+static void _tofloat(const T* in, float* out, int numSamples);
+
+template<>
+void _tofloat<uint8_t>(const uint8_t* in, float* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = (in[i] - 0x80) * 256.0f;
+}
+
+template<>
+void _tofloat<int16_t>(const int16_t* in, float* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = in[i];
+}
+
+template<>
+void _tofloat<float>(const float* in, float* out, int numSamples)
+{
+    int i;
+    for(i = 0; i < numSamples; ++i) out[i] = in[i] * 32768.0f;
+}
+
+static inline float _clip16(float x)
+{
+    return (x > 32767.0f) ? 32767.0f : ((x < -32768.0f) ? -32768.0f : x);
+}
+
+LossConcealer::LossConcealer()
+{
+    _noiseSeed = 1;
+    setFormat(8, 1, 8000);
+}
+
+void LossConcealer::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    _sampleSize = sampleSize;
+    _channels = (channels > 0) ? channels : 1;
+    _sampleRate = (sampleRate > 0) ? sampleRate : 8000;
+
+    _history.resize(msToFrames(PLC_HISTORY_MS) * _channels);
+
+    reset();
+}
+
+void LossConcealer::reset()
+{
+    _history.fill(0);
+    _historyFrames = 0;
+    _pitch = 0;
+    _erasedFrames = 0;
+    _phase = 0;
+    _noiseLevel = 0;
+}
+
+void LossConcealer::process(QByteArray& pcm)
+{
+    const int numFrames = pcm.size() / ((_sampleSize / 8) * _channels);
+    const int numSamples = numFrames * _channels;
+    if(numFrames == 0) return;
+
+    if(_scratch.size() < numSamples) _scratch.resize(numSamples);
+    float* samples = _scratch.data();
+    toFloat(pcm.constData(), samples, numSamples);
+
+    // ends a gap, fade from the concealment into the received audio
+    if(_erasedFrames > 0){
+        int mergeFrames = msToFrames(PLC_MERGE_MS);
+        if(mergeFrames > numFrames) mergeFrames = numFrames;
+
+        if(_synthetic.size() < mergeFrames * _channels) _synthetic.resize(mergeFrames * _channels);
+        float* synthetic = _synthetic.data();
+        synthesize(synthetic, mergeFrames);
+
+        int i, c;
+        for(i = 0; i < mergeFrames; ++i){
+            float w = (float)(i + 1) / (mergeFrames + 1);
+
+            for(c = 0; c < _channels; ++c){
+                int k = i * _channels + c;
+                samples[k] = w * samples[k] + (1.0f - w) * synthetic[k];
+            }
+        }
+
+        fromFloat(samples, pcm.data(), mergeFrames * _channels);
+        _erasedFrames = 0;
+    }
+
+    // follow the background level, drops immediately and rises slowly
+    double sum = 0;
+    int i;
+    for(i = 0; i < numSamples; ++i) sum += (double)samples[i] * samples[i];
+
+    float rms = (float)sqrt(sum / numSamples);
+    if(rms < _noiseLevel || _historyFrames == 0)
+        _noiseLevel = rms;
+    else
+        _noiseLevel += (rms - _noiseLevel) * PLC_NOISE_RISE;
+
+    if(_noiseLevel > PLC_NOISE_MAX) _noiseLevel = PLC_NOISE_MAX;
+
+    addHistory(samples, numFrames);
+}
+
+void LossConcealer::conceal(char* out, int numFrames)
+{
+    const int numSamples = numFrames * _channels;
+    if(numSamples <= 0) return;
+
+    if(_synthetic.size() < numSamples) _synthetic.resize(numSamples);
+    float* samples = _synthetic.data();
+
+    synthesize(samples, numFrames);
+    fromFloat(samples, out, numSamples);
+}
+
+void LossConcealer::synthesize(float* out, int numFrames)
+{
+    const int historyLen = _history.size() / _channels;
+    const int holdFrames = msToFrames(PLC_HOLD_MS);
+    const int fadeFrames = msToFrames(PLC_FADE_MS);
+    const int periodFrames = msToFrames(PLC_PERIOD_MS);
+    const float* history = _history.constData();
+
+    // start of a gap
+    if(_erasedFrames == 0){
+        _pitch = estimatePitch();
+        _phase = 0;
+    }
+
+    if(_noise.size() < numFrames * _channels) _noise.resize(numFrames * _channels);
+    int16_t* noise = _noise.data();
+    VoiceActivityDetector::comfortNoise(noise, numFrames * _channels, (uint16_t)_noiseLevel, &_noiseSeed);
+
+    int i, c;
+    for(i = 0; i < numFrames; ++i){
+        int t = _erasedFrames + i;
+
+        // repeat more periods as the gap grows, as far as the history allows
+        int periods = 1 + t / (periodFrames > 0 ? periodFrames : 1);
+        if(periods > PLC_MAX_PERIODS) periods = PLC_MAX_PERIODS;
+        while(periods > 1 && periods * _pitch > _historyFrames) periods--;
+
+        int span = periods * _pitch;
+
+        float gain;
+        if(t < holdFrames)
+            gain = 1.0f;
+        else if(t < holdFrames + fadeFrames)
+            gain = 1.0f - (float)(t - holdFrames) / fadeFrames;
+        else
+            gain = 0;
+
+        // the history holds the most recent audio at its end
+        int frame = historyLen - span + ((_phase + i) % (span > 0 ? span : 1));
+
+        for(c = 0; c < _channels; ++c){
+            float repeated = (span > 0 && _historyFrames > 0) ? history[frame * _channels + c] : 0;
+            out[i * _channels + c] = gain * repeated + (1.0f - gain) * noise[i * _channels + c];
+        }
+    }
+
+    _phase += numFrames;
+    _erasedFrames += numFrames;
+}
+
+void LossConcealer::addHistory(const float* samples, int numFrames)
+{
+    const int historyLen = _history.size() / _channels;
+    float* history = _history.data();
+
+    if(numFrames >= historyLen){
+        memcpy(history, samples + (numFrames - historyLen) * _channels, historyLen * _channels * sizeof(float));
+    }
+    else{
+        int keep = historyLen - numFrames;
+        memmove(history, history + numFrames * _channels, keep * _channels * sizeof(float));
+        memcpy(history + keep * _channels, samples, numFrames * _channels * sizeof(float));
+    }
+
+    _historyFrames += numFrames;
+    if(_historyFrames > historyLen) _historyFrames = historyLen;
+}
+
+int LossConcealer::estimatePitch() const
+{
+    const int historyLen = _history.size() / _channels;
+    const float* history = _history.constData();
+
+    int minPeriod = (int)(_sampleRate / PLC_MAX_PITCH_HZ);
+    int maxPeriod = (int)(_sampleRate / PLC_MIN_PITCH_HZ);
+    if(minPeriod < 1) minPeriod = 1;
+
+    // compare the last window with the audio one period earlier
+    int window = maxPeriod;
+    if(window + maxPeriod > _historyFrames){
+        maxPeriod = _historyFrames / 2;
+        window = maxPeriod;
+    }
+
+    if(maxPeriod < minPeriod) return (_historyFrames > 0) ? _historyFrames : 1;
+
+    const int start = historyLen - window;
+    int best = minPeriod;
+    double bestScore = -1;
+    int p, i, c;
+
+    for(p = minPeriod; p <= maxPeriod; ++p){
+        double cross = 0;
+        double energy = 0;
+
+        for(i = 0; i < window; ++i){
+            for(c = 0; c < _channels; ++c){
+                double lagged = history[(start + i - p) * _channels + c];
+                cross += history[(start + i) * _channels + c] * lagged;
+                energy += lagged * lagged;
+            }
+        }
+
+        double score = (energy > 0) ? cross / sqrt(energy) : 0;
+        if(score > bestScore){
+            bestScore = score;
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+void LossConcealer::toFloat(const char* in, float* out, int numSamples) const
+{
+    if(_sampleSize == 32)
+        _tofloat((const float*)in, out, numSamples);
+    else if(_sampleSize == 16)
+        _tofloat((const int16_t*)in, out, numSamples);
+    else
+        _tofloat((const uint8_t*)in, out, numSamples);
+}
+
+void LossConcealer::fromFloat(const float* in, char* out, int numSamples) const
+{
+    int i;
+
+    if(_sampleSize == 32){
+        float* samples = (float*)out;
+        for(i = 0; i < numSamples; ++i) samples[i] = _clip16(in[i]) / 32768.0f;
+    }
+    else if(_sampleSize == 16){
+        int16_t* samples = (int16_t*)out;
+        for(i = 0; i < numSamples; ++i) samples[i] = (int16_t)lrintf(_clip16(in[i]));
+    }
+    else{
+        uint8_t* samples = (uint8_t*)out;
+        for(i = 0; i < numSamples; ++i) samples[i] = (uint8_t)(((int)lrintf(_clip16(in[i])) >> 8) + 0x80);
+    }
+}
+
+int LossConcealer::getConcealedFrames() const
+{
+    return _erasedFrames;
+}
+
+int LossConcealer::msToFrames(int ms) const
+{
+    return (_sampleRate * ms) / 1000;
+}
@@ -0,0 +1,125 @@
+#ifndef PLC_H
+#define PLC_H
+
+#include <cstdint>
+
+#include <QByteArray>
+#include <QVector>
+
+/**
+    Packet loss concealment for received streams
+
+    Missing audio is filled by repeating the last pitch period of the played audio, widening to two
+    and three periods as the gap grows so the repetition does not buzz. The repetition fades into
+    comfort noise at the background level over the first 60 ms, longer gaps are comfort noise only.
+    When real audio resumes it is cross faded with the continuing concealment.
+*/
+class LossConcealer
+{
+public:
+    LossConcealer(void);
+
+    /**
+        Set the format of the audio
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Forget the history, used when a new stream starts
+    */
+    void reset();
+
+    /**
+        Pass received audio through on its way to the output. Merges it with the concealment if it ends
+        a gap, and keeps it as history for the next gap.
+
+        @param pcm
+            received audio, modified in place
+    */
+    void process(QByteArray& pcm);
+
+    /**
+        Synthesize audio for a gap
+
+        @param out
+            buffer for numFrames frames in the audio format
+
+        @param numFrames
+            number of sample frames to synthesize
+    */
+    void conceal(char* out, int numFrames);
+
+    /**
+        @return the number of frames concealed in the current gap, 0 if audio is flowing
+    */
+    int getConcealedFrames() const;
+
+private:
+    //! bits per sample
+    int _sampleSize;
+    //! interleaved channels
+    int _channels;
+    //! samples per second
+    int _sampleRate;
+
+    //! recent audio on the 16 bit scale, interleaved
+    QVector<float> _history;
+    //! frames of valid history
+    int _historyFrames;
+
+    //! pitch period of the current gap in frames
+    int _pitch;
+    //! frames concealed in the current gap
+    int _erasedFrames;
+    //! read position in the repeated periods
+    int _phase;
+
+    //! RMS of the background noise
+    float _noiseLevel;
+    //! comfort noise generator state
+    uint32_t _noiseSeed;
+
+    //! working buffers, grown as needed so playout does not allocate per chunk
+    QVector<float> _scratch;
+    QVector<float> _synthetic;
+    QVector<int16_t> _noise;
+
+    /**
+        Append played audio to the history
+    */
+    void addHistory(const float* samples, int numFrames);
+
+    /**
+        Estimate the pitch period of the end of the history by autocorrelation
+
+        @return the period in frames
+    */
+    int estimatePitch() const;
+
+    /**
+        Synthesize concealment on the 16 bit scale
+    */
+    void synthesize(float* out, int numFrames);
+
+    /**
+        Convert between the audio format and the 16 bit scale
+    */
+    void toFloat(const char* in, float* out, int numSamples) const;
+    void fromFloat(const float* in, char* out, int numSamples) const;
+
+    /**
+        @return milliseconds as a number of frames
+    */
+    int msToFrames(int ms) const;
+};
+
+#endif // PLC_H
@@ -0,0 +1,165 @@
+
+/**
+    @file ratecontroller.cpp
+    @breif Adapts the live stream bitrate to the serial link
+    @author Natesh Narain
+*/
+
+#include "ratecontroller.h"
+
+#include <QDebug>
+
+#include "audiocodec.h"
+#include "audioendpoint.h"
+
+#define RATE_WINDOW_MS    500  ///< throughput measurement window
+#define RATE_HEADROOM     0.8  ///< fraction of the link a tier may use
+#define RATE_BACKLOG_HIGH 0.5  ///< seconds of queued data that forces a step down
+#define RATE_BACKLOG_LOW  0.05 ///< seconds of queued data considered uncongested
+#define RATE_HOLD_MS      1000 ///< minimum time between tier changes
+#define RATE_PROBE_MS     3000 ///< uncongested time before stepping up
+#define RATE_BITS_PER_BYTE 10  ///< start, 8 data and stop bit
+
+StreamRateController::StreamRateController()
+{
+    _current = 0;
+    _nominalRate = 0;
+    _throughput = 0;
+    _windowBytes = 0;
+    _windowStart = -1;
+    _lastChange = -1;
+    _idleSince = 0;
+    _isIdle = false;
+
+    setFormat(8, 1, 8000, false);
+}
+
+void StreamRateController::setFormat(int sampleSize, int channels, int sampleRate, bool companded)
+{
+    // candidates from best to smallest, each kept only if it saves bandwidth over the previous
+    const uint8_t codecs[]   = { AUDIO_CODEC_PCM, AUDIO_CODEC_ULAW, AUDIO_CODEC_IMA_ADPCM, AUDIO_CODEC_IMA_ADPCM, AUDIO_CODEC_IMA_ADPCM };
+    const uint8_t divisors[] = { 1, 1, 1, 2, 4 };
+    const int numCandidates = sizeof(codecs) / sizeof(codecs[0]);
+
+    _tiers.clear();
+
+    int i;
+    for(i = 0; i < numCandidates; ++i){
+        double bytesPerSample;
+
+        if(codecs[i] == AUDIO_CODEC_PCM)
+            bytesPerSample = companded ? 1 : sampleSize / 8;
+        else if(codecs[i] == AUDIO_CODEC_ULAW)
+            bytesPerSample = 1;
+        else
+            bytesPerSample = 0.5;
+
+        Tier tier;
+        tier.codec = codecs[i];
+        tier.divisor = divisors[i];
+        tier.cost = ((double)sampleRate / tier.divisor) * channels * bytesPerSample;
+
+        if(_tiers.isEmpty() || tier.cost < _tiers.last().cost) _tiers.append(tier);
+    }
+
+    selectInitialTier();
+}
+
+void StreamRateController::setLinkRate(int baudRate)
+{
+    _nominalRate = (double)baudRate / RATE_BITS_PER_BYTE;
+    _throughput = 0;
+
+    selectInitialTier();
+}
+
+void StreamRateController::onBytesWritten(qint64 bytes)
+{
+    // timed on the clock the audio runs on, so simulated runs adapt the same way every time
+    const qint64 now = AudioEndpoints::elapsed();
+    if(_windowStart < 0) _windowStart = now;
+
+    _windowBytes += bytes;
+
+    qint64 elapsed = now - _windowStart;
+    if(elapsed >= RATE_WINDOW_MS){
+        double rate = (_windowBytes * 1000.0) / elapsed;
+
+        // smooth out bursts from the port driver
+        _throughput = (_throughput == 0) ? rate : (0.7 * _throughput + 0.3 * rate);
+
+        _windowBytes = 0;
+        _windowStart = now;
+    }
+}
+
+const StreamRateController::Tier& StreamRateController::update(qint64 queueDepth)
+{
+    double linkRate = capacity();
+    double backlog = (linkRate > 0) ? queueDepth / linkRate : 0;
+
+    const qint64 now = AudioEndpoints::elapsed();
+    if(_lastChange < 0) _lastChange = now;
+
+    if(backlog > RATE_BACKLOG_HIGH){
+        _isIdle = false;
+
+        // step down, but give the previous change time to take effect
+        if(_current < _tiers.size() - 1 && now - _lastChange >= RATE_HOLD_MS){
+            _current++;
+            _lastChange = now;
+            qDebug() << "Stream rate down: codec " << _tiers[_current].codec << " divisor " << _tiers[_current].divisor;
+        }
+    }
+    else if(backlog < RATE_BACKLOG_LOW){
+        if(!_isIdle){
+            _isIdle = true;
+            _idleSince = now;
+        }
+
+        // step up when the link has been clear for a while and the better tier fits
+        if(_current > 0 && now - _idleSince >= RATE_PROBE_MS && now - _lastChange >= RATE_HOLD_MS
+           && _tiers[_current - 1].cost <= linkRate * RATE_HEADROOM){
+            _current--;
+            _lastChange = now;
+            _idleSince = now;
+            qDebug() << "Stream rate up: codec " << _tiers[_current].codec << " divisor " << _tiers[_current].divisor;
+        }
+    }
+    else{
+        _isIdle = false;
+    }
+
+    return _tiers[_current];
+}
+
+double StreamRateController::capacity() const
+{
+    // a measured rate below the nominal one means the link is slower than its baud rate suggests,
+    // the measurement only says something about capacity while data is queued though
+    if(_throughput > 0 && !_isIdle && _throughput < _nominalRate) return _throughput;
+
+    return _nominalRate;
+}
+
+void StreamRateController::selectInitialTier()
+{
+    _current = 0;
+
+    // without a link rate the best tier is used
+    if(_nominalRate <= 0) return;
+
+    while(_current < _tiers.size() - 1 && _tiers[_current].cost > _nominalRate * RATE_HEADROOM){
+        _current++;
+    }
+}
+
+const StreamRateController::Tier& StreamRateController::getTier() const
+{
+    return _tiers[_current];
+}
+
+double StreamRateController::getThroughput() const
+{
+    return _throughput;
+}
@@ -0,0 +1,111 @@
+#ifndef RATECONTROLLER_H
+#define RATECONTROLLER_H
+
+#include <cstdint>
+
+#include <QList>
+
+/**
+    Steps a live audio stream between codec and sample rate tiers to fit the serial link.
+
+    Throughput is measured from the bytes the port actually writes. The write queue depth, converted to
+    the time it needs to drain, shows when the stream (plus any competing text traffic) exceeds the link.
+    The stream steps down a tier as soon as the backlog builds, and back up once the link has been idle
+    long enough with room for the better tier.
+*/
+class StreamRateController
+{
+public:
+    //! A codec and sample rate combination
+    struct Tier{
+        uint8_t codec;   ///< wire codec
+        uint8_t divisor; ///< sample rate divisor
+        double cost;     ///< bytes per second on the wire
+    };
+
+    StreamRateController(void);
+
+    /**
+        Build the tiers available for a capture format
+
+        @param sampleSize
+            bits per captured sample
+
+        @param channels
+            number of channels
+
+        @param sampleRate
+            capture sample rate
+
+        @param companded
+            captured audio is stored companded
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate, bool companded);
+
+    /**
+        Set the nominal link rate
+
+        @param baudRate
+            serial baud rate
+    */
+    void setLinkRate(int baudRate);
+
+    /**
+        Record bytes written to the link
+    */
+    void onBytesWritten(qint64 bytes);
+
+    /**
+        Re-evaluate the tier before sending a stream frame
+
+        @param queueDepth
+            bytes waiting to be written to the link
+
+        @return the tier to send the frame with
+    */
+    const Tier& update(qint64 queueDepth);
+
+    /**
+        @return the current tier
+    */
+    const Tier& getTier() const;
+
+    /**
+        @return the measured link throughput in bytes per second
+    */
+    double getThroughput() const;
+
+private:
+    //! tiers from best quality to smallest
+    QList<Tier> _tiers;
+    //! index of the current tier
+    int _current;
+
+    //! nominal link capacity in bytes per second
+    double _nominalRate;
+    //! smoothed measured throughput in bytes per second
+    double _throughput;
+
+    //! bytes written in the current measurement window
+    qint64 _windowBytes;
+    //! start of the measurement window on the audio endpoint clock, -1 before the first write
+    qint64 _windowStart;
+    //! time of the last tier change, -1 before the first update
+    qint64 _lastChange;
+    //! time the link became uncongested
+    qint64 _idleSince;
+    //! link is currently uncongested
+    bool _isIdle;
+
+    /**
+        @return the link capacity estimate in bytes per second
+    */
+    double capacity() const;
+
+    /**
+        Select the best tier that fits the link
+    */
+    void selectInitialTier();
+};
+
+#endif // RATECONTROLLER_H
@@ -0,0 +1,96 @@
+
+/**
+    @file recordingstore.cpp
+    @breif Recording storage in a memory mapped temporary file
+    @author Natesh Narain
+*/
+
+#include "recordingstore.h"
+
+#include <QDir>
+#include <QDebug>
+
+#define RECORDING_CHUNK_BYTES (1024 * 1024) ///< the file grows by whole chunks
+#define RECORDING_FILE_TEMPLATE "/intercom_recording_XXXXXX.raw" ///< name of the file in the temp directory
+
+RecordingStore::RecordingStore() : _file(QDir::tempPath() + RECORDING_FILE_TEMPLATE)
+{
+    _map = NULL;
+    _mapped = 0;
+    _size = 0;
+}
+
+char* RecordingStore::reserve(qint64 end)
+{
+    if(end > _mapped){
+        // whole chunks, and at least half again the current size so long recordings remap rarely
+        qint64 capacity = _mapped + _mapped / 2;
+        if(capacity < end) capacity = end;
+        capacity = ((capacity + RECORDING_CHUNK_BYTES - 1) / RECORDING_CHUNK_BYTES) * RECORDING_CHUNK_BYTES;
+
+        if(!remap(capacity)) return NULL;
+    }
+
+    return (char*)_map;
+}
+
+bool RecordingStore::remap(qint64 capacity)
+{
+    if(!_file.isOpen() && !_file.open()){
+        qWarning() << "RecordingStore: could not create " << _file.fileName();
+        return false;
+    }
+
+    if(_map != NULL){
+        _file.unmap(_map);
+        _map = NULL;
+        _mapped = 0;
+    }
+
+    if(!_file.resize(capacity)){
+        qWarning() << "RecordingStore: could not grow the recording to " << capacity << " bytes";
+        return false;
+    }
+
+    _map = _file.map(0, capacity);
+    if(_map == NULL){
+        qWarning() << "RecordingStore: could not map the recording";
+        return false;
+    }
+
+    _mapped = capacity;
+
+    return true;
+}
+
+void RecordingStore::setSize(qint64 size)
+{
+    _size = (size < _mapped) ? size : _mapped;
+}
+
+void RecordingStore::clear()
+{
+    _size = 0;
+}
+
+qint64 RecordingStore::size() const
+{
+    return _size;
+}
+
+const char* RecordingStore::constData() const
+{
+    return (const char*)_map;
+}
+
+QByteArray RecordingStore::bytes() const
+{
+    if(_map == NULL) return QByteArray();
+
+    return QByteArray::fromRawData((const char*)_map, (int)_size);
+}
+
+RecordingStore::~RecordingStore()
+{
+    if(_map != NULL) _file.unmap(_map);
+}
@@ -0,0 +1,80 @@
+#ifndef RECORDINGSTORE_H
+#define RECORDINGSTORE_H
+
+#include <cstdint>
+
+#include <QByteArray>
+#include <QTemporaryFile>
+
+/**
+    Storage for a recording in a memory mapped temporary file
+
+    The file grows in whole chunks as audio is appended and stays mapped, so a long recording lives in the
+    page cache rather than the heap and is handed on as a view of the mapping instead of a copy. The file
+    is kept between recordings and removed when the store is destroyed.
+*/
+class RecordingStore
+{
+public:
+    RecordingStore(void);
+    ~RecordingStore(void);
+
+    /**
+        Make the mapping cover the first end bytes of the recording
+
+        @param end
+            bytes that must be addressable
+
+        @return the start of the mapping, NULL if the file could not grow
+    */
+    char* reserve(qint64 end);
+
+    /**
+        Set the length of the recording, within what was reserved
+
+        @param size
+            bytes of recorded audio
+    */
+    void setSize(qint64 size);
+
+    /**
+        Empty the recording, the file and mapping are kept for the next one
+    */
+    void clear();
+
+    /**
+        @return bytes of recorded audio
+    */
+    qint64 size() const;
+
+    /**
+        @return the start of the recording, NULL if nothing was recorded
+    */
+    const char* constData() const;
+
+    /**
+        Get the recording without copying it
+
+        @return a view of the mapping, valid until the next recording grows the file
+    */
+    QByteArray bytes() const;
+
+private:
+    //! backing file
+    QTemporaryFile _file;
+    //! start of the mapping
+    uchar* _map;
+    //! bytes mapped
+    qint64 _mapped;
+    //! bytes of recorded audio
+    qint64 _size;
+
+    /**
+        Grow the file and map all of it
+
+        @return false if the file could not be grown or mapped
+    */
+    bool remap(qint64 capacity);
+};
+
+#endif // RECORDINGSTORE_H
@@ -0,0 +1,274 @@
+
+/**
+    @file resampler.cpp
+    @breif Polyphase sample rate converter between the device and wire rates
+    @author Natesh Narain
+*/
+
+#include "resampler.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define RESAMPLER_ZEROS      16    ///< zero crossings of the sinc on each side of its centre
+#define RESAMPLER_CUTOFF     0.92  ///< pass band edge as a fraction of the lower Nyquist frequency
+#define RESAMPLER_BETA       8.0   ///< Kaiser window shape, about 80 dB of stop band
+#define RESAMPLER_MAX_PHASES 512   ///< most filter phases stored
+#define RESAMPLER_MAX_TAPS   1024  ///< most taps in a phase
+
+static int _gcd(int a, int b)
+{
+    while(b != 0){
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/**
+    Zeroth order modified Bessel function of the first kind, for the Kaiser window
+*/
+static double _bessel0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+
+    for(k = 1; k < 32; ++k){
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if(term < sum * 1e-12) break;
+    }
+
+    return sum;
+}
+
+/**
+    Dot product of a filter phase and the input under it
+*/
+static float _dot(const float* filter, const float* x, int n)
+{
+    float sum = 0;
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    for(; i + 8 <= n; i += 8){
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(filter + i),     _mm_loadu_ps(x + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(filter + i + 4), _mm_loadu_ps(x + i + 4)));
+    }
+    for(; i + 4 <= n; i += 4){
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(filter + i), _mm_loadu_ps(x + i)));
+    }
+
+    // horizontal sum of the four lanes
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    sum = _mm_cvtss_f32(acc0);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+
+    for(; i + 8 <= n; i += 8){
+        acc0 = vmlaq_f32(acc0, vld1q_f32(filter + i),     vld1q_f32(x + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(filter + i + 4), vld1q_f32(x + i + 4));
+    }
+    for(; i + 4 <= n; i += 4){
+        acc0 = vmlaq_f32(acc0, vld1q_f32(filter + i), vld1q_f32(x + i));
+    }
+
+    acc0 = vaddq_f32(acc0, acc1);
+    float32x2_t half = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    sum = vget_lane_f32(vpadd_f32(half, half), 0);
+#endif
+
+    for(; i < n; ++i) sum += filter[i] * x[i];
+
+    return sum;
+}
+
+static inline int16_t _saturate(float x)
+{
+    return (int16_t)((x > 32767.0f) ? 32767 : ((x < -32768.0f) ? -32768 : lrintf(x)));
+}
+
+Resampler::Resampler()
+{
+    _inRate = 0;
+    _outRate = 0;
+    _channels = 0;
+    _up = 1;
+    _down = 1;
+    _phases = 1;
+    _taps = 0;
+    _historyFrames = 0;
+    _next = 0;
+
+    setRates(8000, 8000, 1);
+}
+
+void Resampler::setRates(int inRate, int outRate, int channels)
+{
+    if(inRate <= 0) inRate = 1;
+    if(outRate <= 0) outRate = 1;
+    if(channels <= 0) channels = 1;
+
+    if(inRate == _inRate && outRate == _outRate && channels == _channels) return;
+
+    _inRate = inRate;
+    _outRate = outRate;
+    _channels = channels;
+
+    int g = _gcd(inRate, outRate);
+    _up = outRate / g;
+    _down = inRate / g;
+    _phases = (_up < RESAMPLER_MAX_PHASES) ? _up : RESAMPLER_MAX_PHASES;
+
+    // cut off below the lower Nyquist frequency, in cycles per input sample times two
+    double cutoff = RESAMPLER_CUTOFF * ((_up < _down) ? (double)_up / _down : 1.0);
+
+    // the filter spans the same number of zero crossings at any cut off
+    _taps = (int)ceil(2 * RESAMPLER_ZEROS / cutoff);
+    if(_taps > RESAMPLER_MAX_TAPS) _taps = RESAMPLER_MAX_TAPS;
+    _taps = (_taps + 3) & ~3;
+
+    _filter.resize(_phases * _taps);
+
+    const double half = _taps / 2.0;
+    const double norm = _bessel0(RESAMPLER_BETA);
+    int p, j;
+
+    for(p = 0; p < _phases; ++p){
+        float* phase = _filter.data() + p * _taps;
+        double sum = 0;
+
+        for(j = 0; j < _taps; ++j){
+            // distance from the output sample to tap j, in input samples
+            double t = (_taps / 2 - 1) + (double)p / _phases - j;
+            double s = (t == 0) ? 1.0 : sin(M_PI * cutoff * t) / (M_PI * cutoff * t);
+            double r = t / half;
+            double w = (r * r < 1) ? _bessel0(RESAMPLER_BETA * sqrt(1 - r * r)) / norm : 0;
+
+            phase[j] = (float)(s * w);
+            sum += phase[j];
+        }
+
+        // unity gain at DC for every phase
+        for(j = 0; j < _taps; ++j) phase[j] = (float)(phase[j] / sum);
+    }
+
+    reset();
+}
+
+void Resampler::reset()
+{
+    int c;
+
+    _history.resize(_channels);
+
+    // the first output is centred on the first input
+    _historyFrames = _taps / 2 - 1;
+    for(c = 0; c < _channels; ++c) _history[c].fill(0, _historyFrames);
+
+    _next = 0;
+}
+
+bool Resampler::isPassThrough() const
+{
+    return _inRate == _outRate;
+}
+
+int Resampler::process(const int16_t* in, int numFrames, QVector<int16_t>& out)
+{
+    int i, c;
+
+    if(isPassThrough()){
+        out.resize(numFrames * _channels);
+        memcpy(out.data(), in, numFrames * _channels * sizeof(int16_t));
+        return numFrames;
+    }
+
+    const int held = _historyFrames + numFrames;
+
+    for(c = 0; c < _channels; ++c){
+        QVector<float>& history = _history[c];
+        if(history.size() < held) history.resize(held);
+
+        float* x = history.data() + _historyFrames;
+        for(i = 0; i < numFrames; ++i) x[i] = in[i * _channels + c];
+    }
+
+    _historyFrames = held;
+
+    // enough room for every output the held input can make
+    int maxFrames = (int)(((int64_t)held * _up) / _down) + 2;
+    out.resize(maxFrames * _channels);
+
+    int16_t* dst = out.data();
+    int outFrames = 0;
+
+    while(outFrames < maxFrames){
+        int64_t start = _next / _up;
+        int phase = (int)(_next % _up);
+
+        // nearest stored phase when the ratio has more phases than are stored
+        if(_phases != _up){
+            phase = (int)(((int64_t)phase * _phases * 2 + _up) / (2 * _up));
+            if(phase == _phases){
+                phase = 0;
+                start++;
+            }
+        }
+
+        if(start + _taps > _historyFrames) break;
+
+        const float* filter = _filter.constData() + phase * _taps;
+        for(c = 0; c < _channels; ++c){
+            dst[outFrames * _channels + c] = _saturate(_dot(filter, _history[c].constData() + start, _taps));
+        }
+
+        outFrames++;
+        _next += _down;
+    }
+
+    out.resize(outFrames * _channels);
+
+    // drop the input no later output reaches
+    int consumed = (int)(_next / _up);
+    if(consumed > _historyFrames) consumed = _historyFrames;
+
+    if(consumed > 0){
+        for(c = 0; c < _channels; ++c){
+            float* history = _history[c].data();
+            memmove(history, history + consumed, (_historyFrames - consumed) * sizeof(float));
+        }
+
+        _historyFrames -= consumed;
+        _next -= (int64_t)consumed * _up;
+    }
+
+    return outFrames;
+}
+
+int Resampler::flush(QVector<int16_t>& out)
+{
+    if(isPassThrough()){
+        out.resize(0);
+        return 0;
+    }
+
+    // silence after the end lets the filter reach the last input
+    QVector<int16_t> silence(_taps / 2 * _channels, 0);
+
+    return process(silence.constData(), _taps / 2, out);
+}
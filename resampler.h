@@ -0,0 +1,101 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+
+#include <QVector>
+
+/**
+    Polyphase sample rate converter
+
+    Converts between any two rates by the ratio of the rates reduced to lowest terms, up by L and down
+    by M. The low pass filter is a Kaiser windowed sinc designed at the up sampled rate and split into
+    its L phases, so each output sample is one dot product of a phase with the input around it. The cut
+    off follows the lower of the two rates, so down sampling does not alias. Ratios with more phases
+    than are stored use the nearest stored phase.
+
+    Audio is converted as a stream, the input kept for the filter carries over between calls. The
+    output lags the input by half the filter, flush() pushes out the rest at the end of the audio.
+*/
+class Resampler
+{
+public:
+    Resampler(void);
+
+    /**
+        Set the rates, the filter is only redesigned when they change
+
+        @param inRate
+            samples per second of the input
+
+        @param outRate
+            samples per second of the output
+
+        @param channels
+            number of interleaved channels
+    */
+    void setRates(int inRate, int outRate, int channels);
+
+    /**
+        Forget the input carried over, used when a new stream starts
+    */
+    void reset();
+
+    /**
+        @return true if the rates are equal and audio passes through unchanged
+    */
+    bool isPassThrough() const;
+
+    /**
+        Convert audio
+
+        @param in
+            interleaved 16 bit samples at the input rate
+
+        @param numFrames
+            sample frames in the input
+
+        @param out
+            set to the interleaved 16 bit samples at the output rate
+
+        @return sample frames in the output
+    */
+    int process(const int16_t* in, int numFrames, QVector<int16_t>& out);
+
+    /**
+        Convert the input still held back by the filter, used at the end of the audio
+
+        @param out
+            set to the interleaved 16 bit samples at the output rate
+
+        @return sample frames in the output
+    */
+    int flush(QVector<int16_t>& out);
+
+private:
+    //! samples per second of the input
+    int _inRate;
+    //! samples per second of the output
+    int _outRate;
+    //! interleaved channels
+    int _channels;
+    //! up sampling factor, L
+    int _up;
+    //! down sampling factor, M
+    int _down;
+    //! phases stored
+    int _phases;
+    //! taps of each phase, a multiple of 4
+    int _taps;
+    //! filter phases, _taps coefficients each
+    QVector<float> _filter;
+
+    //! input of each channel, the oldest sample first
+    QVector< QVector<float> > _history;
+    //! sample frames held in _history
+    int _historyFrames;
+    //! start of the window of the next output sample in 1 / L input samples
+    int64_t _next;
+};
+
+#endif // RESAMPLER_H
@@ -7,65 +7,84 @@
 
 #include "rlencoding.h"
 
+#include <string.h>
+
+static int _rlflush(uint8_t* outBuffer, int outIdx, int outLen, uint8_t current, uint8_t count, uint8_t esc);
+
 int rlencode(uint8_t *inBuffer, int inLen, uint8_t *outBuffer, int outLen, uint8_t esc)
 {
     int i, outIdx = 0;
 
+    if(inLen <= 0) return 0;
+
     uint8_t current = inBuffer[0];
     uint8_t count = 0;
 
     for(i = 0; i < inLen; ++i){
 
-        if(outIdx >= outLen) return outIdx;
-
         // count the number of the current character
-        if(current == inBuffer[i] || count == 0xFF){
+        if(current == inBuffer[i] && count < 0xFF){
             count++;
         }
         else{
-            // greater than 2 encoding
-            if(count > 2){
-                if(current != esc){
-                    outBuffer[outIdx++] = esc;
-                    outBuffer[outIdx++] = count;
-                    outBuffer[outIdx++] = current;
-                }
-                else{
-                    // cases where we are encoding the esc character
-                    if(count == 2){
-                        outBuffer[outIdx++] = esc;
-                        outBuffer[outIdx++] = 0x01;
-                    }
-                    else{
-                        outBuffer[outIdx++] = esc;
-                        outBuffer[outIdx++] = 0x02;
-                        outBuffer[outIdx++] = count;
-                    }
-                }
-            }
-            // 2 or less encoding (2 or 1)
-            else{
-                if(current == esc){
-                    outBuffer[outIdx++] = esc;
-                    outBuffer[outIdx++] = count - 1; // [ESC $00] is 1 ESCs, [ESC $01] is 2 ESCs
-                }
-                else{
-                    if(count == 2){
-                        outBuffer[outIdx++] = current;
-                        outBuffer[outIdx++] = current;
-                    }
-                    // must be 1
-                    else{
-                        outBuffer[outIdx++] = current;
-                    }
-                }
-            }
+            int next = _rlflush(outBuffer, outIdx, outLen, current, count, esc);
+
+            // out of space
+            if(next < 0) return outIdx;
+
+            outIdx = next;
+
             // change to the different character
             current = inBuffer[i];
             count = 1;
         }
     }
 
+    // the last run is still pending
+    int next = _rlflush(outBuffer, outIdx, outLen, current, count, esc);
+
+    return (next < 0) ? outIdx : next;
+}
+
+static int _rlflush(uint8_t* outBuffer, int outIdx, int outLen, uint8_t current, uint8_t count, uint8_t esc)
+{
+    // number of bytes this run encodes to
+    int needed = (count > 2) ? 3 : ((current == esc) ? 2 : count);
+
+    if(outIdx + needed > outLen) return -1;
+
+    // greater than 2 encoding
+    if(count > 2){
+        if(current != esc){
+            outBuffer[outIdx++] = esc;
+            outBuffer[outIdx++] = count;
+            outBuffer[outIdx++] = current;
+        }
+        else{
+            // cases where we are encoding the esc character
+            outBuffer[outIdx++] = esc;
+            outBuffer[outIdx++] = 0x02;
+            outBuffer[outIdx++] = count;
+        }
+    }
+    // 2 or less encoding (2 or 1)
+    else{
+        if(current == esc){
+            outBuffer[outIdx++] = esc;
+            outBuffer[outIdx++] = count - 1; // [ESC $00] is 1 ESCs, [ESC $01] is 2 ESCs
+        }
+        else{
+            if(count == 2){
+                outBuffer[outIdx++] = current;
+                outBuffer[outIdx++] = current;
+            }
+            // must be 1
+            else{
+                outBuffer[outIdx++] = current;
+            }
+        }
+    }
+
     return outIdx;
 }
 
@@ -77,9 +96,14 @@ int rldecode(uint8_t* inBuffer, int iLen, uint8_t* outBuffer, int max, uint8_t e
         // escape sequence found
         if(inBuffer[i] == esc){
 
+            // truncated escape sequence
+            if(i + 1 >= iLen) break;
+
             uint8_t count = inBuffer[++i];
 
             if(count > 2){
+                if(i + 1 >= iLen || outIdx + count > max) break;
+
                 uint8_t byte = inBuffer[++i];
 
                 for(j = 0; j < count; j++){
@@ -87,25 +111,141 @@ int rldecode(uint8_t* inBuffer, int iLen, uint8_t* outBuffer, int max, uint8_t e
                 }
             }
             else if(count == 2){
+                if(i + 1 >= iLen) break;
+
                 uint8_t realCount = inBuffer[++i];
 
+                if(outIdx + realCount > max) break;
+
                 for(j = 0; j < realCount; ++j){
                     outBuffer[outIdx++] = esc;
                 }
             }
             else if(count == 1){
+                if(outIdx + 2 > max) break;
+
                 outBuffer[outIdx++] = esc;
                 outBuffer[outIdx++] = esc;
             }
             else if(count == 0){
+                if(outIdx + 1 > max) break;
+
                 outBuffer[outIdx++] = esc;
             }
 
         }
         else{
+            if(outIdx >= max) break;
+
             outBuffer[outIdx++] = inBuffer[i];
         }
     }
 
     return outIdx;
 }
+
+int rldecodepartial(const uint8_t* inBuffer, int iLen, uint8_t* outBuffer, int max, uint8_t esc, int* consumed)
+{
+    int i = 0, j, outIdx = 0;
+
+    while(i < iLen){
+        int codeLen = 1;
+        int runLen = 1;
+        uint8_t byte = inBuffer[i];
+
+        if(inBuffer[i] == esc){
+            // the count decides how long the code is
+            if(i + 1 >= iLen) break;
+
+            uint8_t count = inBuffer[i + 1];
+
+            if(count >= 2){
+                if(i + 2 >= iLen) break;
+
+                codeLen = 3;
+                runLen = (count > 2) ? count : inBuffer[i + 2];
+                byte = (count > 2) ? inBuffer[i + 2] : esc;
+            }
+            else{
+                codeLen = 2;
+                runLen = count + 1;
+                byte = esc;
+            }
+        }
+
+        if(outIdx + runLen > max) break;
+
+        for(j = 0; j < runLen; ++j){
+            outBuffer[outIdx++] = byte;
+        }
+
+        i += codeLen;
+    }
+
+    *consumed = i;
+
+    return outIdx;
+}
+
+void rlhistogram(const uint8_t* inBuffer, int len, uint32_t histogram[256])
+{
+    // four interleaved tables so consecutive bytes with the same value do not
+    // serialize on a single counter
+    uint32_t tables[4][256];
+    uint32_t lo, hi;
+    int i;
+
+    memset(tables, 0, sizeof(tables));
+
+    for(i = 0; i + 8 <= len; i += 8){
+        memcpy(&lo, inBuffer + i, sizeof(uint32_t));
+        memcpy(&hi, inBuffer + i + 4, sizeof(uint32_t));
+
+        tables[0][ lo        & 0xFF]++;
+        tables[1][(lo >> 8)  & 0xFF]++;
+        tables[2][(lo >> 16) & 0xFF]++;
+        tables[3][ lo >> 24        ]++;
+
+        tables[0][ hi        & 0xFF]++;
+        tables[1][(hi >> 8)  & 0xFF]++;
+        tables[2][(hi >> 16) & 0xFF]++;
+        tables[3][ hi >> 24        ]++;
+    }
+
+    // remaining bytes
+    for(; i < len; ++i){
+        tables[0][inBuffer[i]]++;
+    }
+
+    for(i = 0; i < 256; ++i){
+        histogram[i] = tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+    }
+}
+
+uint8_t rlleastused(const uint32_t histogram[256])
+{
+    int i;
+    int leastUsed = DEFAULT_ESC;
+
+    // prefer the default escape on ties so unchanged payloads encode the same way
+    for(i = 0; i < 256; ++i){
+        if(histogram[i] < histogram[leastUsed]){
+            leastUsed = i;
+        }
+    }
+
+    return (uint8_t)leastUsed;
+}
+
+uint8_t rlescape(const uint8_t* inBuffer, int len, uint32_t* escCount)
+{
+    uint32_t histogram[256];
+    uint8_t esc;
+
+    rlhistogram(inBuffer, len, histogram);
+    esc = rlleastused(histogram);
+
+    if(escCount != NULL) *escCount = histogram[esc];
+
+    return esc;
+}
@@ -46,6 +46,69 @@ int rlencode(uint8_t *inBuffer, int inLen, uint8_t *outBuffer, int outLen, uint8
 */
 int rldecode(uint8_t* inBuffer, int iLen, uint8_t* outBuffer, int max, uint8_t esc);
 
+/**
+    Run Length Decoding of a payload that is still arriving. Only whole codes are
+    decoded, an escape sequence cut off by the end of the input is left for the
+    next call.
+
+    @param inBuffer
+        The encoded bytes received so far and not yet consumed
+
+    @param iLen
+        Length of the input
+
+    @param outBuffer
+        Buffer to put decoded data
+
+    @param max
+        Max output buffer length
+
+    @param esc
+        the escape code
+
+    @param consumed
+        Receives the number of input bytes decoded
+
+    @return the number of bytes decoded
+*/
+int rldecodepartial(const uint8_t* inBuffer, int iLen, uint8_t* outBuffer, int max, uint8_t esc, int* consumed);
+
+/**
+    Count the occurrences of each byte value
+
+    @param inBuffer
+        The data to count
+
+    @param len
+        Length of the data
+
+    @param histogram
+        Receives the count of each byte value
+*/
+void rlhistogram(const uint8_t* inBuffer, int len, uint32_t histogram[256]);
+
+/**
+    @return the least frequent byte value in the histogram
+*/
+uint8_t rlleastused(const uint32_t histogram[256]);
+
+/**
+    Choose the escape code for a payload. The least frequent byte is used so the
+    fewest literal bytes need escaping.
+
+    @param inBuffer
+        The data to be encoded
+
+    @param len
+        Length of the data
+
+    @param escCount
+        Optional, receives the number of times the escape occurs in the data
+
+    @return the escape code
+*/
+uint8_t rlescape(const uint8_t* inBuffer, int len, uint32_t* escCount);
+
 #ifdef __cplusplus
 }
 #endif
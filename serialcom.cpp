@@ -21,9 +21,13 @@
 
 #include <string>
 #include <cstdlib>
+#include <climits>
 
 #include "rlencoding.h"
 #include "bitopts.h"
+#include "broadcastencoder.h"
+#include "audioendpoint.h"
+#include "loopbackport.h"
 
 //! Hex String from int
 #define Q_HEXSTR(x) QString("%1").arg(x, 0, 16)
@@ -32,21 +36,52 @@
 
 #define vote(x,y) (x == y)
 
+#define SERIAL_BITS_PER_BYTE 10 ///< start, 8 data and stop bit
+#define SERIAL_BULK_BACKLOG_MS 50 ///< link time queued on the port before broadcast fragments hold back
+#define SERIAL_MESSAGE_LIMIT 8192 ///< most received text messages held, the lowest priority go first
+#define SERIAL_MAX_PAYLOAD (256 * 1024) ///< largest payload accepted, past a stream frame or fragment at the highest rate
+#define SERIAL_RLE_MAX_EXPANSION 85     ///< most bytes one byte of RLE codes decodes to, a 3 byte code gives 255
+
 SerialCom::SerialCom(QObject *parent) : QObject(parent)
 {
-    _serial = new QSerialPort(this);
-    connect(_serial, SIGNAL(readyRead()), this, SLOT(onDataReceived()));
+    _serial = NULL;
+    usePort(false);
 
     _isProcessingPacket = false;
+    _skipPacket = false;
+    _adaptiveStreamRate = false;
+
+    _streamSequence = 0;
+    _fragmentValid = false;
+    _payloadReceived = 0;
+    _payloadDecoded = 0;
+    _latency = NULL;
+    _bytesSent = 0;
+    _linkBytesPerSecond = 0;
     _useHeader = true;
     _checksumDivisor = 16;
 
-    initQueue(&_queue);
+    // reserved so resizing down to a shorter payload keeps the storage
+    _decodeBuffer.reserve(BROADCAST_CHUNK_BYTES);
+
+    initMessagePool(&_messages);
+    initQueue(&_queue, &_messages);
+    setQueueLimit(&_queue, SERIAL_MESSAGE_LIMIT);
     initPhoneBook(&_log);
+
+    // broadcasts are encoded on a worker, the fragments come back to this thread for the port
+    _encoder = new BroadcastEncoder();
+    _encoder->moveToThread(&_encoderThread);
+    connect(_encoder, SIGNAL(onFragmentReady(QByteArray)), this, SLOT(onBroadcastFragmentReady(QByteArray)));
+    connect(_encoder, SIGNAL(onBroadcastEncoded()), this, SIGNAL(onBroadcastSent()));
+    connect(&_encoderThread, SIGNAL(finished()), _encoder, SLOT(deleteLater()));
+    _encoderThread.start();
 }
 
 bool SerialCom::open(SerialSettings::Settings settings)
 {
+    usePort(settings.portName == LOOPBACK_PORT_NAME);
+
     _serial->setPortName(settings.portName);
     _serial->setBaudRate(settings.baudrate);
     _serial->setDataBits(settings.databits);
@@ -57,14 +92,37 @@ bool SerialCom::open(SerialSettings::Settings settings)
 
     _receiveBuffer.open(QIODevice::ReadWrite);
 
+    _rateController.setLinkRate(settings.baudrate);
+
+    _linkBytesPerSecond = settings.baudrate / SERIAL_BITS_PER_BYTE;
+    _bytesSent = 0;
+    _inFlight = QList<SentChunk>();
+    _bulkInFlight = QList<SentFragment>();
+
     return _serial->open(QIODevice::ReadWrite);
 }
 
+void SerialCom::usePort(bool loopback)
+{
+    if(_serial != NULL && (qobject_cast<LoopbackPort*>(_serial) != NULL) == loopback) return;
+
+    delete _serial;
+
+    _serial = loopback ? new LoopbackPort(this) : new QSerialPort(this);
+    connect(_serial, SIGNAL(readyRead()), this, SLOT(onDataReceived()));
+    connect(_serial, SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten(qint64)));
+}
+
 void SerialCom::close()
 {
     _serial->close();
     resetBuffer(_receiveBuffer);
     _isProcessingPacket = false;
+
+    // a broadcast going out ends with the session
+    _encoder->cancel();
+    _bulkPending = QList<QByteArray>();
+    _bulkInFlight = QList<SentFragment>();
 }
 
 void SerialCom::onDataReceived()
@@ -81,6 +139,13 @@ void SerialCom::onDataReceived()
         return ;
     }
 
+    // one read can bring several frames, e.g. many small stream frames, and the last of them must not
+    // wait for a read that may never come
+    while(processFrame());
+}
+
+bool SerialCom::processFrame()
+{
     // check if there is data for a packet header
     if(_isProcessingPacket == false && _receiveBuffer.size() >= sizeof(FrameHeader)){
         qDebug() << "Getting packet header";
@@ -92,7 +157,12 @@ void SerialCom::onDataReceived()
         _receiveBuffer.read((char*)&_inHeader, sizeof(FrameHeader));
 
         // verify the packet is valid
-        if(_inHeader.lSignature == FRAME_SIGNATURE && vote(_inHeader.lSignature, _inHeader.lSignature2)){
+        // the sample rate sizes the rate conversion, a corrupt one would build a filter for an absurd ratio,
+        // the format says how the payload splits into samples and the lengths size the buffers
+        if(_inHeader.lSignature == FRAME_SIGNATURE && vote(_inHeader.lSignature, _inHeader.lSignature2) && _inHeader.bVersion == FRAME_VERSION
+           && _inHeader.lDataLength <= SERIAL_MAX_PAYLOAD && _inHeader.lUncompressedLength <= SERIAL_MAX_PAYLOAD
+           && AudioCodec::isValidRate(_inHeader.lSampleRate)
+           && AudioCodec::isValidFormat(_inHeader.bChannels, _inHeader.bSampleSize)){
             // check if the correct station
             qDebug() << "receiver id: " << _inHeader.bReceiverId;
             if(_inHeader.bReceiverId == _stationId || (isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO) || isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO_STREAM))){
@@ -100,27 +170,45 @@ void SerialCom::onDataReceived()
                 qDebug() << "Will wait for " << _inHeader.lDataLength << " bytes";
                 // specify that a packet is now being processed
                 _isProcessingPacket = true;
+                _skipPacket = false;
                 removeProcessedData(_receiveBuffer, sizeof(FrameHeader));
+
+                if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO)) beginBroadcastFrame();
             }
             else{
+                // passed over, the frames after it may still be for this station
                 qDebug() << "Data not for this station";
-                resetBuffer(_receiveBuffer);
+                _isProcessingPacket = true;
+                _skipPacket = true;
+                removeProcessedData(_receiveBuffer, sizeof(FrameHeader));
             }
         }
         else{
             resetBuffer(_receiveBuffer);
-            qDebug() << "Data discarded, invalid signature";
+            qDebug() << "Data discarded, invalid header";
         }
         qDebug() << "\n";
     }
 
-    // check if a packet is being processed
-    if(_isProcessingPacket){
+    if(!_isProcessingPacket) return false;
+
+    if(_skipPacket){
+        if(_receiveBuffer.size() < _inHeader.lDataLength) return false;
 
-        // check for the number of bytes specified by the header
+        _isProcessingPacket = false;
+        removeProcessedData(_receiveBuffer, _inHeader.lDataLength);
+    }
+    // broadcasts are decoded as they arrive rather than once the whole frame is in
+    else if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO)){
+        receiveBroadcastData();
+    }
+    // check for the number of bytes specified by the header
+    else{
         if(_receiveBuffer.size() >= _inHeader.lDataLength){
             qDebug() << "Enough data received";
 
+            const qint64 received = AudioEndpoints::elapsed();
+
             // move to the front of the buffer for reading
             _receiveBuffer.reset();
 
@@ -146,9 +234,6 @@ void SerialCom::onDataReceived()
             if(isBitSet(_inHeader.bDecodeOpts, COMPRESS_TYPE_RLE)){
                 qDebug() << "RL Decode";
 
-                // create a buffer for the uncompressed data
-                uint8_t* decodeBuffer = (uint8_t*) malloc(_inHeader.lUncompressedLength);
-
                 // get the data from the buffer
                 QByteArray bytes = _receiveBuffer.read(_inHeader.lDataLength);
                 uint8_t* raw = (uint8_t*) bytes.data();
@@ -156,44 +241,43 @@ void SerialCom::onDataReceived()
                 //
                 if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_TEXT)){
 
-                    // uncompress the data
-                    rldecode(raw, _inHeader.lDataLength, decodeBuffer, _inHeader.lUncompressedLength, 0x1B);
+                    MessageHandle handle = allocMessage(&_messages);
+                    Message* message = ::getMessage(&_messages, handle);
 
-                    Message* message = (Message*)decodeBuffer;
+                    // uncompress straight into the pooled message, anything but one whole message is dropped
+                    int decodeLen = 0;
+                    if(message != NULL){
+                        decodeLen = rldecode(raw, _inHeader.lDataLength, (uint8_t*)message, sizeof(Message), _inHeader.bEscapeCode);
+                    }
 
                     // validate checksum
-                    if(message->checksum = checksum((uint8_t*)message, sizeof(Message), _checksumDivisor)){
-                        enQueue(&_queue, message);
+                    if(decodeLen == (int)sizeof(Message) && (message->checksum = checksum((uint8_t*)message, sizeof(Message), _checksumDivisor))){
+                        qDebug() << message->msg << "\n";
                         insertIntoPhoneBook(&_log, message);
+                        if(enQueue(&_queue, handle) != SUCCESS) ::releaseMessage(&_messages, handle);
                         emit onQueueUpdate(_queue.size);
-                        qDebug() << message->msg << "\n";
                     }
-                }
-                else if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO)){
-                    qDebug() << "decode audio broadcast";
-
-                    // uncompress the data
-                    rldecode(raw, _inHeader.lDataLength, decodeBuffer, _inHeader.lUncompressedLength, 0xFF);
-
-                    QByteArray audioBuffer;
-                    audioBuffer.append((char*)decodeBuffer, _inHeader.lDataLength);
-
-                    emit onAudioReceived(audioBuffer);
+                    else{
+                        ::releaseMessage(&_messages, handle);
+                    }
                 }
                 else if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO_STREAM)){
                     qDebug() << "decode audio stream";
 
-                    // decompress data
-                    rldecode(raw, _inHeader.lDataLength, decodeBuffer, _inHeader.lUncompressedLength, 0xFF);
+                    // decompress into the reused buffer, no larger than the codes received can expand to
+                    _decodeBuffer.resize((int)qMin((qint64)_inHeader.lUncompressedLength,
+                                                   (qint64)_inHeader.lDataLength * SERIAL_RLE_MAX_EXPANSION));
 
-                    QByteArray audioBuffer;
-                    audioBuffer.append((char*)decodeBuffer, _inHeader.lDataLength);
+                    int decodeLen = rldecode(raw, _inHeader.lDataLength, (uint8_t*)_decodeBuffer.data(), _decodeBuffer.size(),
+                                             _inHeader.bEscapeCode);
+                    _decodeBuffer.resize(decodeLen);
 
-                    emit onAudioStreamReceived(audioBuffer);
+                    QByteArray audioBuffer = _codec.decode(_decodeBuffer, _inHeader.bAudioCodec, _inHeader.bRateDivisor, _inHeader.lSampleRate,
+                                                _inHeader.bChannels, _inHeader.bSampleSize, &_streamResamplers[_inHeader.bSenderId]);
+                    noteStreamReceived(received);
+                    emit onAudioStreamReceived(audioBuffer, _inHeader.bSenderId, _inHeader.wSequence, _inHeader.lTimestamp);
                 }
 
-               // free(decodeBuffer);
-
             }else{
                 qDebug() << "No compression";
 
@@ -201,33 +285,30 @@ void SerialCom::onDataReceived()
                 if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_TEXT)){
                     qDebug() << "Uncompressed text";
 
-                    Message* message = (Message*) malloc(sizeof(Message));
+                    MessageHandle handle = allocMessage(&_messages);
+                    Message* message = ::getMessage(&_messages, handle);
 
-                    _receiveBuffer.read((char*)message, sizeof(Message));
+                    if(message != NULL){
+                        _receiveBuffer.read((char*)message, sizeof(Message));
 
-                    // validate checksum
-                   // if(message->checksum == checksum((uint8_t*)message, sizeof(Message), _checksumDivisor)){
-                        enQueue(&_queue, message);
-                        emit onQueueUpdate(_queue.size);
+                        // validate checksum
+                       // if(message->checksum == checksum((uint8_t*)message, sizeof(Message), _checksumDivisor)){
+                            qDebug() << message->msg << "\n";
 
-                        qDebug() << message->msg << "\n";
-                   // }
-
-                }
-                // Uncompressed Audio Message
-                else if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO)){
-                    qDebug() << "Receive Uncompressed Audio Message";
-
-                    // send the audio buffer to the broadcast player
-                    QByteArray audioBuffer = _receiveBuffer.read(_inHeader.lDataLength);
-                    emit onAudioReceived(audioBuffer);
+                            if(enQueue(&_queue, handle) != SUCCESS) ::releaseMessage(&_messages, handle);
+                            emit onQueueUpdate(_queue.size);
+                       // }
+                    }
 
                 }
                 // Uncompressed audio stream
                 else if(isBitSet(_inHeader.bDecodeOpts, MSG_TYPE_AUDIO_STREAM)){
 
                     QByteArray audioBuffer = _receiveBuffer.read(_inHeader.lDataLength);
-                    emit onAudioStreamReceived(audioBuffer);
+                    audioBuffer = _codec.decode(audioBuffer, _inHeader.bAudioCodec, _inHeader.bRateDivisor, _inHeader.lSampleRate,
+                                                _inHeader.bChannels, _inHeader.bSampleSize, &_streamResamplers[_inHeader.bSenderId]);
+                    noteStreamReceived(received);
+                    emit onAudioStreamReceived(audioBuffer, _inHeader.bSenderId, _inHeader.wSequence, _inHeader.lTimestamp);
 
                 }
             }
@@ -236,32 +317,28 @@ void SerialCom::onDataReceived()
             _isProcessingPacket = false;
             removeProcessedData(_receiveBuffer, _inHeader.lDataLength);
         }
-
     }
 
+    // a whole frame is done, the next may already be in the buffer
+    return !_isProcessingPacket;
 }
 
-void SerialCom::write(QByteArray buffer, uint8_t receiverId, bool useHeader, uint8_t decodeOptions)
+void SerialCom::write(QByteArray buffer, uint8_t receiverId, bool useHeader, uint8_t decodeOptions, uint8_t audioCodec, uint32_t timestamp)
 {
     qDebug() << "Serial Write";
     QBuffer outData;
     outData.open(QIODevice::ReadWrite);
+    // audio written after the framing without copying it into outData
+    QByteArray payload;
+    // time a stream chunk was encoded, for its latency
+    qint64 encoded = -1;
 
-    FrameHeader outHeader;
-    outHeader.lSignature = FRAME_SIGNATURE;
-    outHeader.lSignature2 = FRAME_SIGNATURE;
-    outHeader.bVersion = 1;
-    outHeader.bEncryptionKey = (uint8_t)'Q';
+    FrameHeader outHeader = createHeader(receiverId, decodeOptions);
 
     if(useHeader){
         qDebug() << "Using Framed Data";
-        // fill initial header data
-        outHeader.bReceiverId = receiverId;
         qDebug() << "send: receiver: " << receiverId;
 
-        outHeader.bDecodeOpts = 0;
-        set(outHeader.bDecodeOpts, decodeOptions);
-
         // handle text message
         if(isBitSet(decodeOptions, MSG_TYPE_TEXT)){
             qDebug() << "Sending Text";
@@ -271,7 +348,7 @@ void SerialCom::write(QByteArray buffer, uint8_t receiverId, bool useHeader, uin
             memset(message.msg, '\0', BUFFER_MAX);
             message.receiverID = receiverId;
             message.priority = 1;
-            message.senderID = rand() % 5;
+            message.senderID = (uint16_t)_stationId;
             message.timestamp = (uint32_t) QDateTime::currentDateTimeUtc().toTime_t();
 
             memcpy(message.msg, buffer.data(), BUFFER_MAX);
@@ -287,8 +364,13 @@ void SerialCom::write(QByteArray buffer, uint8_t receiverId, bool useHeader, uin
                 if(isBitSet(decodeOptions, COMPRESS_TYPE_RLE)){
                     qDebug() << "RL Encoding";
 
-                    uint8_t* encodedBuffer = (uint8_t*) malloc(sizeof(Message));
-                    int iEncodeLen = rlencode((uint8_t*)&message, sizeof(Message), encodedBuffer, sizeof(Message), 27);
+                    // escape with the least used byte, each occurrence of it costs one extra byte
+                    uint32_t escCount;
+                    outHeader.bEscapeCode = rlescape((uint8_t*)&message, sizeof(Message), &escCount);
+
+                    int maxEncodeLen = sizeof(Message) + escCount;
+                    uint8_t* encodedBuffer = (uint8_t*) malloc(maxEncodeLen);
+                    int iEncodeLen = rlencode((uint8_t*)&message, sizeof(Message), encodedBuffer, maxEncodeLen, outHeader.bEscapeCode);
 
                     outHeader.lUncompressedLength = sizeof(Message);
                     outHeader.lDataLength = iEncodeLen;
@@ -300,7 +382,7 @@ void SerialCom::write(QByteArray buffer, uint8_t receiverId, bool useHeader, uin
                     else
                         outData.write((char*)encodedBuffer, iEncodeLen);
 
-                  //  free(encodedBuffer);
+                    free(encodedBuffer);
 
                 }
 
@@ -324,60 +406,329 @@ void SerialCom::write(QByteArray buffer, uint8_t receiverId, bool useHeader, uin
         else if(isBitSet(decodeOptions, MSG_TYPE_AUDIO) || isBitSet(decodeOptions, MSG_TYPE_AUDIO_STREAM)){
             qDebug() << "Send Audio";
 
-            if(isBitSet(decodeOptions, COMPRESS_TYPE_HUFF) || isBitSet(decodeOptions, COMPRESS_TYPE_RLE)){
-
-                if(isBitSet(decodeOptions, COMPRESS_TYPE_RLE)){
-                    qDebug() << "RLE compression";
-
-                    int len = buffer.length();
-
-                    uint8_t* encodedBuffer = (uint8_t*) malloc(len * sizeof(uint8_t));
-                    int iEncodeLen = rlencode((uint8_t*)buffer.data(), len, encodedBuffer, len, 0xFF);
+            // the receiver orders and paces stream chunks by these
+            if(isBitSet(decodeOptions, MSG_TYPE_AUDIO_STREAM)){
+                outHeader.wSequence = _streamSequence++;
+                outHeader.lTimestamp = timestamp;
+            }
 
-                    outHeader.lUncompressedLength = len;
-                    outHeader.lDataLength = iEncodeLen;
+            // let the rate controller pick the stream tier, the header tells the receiver which one
+            if(_adaptiveStreamRate && isBitSet(decodeOptions, MSG_TYPE_AUDIO_STREAM) && audioCodec != AUDIO_CODEC_SILENCE){
+                // fragments queued behind the stream are not the stream outgrowing the link
+                const StreamRateController::Tier& tier = _rateController.update(_serial->bytesToWrite() - bulkBytesToWrite());
+                audioCodec = tier.codec;
+                outHeader.bRateDivisor = tier.divisor;
+            }
 
-                    qDebug() << "Uncompressed: " << outHeader.lUncompressedLength;
-                    qDebug() << "Data Length : " << outHeader.lDataLength;
-                    qDebug() << "Compression Ratio: " << ((float)outHeader.lUncompressedLength/(float)outHeader.lDataLength);
+            // stream chunks are converted as one stream, anything else on its own
+            Resampler* resampler = NULL;
+            if(isBitSet(decodeOptions, MSG_TYPE_AUDIO_STREAM)) resampler = &_streamResampler;
 
-                    outData.write((char*)&outHeader, sizeof(FrameHeader));
+            encodeAudioPayload(outHeader, buffer, decodeOptions, audioCodec, _codec, resampler);
 
-                    if(isBitSet(decodeOptions, ENCRYPT_TYPE_XOR))
-                        encryptXOR(outData, encodedBuffer, iEncodeLen, outHeader.bEncryptionKey);
-                    else
-                        outData.write((char*)encodedBuffer, iEncodeLen);
+            if(isBitSet(decodeOptions, MSG_TYPE_AUDIO_STREAM)){
+                encoded = AudioEndpoints::elapsed();
+                int encodeMs = (int32_t)((uint32_t)encoded - outHeader.lTimestamp);
 
-                   // free(encodedBuffer);
-                }
+                // the receiver cannot see the sender's clock, tell it how long the chunk will have waited
+                int queuedMs = (_linkBytesPerSecond > 0) ? (int)((_serial->bytesToWrite() * 1000) / _linkBytesPerSecond) : 0;
+                int senderDelay = encodeMs + queuedMs;
+                outHeader.wSenderDelay = (senderDelay < 0) ? 0 : ((senderDelay > 0xFFFF) ? 0xFFFF : senderDelay);
 
-            }
-            // uncompressed audio
-            else{
-                outHeader.lDataLength = buffer.length();
-                outHeader.lUncompressedLength = buffer.length();
-                outData.write((char*)&outHeader, sizeof(FrameHeader));
-                outData.write(buffer);
+                if(_latency != NULL) _latency->record(LatencyMonitor::Encode, encodeMs);
             }
 
+            // the payload goes out after the header without being copied into outData
+            outData.write((char*)&outHeader, sizeof(FrameHeader));
+            payload = buffer;
         }
     }
     else{
         outData.write(buffer);
     }
 
-    // write out to serial
-    qDebug() << "written bytes: " << _serial->write(outData.buffer()) << "\n";
+    // write out to serial, the audio payload goes straight from its buffer
+    qint64 written = _serial->write(outData.buffer());
+    if(!payload.isEmpty()) written += _serial->write(payload);
+
+    // the chunk is transmitted once the port has written everything queued up to its end
+    if(encoded >= 0 && _latency != NULL){
+        SentChunk chunk;
+        chunk.end = _bytesSent + _serial->bytesToWrite();
+        chunk.encoded = encoded;
+        _inFlight.append(chunk);
+    }
+
+    qDebug() << "written bytes: " << written << "\n";
     outData.close();
 }
 
-Message* SerialCom::getNextMessageFromQueue()
+FrameHeader SerialCom::createHeader(uint8_t receiverId, uint8_t decodeOptions) const
 {
-    Message* message = deQueue(&_queue);
+    FrameHeader header;
+    header.lSignature = FRAME_SIGNATURE;
+    header.lSignature2 = FRAME_SIGNATURE;
+    header.lDataLength = 0;
+    header.lUncompressedLength = 0;
+    header.bReceiverId = receiverId;
+    header.bVersion = FRAME_VERSION;
+    header.bEncryptionKey = (uint8_t)'Q';
+    header.bDecodeOpts = 0;
+    set(header.bDecodeOpts, decodeOptions);
+    header.bEscapeCode = DEFAULT_ESC;
+    header.bAudioCodec = AUDIO_CODEC_PCM;
+    header.bRateDivisor = 1;
+    header.bPriority = BROADCAST_PRIORITY_NORMAL;
+    header.bSenderId = (uint8_t)_stationId;
+    header.bFragment = FRAGMENT_FIRST | FRAGMENT_LAST;
+    header.wSequence = 0;
+    header.lTimestamp = 0;
+    header.wSenderDelay = 0;
+    header.lSampleRate = 0;
+    header.bChannels = 0;
+    header.bSampleSize = 0;
+
+    return header;
+}
+
+void SerialCom::encodeAudioPayload(FrameHeader& header, QByteArray& audio, uint8_t decodeOptions, uint8_t audioCodec,
+                                   const AudioCodec& codec, Resampler* resampler, bool last)
+{
+    // encode before compressing
+    header.bAudioCodec = codec.getWireCodec(audioCodec);
+    header.lSampleRate = codec.getWireRate();
+    header.bChannels = (uint8_t)codec.getChannelCount();
+    header.bSampleSize = (uint8_t)codec.getSampleSize();
+    audio = codec.encode(audio, audioCodec, header.bRateDivisor, resampler, last);
+
+    const int len = audio.length();
+    header.lUncompressedLength = len;
+
+    if(isBitSet(decodeOptions, COMPRESS_TYPE_RLE)){
+        // escape with the least used byte, each occurrence of it costs one extra byte
+        uint32_t escCount;
+        header.bEscapeCode = rlescape((const uint8_t*)audio.constData(), len, &escCount);
+
+        int maxEncodeLen = len + escCount;
+        QByteArray encoded(maxEncodeLen, 0);
+        int iEncodeLen = rlencode((uint8_t*)audio.constData(), len, (uint8_t*)encoded.data(), maxEncodeLen, header.bEscapeCode);
+        encoded.resize(iEncodeLen);
+
+        qDebug() << "RLE compression: " << len << " to " << iEncodeLen << " bytes, escape " << header.bEscapeCode
+                 << " used " << escCount << " times";
+
+        audio = encoded;
+    }
+
+    header.lDataLength = audio.length();
+
+    if(isBitSet(decodeOptions, ENCRYPT_TYPE_XOR)){
+        // in place rather than a byte at a time through a QBuffer
+        uint8_t* data = (uint8_t*)audio.data();
+        const int n = audio.length();
+        int i;
+
+        for(i = 0; i < n; ++i) data[i] ^= header.bEncryptionKey;
+    }
+}
+
+void SerialCom::writeBroadcast(const QByteArray& clip, uint8_t receiverId, uint8_t decodeOptions, uint8_t audioCodec)
+{
+    qDebug() << "Send broadcast of " << clip.size() << " bytes";
+
+    BroadcastEncoder::Job job;
+    // the worker reads the clip while the next recording may reuse the storage, one copy costs little
+    // next to the encode
+    job.clip = QByteArray(clip.constData(), clip.size());
+    job.header = createHeader(receiverId, decodeOptions);
+    job.decodeOptions = decodeOptions;
+    job.audioCodec = audioCodec;
+    job.codec = _codec;
+
+    // a fragment holds the link for about as long as the backlog a stream frame may wait behind
+    const qint64 backlog = ((qint64)_linkBytesPerSecond * SERIAL_BULK_BACKLOG_MS) / 1000 - sizeof(FrameHeader);
+    job.payloadBytes = (_linkBytesPerSecond <= 0 || backlog > INT_MAX) ? INT_MAX : (int)backlog;
+    if(job.payloadBytes < BROADCAST_MIN_PAYLOAD_BYTES) job.payloadBytes = BROADCAST_MIN_PAYLOAD_BYTES;
+
+    _encoder->submit(job);
+}
+
+void SerialCom::onBroadcastFragmentReady(QByteArray frame)
+{
+    // encoded before the session closed
+    if(!_serial->isOpen()) return;
+
+    _bulkPending.append(frame);
+    writeBulk();
+}
+
+void SerialCom::writeBulk()
+{
+    // frames cannot be split, so a stream frame waits for at most the fragment being sent, which is
+    // sized to the backlog
+    const qint64 backlog = ((qint64)_linkBytesPerSecond * SERIAL_BULK_BACKLOG_MS) / 1000;
+
+    while(!_bulkPending.isEmpty() && _serial->bytesToWrite() <= backlog){
+        SentFragment fragment;
+        fragment.start = _bytesSent + _serial->bytesToWrite();
+
+        qint64 written = _serial->write(_bulkPending.takeFirst());
+        qDebug() << "broadcast fragment written: " << written;
+
+        if(written <= 0) continue;
+
+        fragment.end = fragment.start + written;
+        _bulkInFlight.append(fragment);
+    }
+}
+
+qint64 SerialCom::bulkBytesToWrite() const
+{
+    qint64 bytes = 0;
+    int i;
+
+    for(i = 0; i < _bulkInFlight.size(); ++i){
+        const SentFragment& fragment = _bulkInFlight[i];
+        bytes += fragment.end - ((fragment.start > _bytesSent) ? fragment.start : _bytesSent);
+    }
+
+    return bytes;
+}
+
+void SerialCom::beginBroadcastFrame()
+{
+    const uint8_t sender = _inHeader.bSenderId;
+
+    _payloadReceived = 0;
+    _payloadDecoded = 0;
+    _rlePending.resize(0);
+    _wirePending.resize(0);
+
+    if(_inHeader.bFragment & FRAGMENT_FIRST){
+        // a new broadcast ends one the sender never finished
+        if(_broadcastNextFragment.contains(sender)) endBroadcast(sender);
+
+        _broadcastNextFragment.insert(sender, 0);
+        _broadcastResamplers[sender].reset();
+
+        QByteArray none;
+        emit onBroadcastDataReceived(none, sender, _inHeader.bPriority, FRAGMENT_FIRST);
+    }
+
+    _fragmentValid = _broadcastNextFragment.contains(sender) && _broadcastNextFragment.value(sender) == _inHeader.wSequence;
+
+    // a missing fragment ends the broadcast with what was received
+    if(!_fragmentValid && _broadcastNextFragment.contains(sender)){
+        qDebug() << "Broadcast fragment " << _inHeader.wSequence << " from " << sender << " out of order";
+        endBroadcast(sender);
+    }
+}
+
+void SerialCom::receiveBroadcastData()
+{
+    const uint8_t sender = _inHeader.bSenderId;
+
+    qint64 n = _receiveBuffer.size();
+    if(n > _inHeader.lDataLength - _payloadReceived) n = _inHeader.lDataLength - _payloadReceived;
+
+    QByteArray bytes;
+    if(n > 0){
+        _receiveBuffer.reset();
+        bytes = _receiveBuffer.read(n);
+        removeProcessedData(_receiveBuffer, n);
+        _payloadReceived += n;
+    }
+
+    const bool complete = (_payloadReceived >= _inHeader.lDataLength);
+
+    if(_fragmentValid){
+        if(isBitSet(_inHeader.bDecodeOpts, ENCRYPT_TYPE_XOR)){
+            uint8_t* data = (uint8_t*)bytes.data();
+            int i;
+
+            for(i = 0; i < bytes.size(); ++i) data[i] ^= _inHeader.bEncryptionKey;
+        }
+
+        if(isBitSet(_inHeader.bDecodeOpts, COMPRESS_TYPE_RLE)){
+            // decode the whole codes received so far, a code cut off at the end waits for the rest
+            _rlePending.append(bytes);
+
+            // into the reused buffer, no larger than what the pending codes can expand to
+            qint64 maxDecodeLen = qMin((qint64)_inHeader.lUncompressedLength - _payloadDecoded,
+                                       (qint64)_rlePending.size() * SERIAL_RLE_MAX_EXPANSION);
+            if(maxDecodeLen < 0) maxDecodeLen = 0;
+
+            if(_decodeBuffer.size() < maxDecodeLen) _decodeBuffer.resize((int)maxDecodeLen);
+            int consumed;
+            int decodeLen = rldecodepartial((const uint8_t*)_rlePending.constData(), _rlePending.size(),
+                                            (uint8_t*)_decodeBuffer.data(), (int)maxDecodeLen, _inHeader.bEscapeCode, &consumed);
+
+            _rlePending.remove(0, consumed);
+            _wirePending.append(_decodeBuffer.constData(), decodeLen);
+            _payloadDecoded += decodeLen;
+        }
+        else{
+            _wirePending.append(bytes);
+        }
+
+        // pass on the audio that decodes on its own, everything once the frame is complete
+        int unit = _codec.getDecodeUnit(_inHeader.bAudioCodec, _inHeader.bChannels, _inHeader.bSampleSize);
+        int ready = _wirePending.size();
+        if(!complete) ready = (unit > 0) ? ready - (ready % unit) : 0;
+
+        if(ready > 0){
+            QByteArray audio = _codec.decode(_wirePending.left(ready), _inHeader.bAudioCodec, _inHeader.bRateDivisor,
+                                             _inHeader.lSampleRate, _inHeader.bChannels, _inHeader.bSampleSize,
+                                             &_broadcastResamplers[sender]);
+            _wirePending.remove(0, ready);
+
+            emit onBroadcastDataReceived(audio, sender, _inHeader.bPriority, 0);
+        }
+
+        if(complete){
+            _broadcastNextFragment.insert(sender, _inHeader.wSequence + 1);
+            if(_inHeader.bFragment & FRAGMENT_LAST) endBroadcast(sender);
+        }
+    }
+
+    if(complete){
+        qDebug() << "Broadcast fragment " << _inHeader.wSequence << " received";
+        _isProcessingPacket = false;
+    }
+}
+
+void SerialCom::endBroadcast(uint8_t sender)
+{
+    // the rate conversion holds back the end of the audio until it is told there is no more
+    if(_broadcastResamplers.contains(sender)){
+        QByteArray tail = _codec.flush(&_broadcastResamplers[sender]);
+        if(!tail.isEmpty()) emit onBroadcastDataReceived(tail, sender, _inHeader.bPriority, 0);
+    }
+
+    _broadcastNextFragment.remove(sender);
+    _broadcastResamplers.remove(sender);
+
+    QByteArray none;
+    emit onBroadcastDataReceived(none, sender, _inHeader.bPriority, FRAGMENT_LAST);
+}
+
+MessageHandle SerialCom::getNextMessageFromQueue()
+{
+    MessageHandle message = deQueue(&_queue);
     emit onQueueUpdate(_queue.size);
     return message;
 }
 
+Message* SerialCom::getMessage(MessageHandle handle)
+{
+    return ::getMessage(&_messages, handle);
+}
+
+void SerialCom::releaseMessage(MessageHandle handle)
+{
+    ::releaseMessage(&_messages, handle);
+}
+
 void SerialCom::encryptXOR(QBuffer& outBuffer, QBuffer &buffer, uint8_t key)
 {
     int size = buffer.size();
@@ -474,6 +825,52 @@ PhoneLog* SerialCom::getPhoneLog()
     return &_log;
 }
 
+void SerialCom::setAudioFormat(AudioSettings::Settings settings)
+{
+    _codec.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(), settings.companding);
+    _codec.setRates(settings.encoderSettings.sampleRate(), settings.wireSampleRate);
+
+    // tiers are priced at the rate audio goes out at
+    _rateController.setFormat(settings.sampleSize, settings.encoderSettings.channelCount(),
+                              _codec.getWireRate(), settings.companding != AUDIO_CODEC_PCM);
+}
+
+void SerialCom::setAdaptiveStreamRate(bool adaptive)
+{
+    _adaptiveStreamRate = adaptive;
+}
+
+void SerialCom::onBytesWritten(qint64 bytes)
+{
+    _rateController.onBytesWritten(bytes);
+
+    _bytesSent += bytes;
+
+    while(!_inFlight.isEmpty() && _inFlight.first().end <= _bytesSent){
+        SentChunk chunk = _inFlight.takeFirst();
+        if(_latency != NULL) _latency->record(LatencyMonitor::Transmit, (int)(AudioEndpoints::elapsed() - chunk.encoded));
+    }
+
+    while(!_bulkInFlight.isEmpty() && _bulkInFlight.first().end <= _bytesSent) _bulkInFlight.removeFirst();
+
+    writeBulk();
+}
+
+void SerialCom::noteStreamReceived(qint64 received)
+{
+    if(_latency == NULL) return;
+
+    int linkMs = (_linkBytesPerSecond > 0) ? (int)(((sizeof(FrameHeader) + _inHeader.lDataLength) * 1000) / _linkBytesPerSecond) : 0;
+
+    _latency->received(_inHeader.bSenderId, _inHeader.wSequence, _inHeader.wSenderDelay, linkMs, received, AudioEndpoints::elapsed());
+}
+
+void SerialCom::setLatencyMonitor(LatencyMonitor* monitor)
+{
+    _latency = monitor;
+    _inFlight = QList<SentChunk>();
+}
+
 void SerialCom::setStationId(int id)
 {
     _stationId = id;
@@ -481,6 +878,11 @@ void SerialCom::setStationId(int id)
 
 SerialCom::~SerialCom()
 {
+    // the encoder is deleted once its thread finishes
+    _encoderThread.quit();
+    _encoderThread.wait();
+
     delete _serial;
-    if(_queue.size > 0) deleteQueue(&_queue);
+    deleteQueue(&_queue);
+    destroyMessagePool(&_messages);
 }
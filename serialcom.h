@@ -15,12 +15,20 @@
 #include <QByteArray>
 #include <QBuffer>
 #include <QDateTime>
+#include <QThread>
+#include <QMap>
 
 #include "serialsettings.h"
+#include "audiosettings.h"
 #include "messagequeue.h"
 #include "phonebook.h"
+#include "audiocodec.h"
+#include "ratecontroller.h"
+#include "broadcastqueue.h"
+#include "latencymonitor.h"
 
 #define FRAME_SIGNATURE 0xDEADBEEF
+#define FRAME_VERSION   12 ///< Current version of the frame header
 #define DEBUG_SERIAL_OUT QString("DEADBEEF")
 
 #define READY_READ_SIZE sizeof(FrameHeader)
@@ -36,6 +44,9 @@
 #define COMPRESS_TYPE_RLE     0x06 ///< Run Length Encoding Compression
 #define COMPRESS_TYPE_HUFF    0x07 ///< Huffman Encoding Compression
 
+#define FRAGMENT_FIRST        0x01 ///< first fragment of a broadcast
+#define FRAGMENT_LAST         0x02 ///< last fragment of a broadcast
+
 //! Packet header for the outgoing data
 typedef struct frameHeader{
     uint32_t lSignature;          ///< Signature to verify the packet
@@ -46,6 +57,18 @@ typedef struct frameHeader{
     uint8_t  bVersion;            ///< the header version
     uint8_t  bEncryptionKey;      ///< the xor encryption key
     uint8_t  bDecodeOpts;         ///< Flags to specify how to decode message
+    uint8_t  bEscapeCode;         ///< RLE escape code chosen for the payload
+    uint8_t  bAudioCodec;         ///< codec of the audio payload
+    uint8_t  bRateDivisor;        ///< sample rate divisor of the audio payload
+    uint8_t  bPriority;           ///< playback priority of an audio broadcast
+    uint8_t  bSenderId;           ///< the id of the sender
+    uint8_t  bFragment;           ///< FRAGMENT_FIRST and FRAGMENT_LAST flags of a broadcast fragment
+    uint16_t wSequence;           ///< sequence number of a stream chunk or broadcast fragment
+    uint32_t lTimestamp;          ///< capture time of a stream chunk in milliseconds
+    uint16_t wSenderDelay;        ///< milliseconds from capture until a stream chunk reaches the link
+    uint32_t lSampleRate;         ///< sample rate of the audio payload before the divisor
+    uint8_t  bChannels;           ///< channel count of the audio payload, 0 for the receiver's own
+    uint8_t  bSampleSize;         ///< bits per sample of PCM audio, 0 for the receiver's own
 }FrameHeader;
 
 /**
@@ -53,6 +76,8 @@ typedef struct frameHeader{
 
     Handle read, write, queuing, framing, etc
 */
+class BroadcastEncoder;
+
 class SerialCom : public QObject
 {
     Q_OBJECT
@@ -70,14 +95,37 @@ signals:
     void onQueueUpdate(int numQueued);
 
     /**
-        Emmitted when an audio broadcast is received
+        Emmitted as an audio broadcast arrives, its audio is decoded as the bytes come in
+
+        @param sender
+            id of the sending station
+
+        @param priority
+            playback priority of the broadcast
+
+        @param flags
+            FRAGMENT_FIRST when a broadcast starts and FRAGMENT_LAST when it ends, both with no audio
     */
-    void onAudioReceived(QByteArray&);
+    void onBroadcastDataReceived(QByteArray&, quint8 sender, quint8 priority, quint8 flags);
+
+    /**
+        Emmitted when the last fragment of a sent broadcast has been encoded, the recording is no longer read
+    */
+    void onBroadcastSent();
 
     /**
         Emmitted when part of an audio stream is received
+
+        @param sender
+            id of the sending station
+
+        @param sequence
+            sequence number of the chunk
+
+        @param timestamp
+            sender time of the chunk in milliseconds
     */
-    void onAudioStreamReceived(QByteArray&);
+    void onAudioStreamReceived(QByteArray&, quint8 sender, quint16 sequence, quint32 timestamp);
 
 public slots:
     /**
@@ -85,10 +133,24 @@ public slots:
     */
     void onDataReceived();
 
+    /**
+        Called when the serial port has written data to the link
+    */
+    void onBytesWritten(qint64 bytes);
+
+    /**
+        Called when the encoder has finished a fragment of a broadcast, the fragment waits its turn for the
+        port behind stream frames
+    */
+    void onBroadcastFragmentReady(QByteArray frame);
+
 public:
     /**
         Opens the serial port
 
+        The port named LOOPBACK_PORT_NAME is a loopback link that reads back what is written, for
+        runs without serial hardware
+
         @param settings
             The Serial settings to configure the serial port with
 
@@ -97,7 +159,7 @@ public:
     bool open(SerialSettings::Settings settings);
 
     /**
-        Close the serial port
+        Close the serial port, a broadcast still going out is dropped
     */
     void close();
 
@@ -106,13 +168,79 @@ public:
 
         @param data
             data to be written to the serial port
+
+        @param audioCodec
+            codec to encode audio with before compression
+
+        @param timestamp
+            capture time of a stream chunk in milliseconds
+    */
+    void write(QByteArray data, uint8_t receiverId, bool useHeader, uint8_t decodeOptions, uint8_t audioCodec = AUDIO_CODEC_PCM, uint32_t timestamp = 0);
+
+    /**
+        Send a recorded broadcast in fragments. The fragments are encoded on a worker thread and each is
+        written as soon as it is ready, onBroadcastSent is emitted after the last.
+
+        @param clip
+            recorded audio, copied
+
+        @param decodeOptions
+            compression and encryption of the fragments
+
+        @param audioCodec
+            codec to encode audio with before compression
+    */
+    void writeBroadcast(const QByteArray& clip, uint8_t receiverId, uint8_t decodeOptions, uint8_t audioCodec = AUDIO_CODEC_PCM);
+
+    /**
+        Encode, compress and encrypt audio into a frame payload, and fill in the payload fields of the header
+
+        @param header
+            header of the frame, bRateDivisor and bEncryptionKey must be set
+
+        @param audio
+            captured audio, replaced by the payload
+
+        @param decodeOptions
+            compression and encryption to apply
+
+        @param audioCodec
+            codec to encode the audio with
+
+        @param codec
+            converts the captured audio
+
+        @param resampler
+            carries the rate conversion between the pieces of a stream or broadcast, NULL if the audio is
+            sent whole
+
+        @param last
+            the audio ends with this payload, the last fragment of a broadcast
+    */
+    static void encodeAudioPayload(FrameHeader& header, QByteArray& audio, uint8_t decodeOptions, uint8_t audioCodec,
+                                   const AudioCodec& codec, Resampler* resampler = NULL, bool last = false);
+
+    /**
+        @return handle to the next message in the queue, owned by the caller, or MESSAGE_HANDLE_NONE if the
+        queue is empty
     */
-    void write(QByteArray data, uint8_t receiverId, bool useHeader, uint8_t decodeOptions);
+    MessageHandle getNextMessageFromQueue();
 
     /**
-        @return the next message in the queue
+        @param handle
+            handle to a received message
+
+        @return the message, or NULL if the handle was released
+    */
+    Message* getMessage(MessageHandle handle);
+
+    /**
+        Give a received message back once it is finished with
+
+        @param handle
+            handle to the message
     */
-    Message* getNextMessageFromQueue();
+    void releaseMessage(MessageHandle handle);
 
     /**
         Calculate a checksum of the data
@@ -143,6 +271,22 @@ public:
     */
     PhoneLog* getPhoneLog();
 
+    /**
+        Set the local audio format, sent audio is encoded from it and received audio is decoded to it
+
+        @param settings
+            the audio settings
+    */
+    void setAudioFormat(AudioSettings::Settings settings);
+
+    /**
+        Adapt the codec and sample rate of outgoing streams to the link
+
+        @param adaptive
+            true to enable
+    */
+    void setAdaptiveStreamRate(bool adaptive);
+
     /**
         Set the id of this station
 
@@ -151,20 +295,40 @@ public:
     */
     void setStationId(int id);
 
+    /**
+        Measure the latency of sent and received streams
+
+        @param monitor
+            records the delays, NULL to stop measuring
+    */
+    void setLatencyMonitor(LatencyMonitor* monitor);
+
 private:
     //! serial port access
     QSerialPort* _serial;
     //! serial data buffer
     QBuffer _receiveBuffer;
 
+    /**
+        Replace the port with a device or loopback port, if it is not that kind already
+
+        @param loopback
+            true for the loopback link
+    */
+    void usePort(bool loopback);
+
     //! Header of the frame currently in process
     FrameHeader _inHeader;
     //! flag indicating whether a packet is currently being processed
     bool _isProcessingPacket;
+    //! the frame in process is for another station and is passed over
+    bool _skipPacket;
 
     //! FInd the header before processing data
     bool _useHeader;
 
+    //! storage of the received messages
+    MessagePool _messages;
     //! queue for the incoming messages
     MessageQueue _queue;
     //! added to log time and number of messages per sender
@@ -176,6 +340,114 @@ private:
     //! Divisor used for checksum
     uint8_t _checksumDivisor;
 
+    //! Converts audio to and from the wire format
+    AudioCodec _codec;
+    //! converts the rate of the outgoing stream
+    Resampler _streamResampler;
+    //! convert the rate of each sender's incoming stream
+    QMap<uint8_t, Resampler> _streamResamplers;
+
+    //! Picks the stream tier from link throughput and backlog
+    StreamRateController _rateController;
+    //! Use the rate controller for outgoing streams
+    bool _adaptiveStreamRate;
+
+    //! sequence number of the next outgoing stream chunk
+    uint16_t _streamSequence;
+
+    //! An outgoing stream chunk not yet written to the link
+    struct SentChunk{
+        qint64 end;     ///< bytes written to the port once the chunk is out
+        qint64 encoded; ///< time the chunk was encoded
+    };
+
+    //! records stream latency, NULL if not measuring
+    LatencyMonitor* _latency;
+    //! stream chunks waiting for the port to write them
+    QList<SentChunk> _inFlight;
+    //! broadcast fragments waiting for the port
+    QList<QByteArray> _bulkPending;
+
+    //! A broadcast fragment written to the port
+    struct SentFragment{
+        qint64 start; ///< bytes written to the port once the fragment starts going out
+        qint64 end;   ///< bytes written to the port once the fragment is out
+    };
+    //! broadcast fragments the port is still writing
+    QList<SentFragment> _bulkInFlight;
+    //! bytes the port has written since it was opened
+    qint64 _bytesSent;
+    //! bytes per second the link carries
+    int _linkBytesPerSecond;
+
+    //! encodes outgoing broadcasts
+    BroadcastEncoder* _encoder;
+    //! runs the broadcast encoder
+    QThread _encoderThread;
+
+    //! next fragment expected from each sender with a broadcast in progress
+    QMap<uint8_t, uint16_t> _broadcastNextFragment;
+    //! convert the rate of each broadcast in progress
+    QMap<uint8_t, Resampler> _broadcastResamplers;
+    //! the broadcast frame being received continues its sender's broadcast
+    bool _fragmentValid;
+    //! payload bytes of the broadcast frame taken from the receive buffer
+    qint64 _payloadReceived;
+    //! bytes of the broadcast frame RLE decoded so far
+    qint64 _payloadDecoded;
+    //! RLE codes cut off by the end of the bytes received so far
+    QByteArray _rlePending;
+    //! decoded bytes short of a whole codec unit
+    QByteArray _wirePending;
+    //! RLE payloads are decoded into this, reused from frame to frame
+    QByteArray _decodeBuffer;
+
+    /**
+        @return a header with the fields common to every frame filled in
+    */
+    FrameHeader createHeader(uint8_t receiverId, uint8_t decodeOptions) const;
+
+    /**
+        Write waiting broadcast fragments while the port's backlog is short, so stream frames written in
+        between go out without waiting behind a whole broadcast
+    */
+    void writeBulk();
+
+    /**
+        @return bytes of broadcast fragments waiting in the port, not part of the stream's backlog
+    */
+    qint64 bulkBytesToWrite() const;
+
+    /**
+        Record the latency of the stream frame just received and decoded
+
+        @param received
+            time the whole frame was received
+    */
+    void noteStreamReceived(qint64 received);
+
+    /**
+        Start receiving a broadcast frame, called once its header is accepted
+    */
+    void beginBroadcastFrame();
+
+    /**
+        Handle the next frame in the receive buffer
+
+        @return true if a whole frame was handled, so another may follow
+    */
+    bool processFrame();
+
+    /**
+        Decrypt, decode and pass on the payload of the broadcast frame received so far
+    */
+    void receiveBroadcastData();
+
+    /**
+        End the broadcast of a sender
+    */
+    void endBroadcast(uint8_t sender);
+
     /**
         XOR encrypt
 
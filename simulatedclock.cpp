@@ -0,0 +1,67 @@
+
+/**
+    @file simulatedclock.cpp
+    @breif Clock the headless audio endpoints run on
+    @author Natesh Narain
+*/
+
+#include "simulatedclock.h"
+
+#define CLOCK_DEFAULT_PERIOD_MS 10 ///< simulated milliseconds per period
+
+SimulatedClock::SimulatedClock(QObject *parent) : QObject(parent)
+{
+    _elapsed = 0;
+    _period = CLOCK_DEFAULT_PERIOD_MS;
+    _speed = 1.0;
+    _users = 0;
+
+    _timer.setTimerType(Qt::PreciseTimer);
+    connect(&_timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+
+    updateInterval();
+}
+
+void SimulatedClock::setPeriod(int ms)
+{
+    _period = (ms > 0) ? ms : 1;
+    updateInterval();
+}
+
+void SimulatedClock::setSpeed(double speed)
+{
+    _speed = (speed > 0) ? speed : 0;
+    updateInterval();
+}
+
+void SimulatedClock::updateInterval()
+{
+    // a zero interval fires whenever the event loop is free
+    _timer.setInterval((_speed > 0) ? (int)(_period / _speed) : 0);
+}
+
+qint64 SimulatedClock::elapsed() const
+{
+    return _elapsed;
+}
+
+void SimulatedClock::advance(int ms)
+{
+    _elapsed += ms;
+    emit tick(ms);
+}
+
+void SimulatedClock::acquire()
+{
+    if(_users++ == 0) _timer.start();
+}
+
+void SimulatedClock::release()
+{
+    if(_users > 0 && --_users == 0) _timer.stop();
+}
+
+void SimulatedClock::onTimeout()
+{
+    advance(_period);
+}
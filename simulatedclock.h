@@ -0,0 +1,85 @@
+#ifndef SIMULATEDCLOCK_H
+#define SIMULATEDCLOCK_H
+
+#include <QObject>
+#include <QTimer>
+
+/**
+    Clock the headless audio endpoints run on
+
+    Time advances in fixed periods, and each period the endpoints move that much audio. The clock can
+    follow real time, run faster or slower, or run as fast as the pipeline keeps up. It only runs while an
+    endpoint is active.
+*/
+class SimulatedClock : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SimulatedClock(QObject *parent = 0);
+
+    /**
+        @param ms
+            simulated milliseconds per period
+    */
+    void setPeriod(int ms);
+
+    /**
+        @param speed
+            simulated milliseconds per real millisecond, 0 runs as fast as possible
+    */
+    void setSpeed(double speed);
+
+    /**
+        @return simulated milliseconds since the clock was created
+    */
+    qint64 elapsed() const;
+
+    /**
+        Advance the clock by hand
+
+        @param ms
+            simulated milliseconds to move on
+    */
+    void advance(int ms);
+
+    /**
+        Start running for an endpoint, the clock runs while any endpoint holds it
+    */
+    void acquire();
+
+    /**
+        Stop running for an endpoint
+    */
+    void release();
+
+signals:
+    /**
+        Emitted each time the clock advances
+
+        @param ms
+            simulated milliseconds that passed
+    */
+    void tick(int ms);
+
+private slots:
+    void onTimeout();
+
+private:
+    //! drives the periods
+    QTimer _timer;
+    //! simulated time
+    qint64 _elapsed;
+    //! simulated milliseconds per period
+    int _period;
+    //! simulated milliseconds per real millisecond
+    double _speed;
+    //! endpoints running on the clock
+    int _users;
+
+    /**
+        Set the timer interval for the period and speed
+    */
+    void updateInterval();
+};
+
+#endif // SIMULATEDCLOCK_H
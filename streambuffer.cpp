@@ -1,87 +1,183 @@
 #include "streambuffer.h"
-#include <QMutexLocker>
+
+#include <cstring>
+#include <cstdlib>
 
 #include <QDebug>
 
-StreamBuffer::StreamBuffer(QObject *parent) : QBuffer(parent)
+#define STREAM_DEFAULT_CAPACITY 65536 ///< default ring size in bytes
+
+StreamBuffer::StreamBuffer(QObject *parent) : QIODevice(parent)
 {
-    _sync = new QMutex(QMutex::Recursive);
-    _readPos = 0;
+    _data = NULL;
+    _capacity = 0;
+    _policy = DropOldest;
+    _meter = NULL;
+
+    _head.store(0);
+    _tail.store(0);
+    _overflowBytes.store(0);
+
+    setCapacity(STREAM_DEFAULT_CAPACITY);
 }
 
-qint64 StreamBuffer::writeData(const char *data, qint64 len)
+void StreamBuffer::setCapacity(qint64 bytes)
+{
+    if(isOpen()){
+        qDebug() << "StreamBuffer: capacity can only be changed while closed";
+        return;
+    }
+
+    // a power of two lets the free running indices wrap with a mask
+    uint capacity = 1;
+    while(capacity < bytes && capacity < 0x40000000u) capacity <<= 1;
+
+    if(capacity == _capacity) return;
+
+    free(_data);
+    _data = (char*) malloc(capacity);
+    _capacity = capacity;
+
+    _head.store(0);
+    _tail.store(0);
+}
+
+void StreamBuffer::setOverflowPolicy(OverflowPolicy policy)
+{
+    _policy = policy;
+}
+
+void StreamBuffer::setLevelMeter(LevelMeter* meter)
+{
+    if(isOpen()){
+        qDebug() << "StreamBuffer: the level meter can only be changed while closed";
+        return;
+    }
+
+    _meter = meter;
+}
+
+qint64 StreamBuffer::capacity() const
 {
-    QMutexLocker locker(_sync);
+    return _capacity;
+}
 
-    // get the current position in the buffer
-    qint64 currentPos = pos();
-    // get the end position of the buffer
-    qint64 bufferSize = size();
+quint64 StreamBuffer::getOverflowBytes() const
+{
+    return _overflowBytes.load();
+}
 
-    // seek to the end
-    if(bufferSize == 0)
-        seek(0);
-    else
-        seek(bufferSize - 1);
+bool StreamBuffer::open(OpenMode mode)
+{
+    _head.store(0);
+    _tail.store(0);
+    _overflowBytes.store(0);
 
-    // write data to the end of the buffer
-    qint64 bytesWritten = QBuffer::writeData(data, len);
+    // reads go straight to the ring, QIODevice must not buffer ahead of the consumer
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
 
-    // seek back to the current position
-    seek(currentPos);
+qint64 StreamBuffer::writeData(const char *data, qint64 len)
+{
+    // the whole write is one period from the device
+    if(_meter != NULL) _meter->measure(data, len);
+
+    const uint head = _head.load();
+    uint tail = _tail.loadAcquire();
+    uint count = (uint)len;
+
+    if(count > _capacity){
+        // only the newest capacity bytes can ever be kept
+        if(_policy == DropOldest){
+            data += count - _capacity;
+            _overflowBytes.fetchAndAddRelaxed(count - _capacity);
+            count = _capacity;
+        }
+    }
 
-    return bytesWritten;
+    uint space = _capacity - (head - tail);
+
+    if(count > space){
+        if(_policy == DropNewest){
+            _overflowBytes.fetchAndAddRelaxed(count - space);
+            count = space;
+        }
+        else{
+            // push the consumer past the oldest audio, a read in progress sees the tail move and retries
+            uint needed = count - space;
+
+            while(!_tail.testAndSetOrdered(tail, tail + needed)){
+                tail = _tail.loadAcquire();
+                space = _capacity - (head - tail);
+                if(count <= space){
+                    needed = 0;
+                    break;
+                }
+                needed = count - space;
+            }
+
+            _overflowBytes.fetchAndAddRelaxed(needed);
+        }
+    }
+
+    copyIn(head, data, count);
+    _head.storeRelease(head + count);
+
+    // the whole write is accounted for, dropped bytes are counted as overflow
+    if(head == tail && count > 0) emit readyRead();
+
+    return len;
 }
 
 qint64 StreamBuffer::readData(char *data, qint64 maxlen)
 {
-    QMutexLocker locker(_sync);
+    uint tail;
+    uint count;
 
-    qint64 currentPos = pos();
+    do{
+        tail = _tail.loadAcquire();
+        const uint head = _head.loadAcquire();
 
-    seek(_readPos);
+        count = head - tail;
+        if(count > maxlen) count = (uint)maxlen;
 
-    qint64 bytesRead = QBuffer::readData(data, maxlen);
-    _readPos += bytesRead;
+        copyOut(tail, data, count);
 
-    seek(currentPos);
+        // the producer moved the tail while copying, the copy may be overwritten
+    }while(!_tail.testAndSetOrdered(tail, tail + count));
 
-    return bytesRead;
+    return count;
 }
 
-void StreamBuffer::removeChunk(qint64 offset)
+void StreamBuffer::copyIn(uint index, const char* data, uint len)
 {
-    qint64 remainingBytes = size() - offset;
+    const uint offset = index & (_capacity - 1);
+    const uint first = (len < _capacity - offset) ? len : _capacity - offset;
 
-    if(remainingBytes > 0){
-        reset();
-        seek(offset);
+    memcpy(_data + offset, data, first);
+    memcpy(_data, data + first, len - first);
+}
 
-        QByteArray array = read(remainingBytes);
+void StreamBuffer::copyOut(uint index, char* data, uint len) const
+{
+    const uint offset = index & (_capacity - 1);
+    const uint first = (len < _capacity - offset) ? len : _capacity - offset;
 
-        resetBuffer(array);
-        seek(remainingBytes);
-    }
-    else{
-        resetBuffer(QByteArray());
-    }
+    memcpy(data, _data + offset, first);
+    memcpy(data + first, _data, len - first);
 }
 
-void StreamBuffer::resetBuffer(QByteArray &buffer)
+bool StreamBuffer::isSequential() const
 {
-    if(!isOpen()){
-        reset();
-        setData(buffer);
-        _readPos = 0;
-    }
+    return true;
 }
 
-qint64 StreamBuffer::readPosition() const
+qint64 StreamBuffer::bytesAvailable() const
 {
-    return _readPos;
+    return (qint64)(_head.loadAcquire() - _tail.loadAcquire()) + QIODevice::bytesAvailable();
 }
 
 StreamBuffer::~StreamBuffer()
 {
-    delete _sync;
+    free(_data);
 }
@@ -1,44 +1,112 @@
 #ifndef STREAMBUFFER_H
 #define STREAMBUFFER_H
 
-#include <QBuffer>
-#include <QMutex>
+#include <QIODevice>
+#include <QAtomicInteger>
+
+#include "levelmeter.h"
+
+#define STREAM_CACHE_LINE 64 ///< size of a cache line, the indices are kept on separate lines
 
 /**
-    Thread synched buffer for simultaneous read\write access
+    Fixed capacity single producer, single consumer ring for streaming audio.
+
+    The audio device writes on one side and the stream reader drains the other, with no locks on
+    either side. Each side only stores its own index, the indices are padded onto separate cache lines
+    so the two threads do not contend for them.
 */
-class StreamBuffer : public QBuffer
+class StreamBuffer : public QIODevice
 {
     Q_OBJECT
 public:
+    //! What a write does when the ring is full
+    enum OverflowPolicy{
+        DropNewest, ///< keep the buffered audio, store as much of the write as fits
+        DropOldest  ///< discard the oldest audio to make room for the write
+    };
+
     explicit StreamBuffer(QObject *parent = 0);
     ~StreamBuffer(void);
 
     /**
-        Reimplementation of QBuffer::writeData()
+        Set the capacity, rounded up to a power of two. Must be called while the buffer is closed.
+
+        @param bytes
+            minimum number of bytes the ring holds
     */
-    qint64 writeData(const char *data, qint64 len);
+    void setCapacity(qint64 bytes);
 
     /**
-        Reimplementation of QBuffer::readData()
+        Set what happens when a write does not fit
+
+        @param policy
+            the overflow policy
     */
-    qint64 readData(char *data, qint64 maxlen);
+    void setOverflowPolicy(OverflowPolicy policy);
 
-    void removeChunk(qint64 offset);
-    void resetBuffer(QByteArray&);
+    /**
+        Measure the level of the audio written. Must be called while the buffer is closed.
 
-    qint64 readPosition() const;
+        @param meter
+            measures every write on the producer side, NULL to stop
+    */
+    void setLevelMeter(LevelMeter* meter);
 
-signals:
+    /**
+        @return the capacity of the ring in bytes
+    */
+    qint64 capacity() const;
 
-public slots:
+    /**
+        @return the number of bytes discarded because the ring was full
+    */
+    quint64 getOverflowBytes() const;
+
+    /**
+        Reimplemented QIODevice::open(), empties the ring
+    */
+    bool open(OpenMode mode);
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+protected:
+    /**
+        Reimplementation of QIODevice::writeData(), producer side
+    */
+    qint64 writeData(const char *data, qint64 len);
+
+    /**
+        Reimplementation of QIODevice::readData(), consumer side
+    */
+    qint64 readData(char *data, qint64 maxlen);
 
 private:
-    //! Position to read from
-    qint64 _readPos;
-    //! Thread synchronization
-    QMutex* _sync;
+    //! ring storage
+    char* _data;
+    //! capacity, a power of two
+    uint _capacity;
+    //! what a write does when the ring is full
+    OverflowPolicy _policy;
+    //! measures the audio written
+    LevelMeter* _meter;
+
+    //! total bytes written, only stored by the producer
+    QAtomicInteger<uint> _head;
+    char _headPad[STREAM_CACHE_LINE - sizeof(QAtomicInteger<uint>)];
+
+    //! total bytes read, stored by the consumer, and by the producer when dropping the oldest audio
+    QAtomicInteger<uint> _tail;
+    char _tailPad[STREAM_CACHE_LINE - sizeof(QAtomicInteger<uint>)];
 
+    //! bytes discarded on overflow
+    QAtomicInteger<uint> _overflowBytes;
+
+    /**
+        Copy between the ring and linear memory, handling the wrap
+    */
+    void copyIn(uint index, const char* data, uint len);
+    void copyOut(uint index, char* data, uint len) const;
 };
 
 #endif // STREAMBUFFER_H
@@ -0,0 +1,443 @@
+
+/**
+    @file streammixer.cpp
+    @breif Mixes the received streams of several senders
+    @author Natesh Narain
+*/
+
+#include "streammixer.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define MIXER_MAX_LEVEL  32767.0f  ///< largest mixed sample on the 16 bit scale
+#define MIXER_MIN_LEVEL -32768.0f  ///< smallest mixed sample on the 16 bit scale
+
+#if defined(__SSE2__)
+/**
+    Scale eight 16 bit samples and add them to the mix
+*/
+static inline void _accumulate8(__m128i x, float* acc, __m128 gain)
+{
+    // sign extend by placing each sample in the top half of a 32 bit lane
+    __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+    __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+
+    _mm_storeu_ps(acc,     _mm_add_ps(_mm_loadu_ps(acc),     _mm_mul_ps(lo, gain)));
+    _mm_storeu_ps(acc + 4, _mm_add_ps(_mm_loadu_ps(acc + 4), _mm_mul_ps(hi, gain)));
+}
+#elif defined(__ARM_NEON)
+static inline void _accumulate8(int16x8_t x, float* acc, float gain)
+{
+    float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+    float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+
+    vst1q_f32(acc,     vmlaq_n_f32(vld1q_f32(acc),     lo, gain));
+    vst1q_f32(acc + 4, vmlaq_n_f32(vld1q_f32(acc + 4), hi, gain));
+}
+#endif
+
+/**
+    Scale a stream and add it to the mix on the 16 bit scale
+*/
+static void _accumulate_u8(const uint8_t* in, float* acc, int numSamples, float gain)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vGain = _mm_set1_ps(gain);
+    const __m128i vBias = _mm_set1_epi8((char)0x80);
+    const __m128i zero = _mm_setzero_si128();
+
+    for(; i + 16 <= numSamples; i += 16){
+        // flip to signed and move each sample into the high byte of a 16 bit lane
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + i)), vBias);
+        _accumulate8(_mm_unpacklo_epi8(zero, x), acc + i, vGain);
+        _accumulate8(_mm_unpackhi_epi8(zero, x), acc + i + 8, vGain);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t vBias = vdupq_n_u8(0x80);
+
+    for(; i + 16 <= numSamples; i += 16){
+        int8x16_t x = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(in + i), vBias));
+        _accumulate8(vshll_n_s8(vget_low_s8(x), 8), acc + i, gain);
+        _accumulate8(vshll_n_s8(vget_high_s8(x), 8), acc + i + 8, gain);
+    }
+#endif
+
+    for(; i < numSamples; ++i) acc[i] += (in[i] - 0x80) * 256.0f * gain;
+}
+
+static void _accumulate_s16(const int16_t* in, float* acc, int numSamples, float gain)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vGain = _mm_set1_ps(gain);
+
+    for(; i + 8 <= numSamples; i += 8){
+        _accumulate8(_mm_loadu_si128((const __m128i*)(in + i)), acc + i, vGain);
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 8 <= numSamples; i += 8){
+        _accumulate8(vld1q_s16(in + i), acc + i, gain);
+    }
+#endif
+
+    for(; i < numSamples; ++i) acc[i] += in[i] * gain;
+}
+
+static void _accumulate_f32(const float* in, float* acc, int numSamples, float gain)
+{
+    const float scale = gain * 32768.0f;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vScale = _mm_set1_ps(scale);
+
+    for(; i + 4 <= numSamples; i += 4){
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(in + i), vScale);
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), x));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= numSamples; i += 4){
+        vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), vld1q_f32(in + i), scale));
+    }
+#endif
+
+    for(; i < numSamples; ++i) acc[i] += in[i] * scale;
+}
+
+static inline float _saturate(float x)
+{
+    return (x > MIXER_MAX_LEVEL) ? MIXER_MAX_LEVEL : ((x < MIXER_MIN_LEVEL) ? MIXER_MIN_LEVEL : x);
+}
+
+/**
+    Saturate the mix into the output format
+*/
+static void _store_u8(const float* acc, uint8_t* out, int numSamples)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vMax = _mm_set1_ps(MIXER_MAX_LEVEL);
+    const __m128 vMin = _mm_set1_ps(MIXER_MIN_LEVEL);
+    const __m128i vBias = _mm_set1_epi8((char)0x80);
+    __m128i s[4];
+    int k;
+
+    for(; i + 16 <= numSamples; i += 16){
+        for(k = 0; k < 4; ++k){
+            __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i + k * 4), vMin), vMax);
+            s[k] = _mm_srai_epi32(_mm_cvtps_epi32(x), 8);
+        }
+
+        __m128i x = _mm_packs_epi16(_mm_packs_epi32(s[0], s[1]), _mm_packs_epi32(s[2], s[3]));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(x, vBias));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t vMax = vdupq_n_f32(MIXER_MAX_LEVEL);
+    const float32x4_t vMin = vdupq_n_f32(MIXER_MIN_LEVEL);
+    int32x4_t s[4];
+    int k;
+
+    for(; i + 16 <= numSamples; i += 16){
+        for(k = 0; k < 4; ++k){
+            float32x4_t x = vminq_f32(vmaxq_f32(vld1q_f32(acc + i + k * 4), vMin), vMax);
+            s[k] = vshrq_n_s32(vcvtnq_s32_f32(x), 8);
+        }
+
+        int16x8_t lo = vcombine_s16(vqmovn_s32(s[0]), vqmovn_s32(s[1]));
+        int16x8_t hi = vcombine_s16(vqmovn_s32(s[2]), vqmovn_s32(s[3]));
+        int8x16_t x = vcombine_s8(vqmovn_s16(lo), vqmovn_s16(hi));
+        vst1q_u8(out + i, veorq_u8(vreinterpretq_u8_s8(x), vdupq_n_u8(0x80)));
+    }
+#endif
+
+    for(; i < numSamples; ++i) out[i] = (uint8_t)(((int)lrintf(_saturate(acc[i])) >> 8) + 0x80);
+}
+
+static void _store_s16(const float* acc, int16_t* out, int numSamples)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vMax = _mm_set1_ps(MIXER_MAX_LEVEL);
+    const __m128 vMin = _mm_set1_ps(MIXER_MIN_LEVEL);
+
+    for(; i + 8 <= numSamples; i += 8){
+        // clamp before converting, out of range floats convert to INT_MIN
+        __m128 lo = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), vMin), vMax);
+        __m128 hi = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i + 4), vMin), vMax);
+        __m128i x = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+        _mm_storeu_si128((__m128i*)(out + i), x);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for(; i + 8 <= numSamples; i += 8){
+        int16x4_t lo = vqmovn_s32(vcvtnq_s32_f32(vld1q_f32(acc + i)));
+        int16x4_t hi = vqmovn_s32(vcvtnq_s32_f32(vld1q_f32(acc + i + 4)));
+        vst1q_s16(out + i, vcombine_s16(lo, hi));
+    }
+#endif
+
+    for(; i < numSamples; ++i) out[i] = (int16_t)lrintf(_saturate(acc[i]));
+}
+
+static void _store_f32(const float* acc, float* out, int numSamples)
+{
+    const float scale = 1.0f / 32768.0f;
+    int i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vMax = _mm_set1_ps(MIXER_MAX_LEVEL);
+    const __m128 vMin = _mm_set1_ps(MIXER_MIN_LEVEL);
+    const __m128 vScale = _mm_set1_ps(scale);
+
+    for(; i + 4 <= numSamples; i += 4){
+        __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), vMin), vMax);
+        _mm_storeu_ps(out + i, _mm_mul_ps(x, vScale));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t vMax = vdupq_n_f32(MIXER_MAX_LEVEL);
+    const float32x4_t vMin = vdupq_n_f32(MIXER_MIN_LEVEL);
+
+    for(; i + 4 <= numSamples; i += 4){
+        float32x4_t x = vminq_f32(vmaxq_f32(vld1q_f32(acc + i), vMin), vMax);
+        vst1q_f32(out + i, vmulq_n_f32(x, scale));
+    }
+#endif
+
+    for(; i < numSamples; ++i) out[i] = _saturate(acc[i]) * scale;
+}
+
+StreamMixer::StreamMixer(QObject *parent) : QIODevice(parent)
+{
+    _latency = NULL;
+    _echo = NULL;
+    setFormat(8, 1, 8000);
+}
+
+void StreamMixer::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    QMutexLocker locker(&_sync);
+
+    _sampleSize = sampleSize;
+    _channels = (channels > 0) ? channels : 1;
+    _sampleRate = sampleRate;
+    _frameBytes = (_sampleSize / 8) * _channels;
+
+    QMap<uint8_t, StreamContext*>::iterator it;
+    for(it = _streams.begin(); it != _streams.end(); ++it){
+        it.value()->jitter->setFormat(_sampleSize, _channels, _sampleRate);
+    }
+}
+
+void StreamMixer::setLatencyMonitor(LatencyMonitor* monitor)
+{
+    QMutexLocker locker(&_sync);
+
+    _latency = monitor;
+}
+
+void StreamMixer::setEchoCanceller(EchoCanceller* canceller)
+{
+    QMutexLocker locker(&_sync);
+
+    _echo = canceller;
+}
+
+void StreamMixer::push(uint8_t sender, const QByteArray& chunk, uint16_t sequence, uint32_t timestamp)
+{
+    QMutexLocker locker(&_sync);
+
+    StreamContext* context = _streams.value(sender, NULL);
+
+    if(context == NULL){
+        context = createStream(sender);
+        if(context == NULL) return;
+    }
+
+    context->jitter->push(chunk, sequence, timestamp);
+}
+
+StreamMixer::StreamContext* StreamMixer::createStream(uint8_t sender)
+{
+    if(_streams.size() >= MIXER_MAX_STREAMS){
+        qDebug() << "StreamMixer: ignoring stream from " << sender << ", " << MIXER_MAX_STREAMS << " streams already playing";
+        return NULL;
+    }
+
+    qDebug() << "stream start: sender " << sender;
+
+    StreamContext* context = new StreamContext;
+    context->jitter = new JitterBuffer();
+    context->jitter->setFormat(_sampleSize, _channels, _sampleRate);
+    context->jitter->clear();
+    // the mixer pulls exactly one period, QIODevice must not read ahead
+    context->jitter->open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    context->gain = _gains.value(sender, 1.0f);
+    context->jitter->setLatencyMonitor(_latency, sender);
+
+    _streams.insert(sender, context);
+
+    return context;
+}
+
+void StreamMixer::endStream(uint8_t sender, StreamContext* context)
+{
+    JitterBuffer::Stats stats = context->jitter->getStats();
+    qDebug() << "stream end: sender " << sender << " received " << stats.received << " late " << stats.late
+             << " lost " << stats.lost << " dropped " << stats.dropped << " underruns " << stats.underruns
+             << " jitter " << stats.jitterMs << "ms target " << stats.targetMs << "ms";
+
+    context->jitter->close();
+    delete context->jitter;
+    delete context;
+}
+
+void StreamMixer::setGain(uint8_t sender, float gain)
+{
+    QMutexLocker locker(&_sync);
+
+    _gains.insert(sender, gain);
+
+    StreamContext* context = _streams.value(sender, NULL);
+    if(context != NULL) context->gain = gain;
+}
+
+void StreamMixer::clear()
+{
+    QMutexLocker locker(&_sync);
+
+    QMap<uint8_t, StreamContext*>::iterator it;
+    for(it = _streams.begin(); it != _streams.end(); ++it){
+        endStream(it.key(), it.value());
+    }
+
+    _streams.clear();
+}
+
+int StreamMixer::activeStreams() const
+{
+    QMutexLocker locker(&_sync);
+    return _streams.size();
+}
+
+bool StreamMixer::getStats(uint8_t sender, JitterBuffer::Stats& stats) const
+{
+    QMutexLocker locker(&_sync);
+
+    StreamContext* context = _streams.value(sender, NULL);
+    if(context == NULL) return false;
+
+    stats = context->jitter->getStats();
+    return true;
+}
+
+bool StreamMixer::open(OpenMode mode)
+{
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+qint64 StreamMixer::readData(char *data, qint64 maxlen)
+{
+    QMutexLocker locker(&_sync);
+
+    // whole frames only
+    maxlen -= maxlen % _frameBytes;
+
+    // no streams left, the output goes idle
+    if(_streams.isEmpty() || maxlen == 0) return 0;
+
+    const int sampleBytes = _sampleSize / 8;
+    const int numSamples = (int)(maxlen / sampleBytes);
+
+    // sized once for the device period, later periods reuse them
+    if(_mix.size() < numSamples) _mix.resize(numSamples);
+    if(_scratch.size() < maxlen) _scratch.resize((int)maxlen);
+
+    float* mix = _mix.data();
+    char* scratch = _scratch.data();
+    memset(mix, 0, numSamples * sizeof(float));
+
+    QMap<uint8_t, StreamContext*>::iterator it = _streams.begin();
+    while(it != _streams.end()){
+        StreamContext* context = it.value();
+
+        // the jitter buffer conceals gaps, a short read only happens when its stream ends
+        qint64 n = context->jitter->read(scratch, maxlen);
+
+        if(n <= 0){
+            endStream(it.key(), context);
+            it = _streams.erase(it);
+            continue;
+        }
+
+        if(_sampleSize == 32)
+            _accumulate_f32((const float*)scratch, mix, (int)(n / sampleBytes), context->gain);
+        else if(_sampleSize == 16)
+            _accumulate_s16((const int16_t*)scratch, mix, (int)(n / sampleBytes), context->gain);
+        else
+            _accumulate_u8((const uint8_t*)scratch, mix, (int)n, context->gain);
+
+        ++it;
+    }
+
+    if(_streams.isEmpty()) return 0;
+
+    if(_sampleSize == 32)
+        _store_f32(mix, (float*)data, numSamples);
+    else if(_sampleSize == 16)
+        _store_s16(mix, (int16_t*)data, numSamples);
+    else
+        _store_u8(mix, (uint8_t*)data, numSamples);
+
+    if(_echo != NULL) _echo->playback(data, maxlen);
+
+    return maxlen;
+}
+
+qint64 StreamMixer::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(len);
+
+    qDebug() << "StreamMixer: use push() to add audio";
+    return -1;
+}
+
+bool StreamMixer::isSequential() const
+{
+    return true;
+}
+
+qint64 StreamMixer::bytesAvailable() const
+{
+    QMutexLocker locker(&_sync);
+
+    // the mix lasts as long as the deepest stream
+    qint64 available = 0;
+
+    QMap<uint8_t, StreamContext*>::const_iterator it;
+    for(it = _streams.constBegin(); it != _streams.constEnd(); ++it){
+        qint64 buffered = it.value()->jitter->bytesAvailable();
+        if(buffered > available) available = buffered;
+    }
+
+    return available + QIODevice::bytesAvailable();
+}
+
+StreamMixer::~StreamMixer()
+{
+    clear();
+}
@@ -0,0 +1,178 @@
+#ifndef STREAMMIXER_H
+#define STREAMMIXER_H
+
+#include <cstdint>
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QVector>
+
+#include "jitterbuffer.h"
+#include "echocanceller.h"
+
+#define MIXER_MAX_STREAMS 16 ///< most senders mixed at once, further senders are ignored until one ends
+
+/**
+    Mixes the received streams of several senders into one output
+
+    Every sender gets its own stream context, a jitter buffer that orders, paces and conceals its audio.
+    Each audio period the mixer pulls the same amount of audio from every context, scales it by the
+    sender's gain, sums it on the 16 bit scale and saturates the sum into the output format. A context
+    is removed once its stream ends, and the mixer reports the end of input when no streams are left.
+*/
+class StreamMixer : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit StreamMixer(QObject *parent = 0);
+    ~StreamMixer(void);
+
+    /**
+        Set the format of the audio played out
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Add a received chunk to the stream of its sender
+
+        @param sender
+            station id of the sender
+
+        @param chunk
+            audio in the playout format
+
+        @param sequence
+            sequence number of the chunk
+
+        @param timestamp
+            sender time of the chunk in milliseconds
+    */
+    void push(uint8_t sender, const QByteArray& chunk, uint16_t sequence, uint32_t timestamp);
+
+    /**
+        Set the gain applied to a sender's stream, kept for later streams of the sender
+
+        @param sender
+            station id of the sender
+
+        @param gain
+            linear gain, 1 plays the stream unchanged
+    */
+    void setGain(uint8_t sender, float gain);
+
+    /**
+        Report stream latency, applies to streams started from now on
+
+        @param monitor
+            records when chunks play, NULL to stop reporting
+    */
+    void setLatencyMonitor(LatencyMonitor* monitor);
+
+    /**
+        Hand the mixed output to an echo canceller as its reference
+
+        @param canceller
+            receives every period played, NULL to stop
+    */
+    void setEchoCanceller(EchoCanceller* canceller);
+
+    /**
+        Drop every stream
+    */
+    void clear();
+
+    /**
+        @return the number of streams being mixed
+    */
+    int activeStreams() const;
+
+    /**
+        Get the playout statistics of a sender's stream
+
+        @param sender
+            station id of the sender
+
+        @param stats
+            set to the statistics
+
+        @return false if the sender has no stream
+    */
+    bool getStats(uint8_t sender, JitterBuffer::Stats& stats) const;
+
+    /**
+        Reimplemented QIODevice::open(), the mixer is always unbuffered
+    */
+    bool open(OpenMode mode);
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+protected:
+    /**
+        Reimplemented QIODevice::readData(), mixes one period for the audio output
+    */
+    qint64 readData(char *data, qint64 maxlen);
+
+    /**
+        Reimplemented QIODevice::writeData(), chunks are added with push()
+    */
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    //! A sender's stream
+    struct StreamContext{
+        JitterBuffer* jitter;  ///< orders and paces the sender's audio
+        float gain;            ///< gain applied when mixing
+    };
+
+    //! streams keyed by sender id
+    QMap<uint8_t, StreamContext*> _streams;
+    //! gains set per sender
+    QMap<uint8_t, float> _gains;
+    //! told when stream chunks play
+    LatencyMonitor* _latency;
+    //! told what is played, NULL if echo cancellation is off
+    EchoCanceller* _echo;
+
+    //! bits per sample
+    int _sampleSize;
+    //! interleaved channels
+    int _channels;
+    //! samples per second
+    int _sampleRate;
+    //! bytes per sample frame
+    int _frameBytes;
+
+    //! sum of the streams on the 16 bit scale, sized to the largest period read
+    QVector<float> _mix;
+    //! audio of one stream for the period
+    QVector<char> _scratch;
+
+    //! Thread synchronization
+    mutable QMutex _sync;
+
+    /**
+        Create the context of a new sender
+
+        @return the context, NULL if the mixer is full
+    */
+    StreamContext* createStream(uint8_t sender);
+
+    /**
+        Log the statistics of an ended stream and free its context
+    */
+    void endStream(uint8_t sender, StreamContext* context);
+};
+
+#endif // STREAMMIXER_H
@@ -0,0 +1,156 @@
+
+/**
+    @file vad.cpp
+    @breif Voice activity detection and comfort noise
+    @author Natesh Narain
+*/
+
+#include "vad.h"
+
+#include <cmath>
+#include <cstring>
+
+#define VAD_WINDOW_MS      20      ///< length of an analysis window
+#define VAD_HANGOVER_MS    300     ///< speech held after the last speech window
+#define VAD_ENERGY_FLOOR   90000.0 ///< minimum speech energy, an RMS of 300 on the 16 bit scale
+#define VAD_SPEECH_RATIO   8.0     ///< voiced speech is 9 dB above the noise floor
+#define VAD_UNVOICED_RATIO 3.0     ///< unvoiced speech is 5 dB above the noise floor...
+#define VAD_UNVOICED_ZCR   0.3     ///< ...with a high zero crossing rate
+#define VAD_NOISE_ADAPT    0.1     ///< noise floor tracking rate in silence
+#define VAD_NOISE_DRIFT    0.002   ///< noise floor tracking rate during speech
+
+static inline int _linear(uint8_t sample){ return (sample - 0x80) * 256; }
+static inline int _linear(int16_t sample){ return sample; }
+static inline int _linear(float sample){ return (int)((sample > 1.0f) ? 32767.0f : ((sample < -1.0f) ? -32768.0f : sample * 32767.0f)); }
+
+template<typename T>
+static void _windowStats(const T* samples, int numSamples, int channels, double* energy, double* zeroCrossingRate)
+{
+    double sum = 0;
+    int crossings = 0;
+    int i;
+
+    for(i = 0; i < numSamples; ++i){
+        int x = _linear(samples[i]);
+        sum += (double)x * x;
+
+        // compare against the previous sample of the same channel
+        if(i >= channels && ((x < 0) != (_linear(samples[i - channels]) < 0))) crossings++;
+    }
+
+    *energy = (numSamples > 0) ? sum / numSamples : 0;
+    *zeroCrossingRate = (numSamples > channels) ? (double)crossings / (numSamples - channels) : 0;
+}
+
+VoiceActivityDetector::VoiceActivityDetector()
+{
+    setFormat(8, 1, 8000);
+}
+
+void VoiceActivityDetector::setFormat(int sampleSize, int channels, int sampleRate)
+{
+    _sampleSize = sampleSize;
+    _channels = (channels > 0) ? channels : 1;
+    _windowSamples = (sampleRate * VAD_WINDOW_MS / 1000) * _channels;
+    if(_windowSamples < _channels) _windowSamples = _channels;
+
+    reset();
+}
+
+void VoiceActivityDetector::reset()
+{
+    _noiseFloor = VAD_ENERGY_FLOOR / VAD_SPEECH_RATIO;
+    _hangover = 0;
+    _seeded = false;
+}
+
+bool VoiceActivityDetector::process(const QByteArray& pcm)
+{
+    const int bytesPerSample = _sampleSize / 8;
+    const int numSamples = pcm.size() / bytesPerSample;
+    bool speech = false;
+    int i;
+
+    for(i = 0; i < numSamples; i += _windowSamples){
+        int n = (numSamples - i < _windowSamples) ? numSamples - i : _windowSamples;
+        double energy, zcr;
+
+        if(_sampleSize == 32)
+            _windowStats((const float*)pcm.data() + i, n, _channels, &energy, &zcr);
+        else if(_sampleSize == 16)
+            _windowStats((const int16_t*)pcm.data() + i, n, _channels, &energy, &zcr);
+        else
+            _windowStats((const uint8_t*)pcm.data() + i, n, _channels, &energy, &zcr);
+
+        if(processWindow(energy, zcr, n)) speech = true;
+    }
+
+    return speech;
+}
+
+bool VoiceActivityDetector::processWindow(double energy, double zeroCrossingRate, int numSamples)
+{
+    // the first window is taken as background
+    if(!_seeded){
+        _noiseFloor = energy;
+        _seeded = true;
+    }
+
+    bool aboveFloor = energy > VAD_ENERGY_FLOOR;
+    bool voiced = aboveFloor && energy > _noiseFloor * VAD_SPEECH_RATIO;
+    bool unvoiced = aboveFloor && energy > _noiseFloor * VAD_UNVOICED_RATIO && zeroCrossingRate > VAD_UNVOICED_ZCR;
+
+    if(voiced || unvoiced){
+        _hangover = (_windowSamples * VAD_HANGOVER_MS) / VAD_WINDOW_MS;
+
+        // follow a slowly rising background so it is not mistaken for speech forever
+        _noiseFloor += (energy - _noiseFloor) * VAD_NOISE_DRIFT;
+
+        return true;
+    }
+
+    // drop to a quieter background immediately, rise slowly
+    if(energy < _noiseFloor)
+        _noiseFloor = energy;
+    else
+        _noiseFloor += (energy - _noiseFloor) * VAD_NOISE_ADAPT;
+
+    if(_hangover > 0){
+        _hangover -= numSamples;
+        return true;
+    }
+
+    return false;
+}
+
+QByteArray VoiceActivityDetector::getSilenceDescriptor(const QByteArray& pcm) const
+{
+    SilenceDescriptor descriptor;
+    descriptor.lNumFrames = pcm.size() / ((_sampleSize / 8) * _channels);
+    descriptor.wNoiseLevel = getNoiseLevel();
+    descriptor.wReserved = 0;
+
+    return QByteArray((const char*)&descriptor, sizeof(SilenceDescriptor));
+}
+
+uint16_t VoiceActivityDetector::getNoiseLevel() const
+{
+    double rms = sqrt(_noiseFloor);
+    return (rms > UINT16_MAX) ? UINT16_MAX : (uint16_t)rms;
+}
+
+void VoiceActivityDetector::comfortNoise(int16_t* out, int numSamples, uint16_t level, uint32_t* seed)
+{
+    // uniform noise with an amplitude of sqrt(3) * rms has the requested rms
+    int amplitude = (int)(level * 1.7320508);
+    if(amplitude > INT16_MAX) amplitude = INT16_MAX;
+
+    int i;
+    for(i = 0; i < numSamples; ++i){
+        *seed = *seed * 1664525u + 1013904223u;
+
+        // top 16 bits as a signed value in [-32768, 32767]
+        int r = (int16_t)(*seed >> 16);
+        out[i] = (int16_t)((r * amplitude) >> 15);
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef VAD_H
+#define VAD_H
+
+#include <cstdint>
+
+#include <QByteArray>
+
+//! Payload of a silence frame, describes the comfort noise to play in place of the audio
+typedef struct silenceDescriptor{
+    uint32_t lNumFrames;  ///< number of sample frames of silence
+    uint16_t wNoiseLevel; ///< RMS level of the background noise, 16 bit scale
+    uint16_t wReserved;   ///< unused
+}SilenceDescriptor;
+
+/**
+    Energy and zero crossing based voice activity detection
+
+    Audio is analysed in short windows. A window is speech when its energy is well above the tracked
+    noise floor, or moderately above it with the high zero crossing rate of unvoiced speech. Speech is
+    held for a hangover period so word endings are not cut.
+*/
+class VoiceActivityDetector
+{
+public:
+    VoiceActivityDetector(void);
+
+    /**
+        Set the format of the analysed audio
+
+        @param sampleSize
+            bits per sample, 8 (unsigned), 16 (signed) or 32 (float)
+
+        @param channels
+            number of interleaved channels
+
+        @param sampleRate
+            samples per second
+    */
+    void setFormat(int sampleSize, int channels, int sampleRate);
+
+    /**
+        Reset the noise floor and hangover, used when a stream starts
+    */
+    void reset();
+
+    /**
+        Analyse a block of audio
+
+        @param pcm
+            audio in the set format
+
+        @return true if the block contains speech
+    */
+    bool process(const QByteArray& pcm);
+
+    /**
+        Build the silence frame that replaces a block of audio
+
+        @param pcm
+            the silent audio
+
+        @return the SilenceDescriptor payload
+    */
+    QByteArray getSilenceDescriptor(const QByteArray& pcm) const;
+
+    /**
+        @return the RMS of the background noise on the 16 bit scale
+    */
+    uint16_t getNoiseLevel() const;
+
+    /**
+        Generate comfort noise
+
+        @param out
+            buffer to put the 16 bit samples
+
+        @param numSamples
+            number of samples to generate
+
+        @param level
+            RMS level of the noise
+
+        @param seed
+            generator state, carried between calls
+    */
+    static void comfortNoise(int16_t* out, int numSamples, uint16_t level, uint32_t* seed);
+
+private:
+    //! bits per sample
+    int _sampleSize;
+    //! interleaved channels
+    int _channels;
+    //! samples per analysis window
+    int _windowSamples;
+
+    //! tracked noise energy
+    double _noiseFloor;
+    //! samples of speech left to hold, frames shorter than a window count for their length
+    int _hangover;
+    //! noise floor has been seeded
+    bool _seeded;
+
+    /**
+        Analyse one window
+
+        @param numSamples
+            samples in the window, the last window of a block may be short
+
+        @return true if the window is speech
+    */
+    bool processWindow(double energy, double zeroCrossingRate, int numSamples);
+};
+
+#endif // VAD_H